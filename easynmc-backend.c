@@ -0,0 +1,208 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup backend_api Device backends
+ * Everything the library does with a core goes through a device backend:
+ * opening the io/mem descriptors, mapping internal memory and the
+ * IOCTL_NMC3_* requests. The default backend talks to the easynmc kernel 
+ * driver. easynmc_sim_backend emulates cores in-process, so that the host
+ * side can be exercised and benchmarked without a board.
+ *
+ * The backend is selected once per process: either explicitly with 
+ * easynmc_set_backend() before any core is opened, or with the 
+ * EASYNMC_BACKEND environment variable ("driver" or "sim").
+ *
+ * \addtogroup backend_api
+ * @{
+ */
+
+static const struct easynmc_backend *g_backend;
+
+/**
+ * Select the device backend for this process. 
+ * Must be called before any core is opened.
+ *
+ * @param b
+ * @return 0 if OK, -1 if another backend is already in use
+ */
+int easynmc_set_backend(const struct easynmc_backend *b)
+{
+	if (g_backend && (g_backend != b)) {
+		err("Backend %s is already in use\n", g_backend->name);
+		return -1;
+	}
+	g_backend = b;
+	return 0;
+}
+
+/**
+ * Get the device backend in use, selecting one if needed.
+ *
+ * @return
+ */
+const struct easynmc_backend *easynmc_get_backend(void)
+{
+	const char *name;
+
+	if (g_backend)
+		return g_backend;
+
+	name = getenv("EASYNMC_BACKEND");
+	if (name && (0 == strcmp(name, easynmc_sim_backend.name)))
+		g_backend = &easynmc_sim_backend;
+	else
+		g_backend = &easynmc_driver_backend;
+
+	dbg("Using %s backend\n", g_backend->name);
+	return g_backend;
+}
+
+/**
+ * Issue an IOCTL_NMC3_* request to the core via its backend
+ *
+ * @param h
+ * @param req
+ * @param arg
+ * @return
+ */
+int easynmc_ioctl(struct easynmc_handle *h, unsigned long req, void *arg)
+{
+	return h->dev->backend->ioctl(h->dev, req, arg);
+}
+
+
+static int driver_probe(int *ids, int max)
+{
+	DIR *dir = opendir("/dev");
+	struct dirent *de;
+	int num = 0;
+
+	if (!dir) {
+		err("Couldn't open /dev\n");
+		return -1;
+	}
+
+	while ((num < max) && (de = readdir(dir))) {
+		int id, len = 0;
+		if ((sscanf(de->d_name, "nmc%dio%n", &id, &len) != 1) ||
+		    (len != strlen(de->d_name)) || (id < 0))
+			continue;
+		ids[num++] = id;
+	}
+	closedir(dir);
+	return num;
+}
+
+static int driver_open(struct easynmc_device *dev, int flags)
+{
+	char path[64];
+	uint32_t maplen;
+
+	dev->memfd = -1;
+
+	sprintf(path, "/dev/nmc%dio", dev->id);
+	dev->iofd = open(path, O_RDWR | O_CLOEXEC);
+	if (dev->iofd == -1) {
+		err("Couldn't open NMC IO device\n");
+		goto err;
+	}
+
+	sprintf(path, "/dev/nmc%dmem", dev->id);
+	dev->memfd = open(path, O_RDWR | O_CLOEXEC);
+	if (dev->memfd == -1) {
+		err("Couldn't open NMC MEM device\n");
+		goto errcloseiofd;
+	}
+
+	if (0 != ioctl(dev->iofd, IOCTL_NMC3_GET_IMEMSZ, &dev->imem_size)) {
+		err("Couldn't get NMC internal memory size\n");
+		goto errclosememfd;
+	}
+
+	/* The IPL registers all live in the first page */
+	maplen = dev->imem_size;
+	if ((flags & EASYNMC_DEV_REGS_ONLY) && (sysconf(_SC_PAGESIZE) < maplen))
+		maplen = sysconf(_SC_PAGESIZE);
+
+	dev->imem = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, dev->memfd, 0);
+	if (dev->imem == MAP_FAILED) {
+		err("Couldn't MMAP internal memory\n");
+		goto errclosememfd;
+	}
+	dev->priv = (void *) (uintptr_t) maplen;
+
+	dbg("Opened core %d iofd %d memfd %d. mmap imem %u bytes @ 0x%lx\n",
+	    dev->id, dev->iofd, dev->memfd, maplen, (unsigned long) dev->imem);
+	return 0;
+
+errclosememfd:
+	close(dev->memfd);
+errcloseiofd:
+	close(dev->iofd);
+err:
+	err("Device was: %s\n", path);
+	return -1;
+}
+
+static void driver_close(struct easynmc_device *dev)
+{
+	munmap(dev->imem, (uintptr_t) dev->priv);
+	close(dev->iofd);
+	close(dev->memfd);
+}
+
+static int driver_ioctl(struct easynmc_device *dev, unsigned long req, void *arg)
+{
+	return ioctl(dev->iofd, req, arg);
+}
+
+const struct easynmc_backend easynmc_driver_backend = {
+	.name  = "driver",
+	.probe = driver_probe,
+	.open  = driver_open,
+	.close = driver_close,
+	.ioctl = driver_ioctl,
+};
+
+/**
+ * @}
+ */
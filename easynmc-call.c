@@ -0,0 +1,214 @@
+/*
+ * libEasyNMC DSP communication library.
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup call_api Function calls
+ * An app can export a table of functions with EASYNMC_CALLS(table, count,
+ * argslen, stacklen) macro (See easynmc.mlb). Once the app is loaded, the
+ * host calls any of them with easynmc_call() and gets the return value,
+ * like launching a kernel: the IPL looks the function up, calls it on the
+ * app's call stack with a pointer to the argument block and goes back to
+ * idle. Nothing is reloaded and stdio is not involved.
+ *
+ * Functions are called without the app's startup code, so they must not
+ * depend on anything main() sets up. Needs an IPL with EASYNMC_IPL_CAP_CALL.
+ *
+ * \addtogroup call_api
+ * @{
+ */
+
+#define CALL_TABLE    0
+#define CALL_COUNT    1
+#define CALL_ARGSLEN  2
+#define CALL_STACK    3
+#define CALL_ARGS     4
+
+static uint32_t *call_hdr(struct easynmc_handle *h)
+{
+	uint32_t *hdr;
+	uint32_t words = h->imem_size / 4;
+
+	if (!h->calloffset) {
+		err("No function table found for this handle\n");
+		return NULL;
+	}
+
+	hdr = &h->imem32[h->calloffset];
+	if (((uint64_t) h->calloffset + CALL_ARGS + hdr[CALL_ARGSLEN] > words) ||
+	    ((uint64_t) hdr[CALL_TABLE] + hdr[CALL_COUNT] > words) ||
+	    (hdr[CALL_STACK] >= words)) {
+		err("Corrupted function table\n");
+		return NULL;
+	}
+	return hdr;
+}
+
+static int call_done(struct easynmc_handle *h)
+{
+	/* The IPL clears the command before it calls, and is idle after the return */
+	return !h->imem32[NMC_REG_CORE_START] &&
+		(h->imem32[NMC_REG_CORE_STATUS] == EASYNMC_CORE_IDLE);
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Get the number of functions the loaded app exports.
+ *
+ * @param h
+ * @return number of functions, -1 if the app has no function table
+ */
+int easynmc_call_count(struct easynmc_handle *h)
+{
+	uint32_t *hdr = call_hdr(h);
+	return hdr ? hdr[CALL_COUNT] : -1;
+}
+
+/**
+ * Call a function from the app's table and wait for it to return.
+ * The core must be idle. If the call times out the function is still
+ * running, easynmc_stop_app() gets the core back.
+ *
+ * @param h
+ * @param fn index in the function table
+ * @param args copied to the argument block
+ * @param nargs at most argslen of the table
+ * @param ret the return value, may be NULL
+ * @param timeout ms
+ * @return 0 if OK, -1 on error, -2 on timeout
+ */
+int easynmc_call(struct easynmc_handle *h, uint32_t fn, const uint32_t *args, int nargs,
+		 uint32_t *ret, uint32_t timeout)
+{
+	uint32_t *hdr = call_hdr(h);
+	struct easynmc_token *t = NULL;
+	enum easynmc_core_state s;
+	uint64_t deadline;
+	uint32_t irqs;
+	int evt, res = 0;
+
+	if (!hdr)
+		return -1;
+
+	if (!(easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_CALL)) {
+		err("IPL on core %d can't call functions, update it\n", h->id);
+		return -1;
+	}
+
+	if (fn >= hdr[CALL_COUNT]) {
+		err("No function %u, the app exports %u\n", fn, hdr[CALL_COUNT]);
+		return -1;
+	}
+
+	if ((nargs < 0) || (nargs > hdr[CALL_ARGSLEN])) {
+		err("Function takes at most %u arguments\n", hdr[CALL_ARGSLEN]);
+		return -1;
+	}
+
+	s = easynmc_core_state(h);
+	if (s != EASYNMC_CORE_IDLE) { 
+		err("Core is in state %s, must be idle\n", easynmc_state_name(s));
+		return -1;
+	}
+
+	/* 
+	 * The IPL raises the completion interrupts set in NMC_REG_ISR_ON_START 
+	 * when it is back to idle, arm the token before the call. With none 
+	 * set the state is polled. 
+	 */
+	irqs = h->imem32[NMC_REG_ISR_ON_START];
+	if (irqs & (EASYNMC_DONE_IRQ_HP | EASYNMC_DONE_IRQ_LP)) {
+		t = easynmc_token_new(h, ((irqs & EASYNMC_DONE_IRQ_HP) ? EASYNMC_EVT_HP : 0) | 
+				      ((irqs & EASYNMC_DONE_IRQ_LP) ? EASYNMC_EVT_LP : 0));
+		if (!t)
+			return -1;
+	}
+
+	if (nargs && (0 != easynmc_write(h, (h->calloffset + CALL_ARGS) << 2, args,
+					 nargs * sizeof(uint32_t)))) {
+		res = -1;
+		goto bailout;
+	}
+
+	h->imem32[NMC_REG_CALL_FN]    = fn;
+	h->imem32[NMC_REG_CALL_ARGS]  = h->calloffset + CALL_ARGS;
+	h->imem32[NMC_REG_CALL_TABLE] = hdr[CALL_TABLE];
+	h->imem32[NMC_REG_CALL_STACK] = hdr[CALL_STACK];
+	if (0 != easynmc_ipl_command(h, NMC_CMD_CALL, 0)) {
+		res = -1;
+		goto bailout;
+	}
+
+	deadline = now_ms() + timeout;
+	while (!call_done(h)) {
+		uint64_t now = now_ms();
+		if (now >= deadline) {
+			res = -2;
+			break;
+		}
+		if (!t) {
+			usleep(100);
+			continue;
+		}
+		/* The app may raise the same interrupts, so there may be nothing for us */
+		evt = easynmc_token_wait(t, deadline - now);
+		if (evt & (EASYNMC_EVT_ERROR | EASYNMC_EVT_CANCELLED)) {
+			res = -1;
+			break;
+		}
+	}
+
+	if (res == -2) {
+		err("Function %u on core %d timed out\n", fn, h->id);
+	} else if ((res == 0) && ret) {
+		*ret = h->imem32[NMC_REG_PROG_RETURN];
+	}
+
+	dbg("Called function %u on core %d: %d\n", fn, h->id, res);
+
+bailout:
+	free(t);
+	return res;
+}
+
+/**
+ * @}
+ */
@@ -31,6 +31,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
 #include <libelf.h>
 #include <gelf.h>
 #include <easynmc.h>
@@ -48,8 +53,19 @@ int g_libeasynmc_errors = 1;
 	}
 
 
+#define IPL_ACK_TIMEOUT_MS         100
+#define IPL_ACK_POLL_US            20
+#define IPL_FILL_MIN               4096  /* Bytes, smaller sections are zeroed by the host */
+
 static uint32_t supported_startupcodes[] = {
-	0x20140715,
+	EASYNMC_LEGACY_STARTUPCODE,
+	0x20261018, /* No function calls */
+	0x20261019, /* Polling idle loop */
+	0x20261020, /* Completion HP only */
+	0x20261021, /* No CRC command */
+	0x20261022, /* No fill and copy commands */
+	0x20261023, /* No run timing */
+	EASYNMC_IPL_VERSION,
 };
 
 
@@ -77,6 +93,42 @@ int easynmc_startupcode_is_compatible(uint32_t codever)
 	return 0;
 }
 
+/**
+ * Query the capabilities of the IPL running on the core.
+ * Legacy IPLs have a short register block and report no capabilities.
+ *
+ * @param h
+ * @return bitmask of EASYNMC_IPL_CAP_*
+ */
+uint32_t easynmc_ipl_caps(struct easynmc_handle *h)
+{
+	uint32_t codever = h->imem32[NMC_REG_CODEVERSION];
+
+	if ((codever == EASYNMC_LEGACY_STARTUPCODE) || 
+	    !easynmc_startupcode_is_compatible(codever))
+		return 0;
+
+	return h->imem32[NMC_REG_IPL_CAPS];
+}
+
+/**
+ * Check if a range of core memory belongs to the IPL, i.e. overlaps
+ * NMC_IPL_AREA_LEN words at the start or the NMC_IPL_EXT_ADDR area.
+ *
+ * @param addr words
+ * @param len words
+ * @return 1 if it does, 0 otherwise
+ */
+int easynmc_ipl_owns(uint32_t addr, uint32_t len)
+{
+	uint64_t end = (uint64_t) addr + len;
+
+	if (!len)
+		return 0;
+	return (addr < NMC_IPL_AREA_LEN) || 
+		((addr < NMC_IPL_EXT_ADDR + NMC_IPL_EXT_LEN) && (end > NMC_IPL_EXT_ADDR));
+}
+
 /**
  * Query current core state.
  *
@@ -87,7 +139,7 @@ enum easynmc_core_state easynmc_core_state(struct easynmc_handle *h)
 {
 	struct nmc_core_stats stats; 
 	int ret;
-	ret = ioctl(h->iofd, IOCTL_NMC3_GET_STATS, &stats);
+	ret = easynmc_ioctl(h, IOCTL_NMC3_GET_STATS, &stats);
 	if (ret != 0) {
 		perror("ioctl");
 		return EASYNMC_CORE_INVALID;
@@ -103,7 +155,9 @@ enum easynmc_core_state easynmc_core_state(struct easynmc_handle *h)
 	
 	uint32_t status  = h->imem32[NMC_REG_CORE_STATUS];
 	if (status > EASYNMC_CORE_INVALID)
-		return EASYNMC_CORE_INVALID;
+		status = EASYNMC_CORE_INVALID;
+	if (h->rec)
+		easynmc_record_state(h, status);
 	return status;
 }
 
@@ -138,7 +192,7 @@ const char* easynmc_state_name(enum easynmc_core_state state)
  */
 int easynmc_get_core_name(struct easynmc_handle *h, char* str)
 {
-	return ioctl(h->iofd, IOCTL_NMC3_GET_NAME, str);
+	return easynmc_ioctl(h, IOCTL_NMC3_GET_NAME, str);
 }
 
 /**
@@ -150,7 +204,7 @@ int easynmc_get_core_name(struct easynmc_handle *h, char* str)
  */
 int easynmc_get_core_type(struct easynmc_handle *h, char* str)
 {
-	return ioctl(h->iofd, IOCTL_NMC3_GET_TYPE, str);
+	return easynmc_ioctl(h, IOCTL_NMC3_GET_TYPE, str);
 }
 
 /**
@@ -162,7 +216,8 @@ int easynmc_get_core_type(struct easynmc_handle *h, char* str)
  */
 int easynmc_send_irq(struct easynmc_handle *h, enum nmc_irq irq)
 {
-	return ioctl(h->iofd, IOCTL_NMC3_SEND_IRQ, &irq);
+	easynmc_record(h, EASYNMC_REC_IRQ, irq, 0, NULL, 0);
+	return easynmc_ioctl(h, IOCTL_NMC3_SEND_IRQ, &irq);
 }
 
 /**
@@ -176,7 +231,14 @@ int easynmc_send_irq(struct easynmc_handle *h, enum nmc_irq irq)
  */
 int easynmc_reset_stats(struct easynmc_handle *h)
 {
-	return ioctl(h->iofd, IOCTL_NMC3_RESET_STATS, NULL);
+	/* Run stats kept by the IPL go along with the driver ones */
+	if (easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_TIMING) { 
+		h->imem32[NMC_REG_RUN_COUNT] = 0;
+		h->imem32[NMC_REG_RUN_LAST]  = 0;
+		h->imem32[NMC_REG_RUN_BUSY]  = 0;
+		h->imem32[NMC_REG_RUN_IDLE]  = 0;
+	}
+	return easynmc_ioctl(h, IOCTL_NMC3_RESET_STATS, NULL);
 }
 
 
@@ -187,7 +249,7 @@ int easynmc_reset_stats(struct easynmc_handle *h)
  */
 void easynmc_reset_core(struct easynmc_handle *h)
 {
-	ioctl(h->iofd, IOCTL_NMC3_RESET, NULL);
+	easynmc_ioctl(h, IOCTL_NMC3_RESET, NULL);
 }
 
 
@@ -232,65 +294,149 @@ char *easynmc_get_default_ipl(char* name, int debug)
 
 }
 
+/**
+ * Returns the IPL built into the library for this core, if any.
+ * See nmc-iplgen.c, the plans are made at build time from the IPL built
+ * in ipl/ or, without NMSDK, from prebuilt-ipl/.
+ *
+ * @param name
+ * @param debug
+ * @return the load plan or NULL
+ */
+const struct easynmc_ipl_plan *easynmc_get_builtin_ipl(const char *name, int debug)
+{
+	const struct easynmc_ipl_plan *p;
+
+	for (p = easynmc_ipl_plans; p->core; p++)
+		if ((0 == strcmp(p->core, name)) && (p->debug == !!debug))
+			return p;
+	return NULL;
+}
+
+/*
+ * Process-wide table of per-core descriptors and imem mappings, keyed by
+ * backend and core id. Every handle is just a lightweight view (filters, 
+ * args, reservation) on top of a shared, reference-counted mapping, so 
+ * opening a core that already has a handle is nearly free. A mapping is 
+ * released with the last handle using it.
+ */
+struct easynmc_mapping {
+	struct easynmc_device dev;
+	int       refcount;
+	struct easynmc_mapping *next;
+};
+
+static struct easynmc_mapping *g_mappings = NULL;
+static pthread_mutex_t g_mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct easynmc_mapping *mapping_create(const struct easynmc_backend *b, int coreid)
+{
+	struct easynmc_mapping *m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+
+	m->dev.id      = coreid;
+	m->dev.backend = b;
+	if (0 != b->open(&m->dev, 0)) {
+		free(m);
+		return NULL;
+	}
+	return m;
+}
+
+static void mapping_destroy(struct easynmc_mapping *m)
+{
+	m->dev.backend->close(&m->dev);
+	free(m);
+}
+
+static struct easynmc_mapping *mapping_get(int coreid)
+{
+	const struct easynmc_backend *b = easynmc_get_backend();
+	struct easynmc_mapping *m;
+
+	pthread_mutex_lock(&g_mappings_lock);
+	/* Core 0 of the simulator is not core 0 of the board */
+	for (m = g_mappings; m; m = m->next)
+		if ((m->dev.id == coreid) && (m->dev.backend == b))
+			break;
+
+	if (!m) {
+		m = mapping_create(b, coreid);
+		if (m) {
+			m->next = g_mappings;
+			g_mappings = m;
+		}
+	} else {
+		dbg("Reusing cached mapping for core %d\n", coreid);
+	}
+
+	if (m)
+		m->refcount++;
+	pthread_mutex_unlock(&g_mappings_lock);
+	return m;
+}
+
+static void mapping_put(struct easynmc_mapping *m)
+{
+	struct easynmc_mapping **pm;
+
+	pthread_mutex_lock(&g_mappings_lock);
+	if (--m->refcount == 0) {
+		for (pm = &g_mappings; *pm; pm = &(*pm)->next) {
+			if (*pm == m) {
+				*pm = m->next;
+				break;
+			}
+		}
+		mapping_destroy(m);
+	}
+	pthread_mutex_unlock(&g_mappings_lock);
+}
+
+/**
+ * Does nothing: mappings are released together with their last handle.
+ * Kept for programs written against the caching version.
+ */
+void easynmc_flush_handle_cache(void)
+{
+}
+
 /**
  * Open a Neuromatrix Core. Do not boot it if it is in cold state.
  *
+ * Handles opened for the same core within a process share file descriptors
+ * and a single imem mapping, only the first open actually touches the device.
+ * Note, that this also means they share file status flags (e.g. O_NONBLOCK)
+ *
  * @param coreid core number
  * @return
  */
 struct easynmc_handle *easynmc_open_noboot(int coreid)
 {
-	char path[1024];
-	int ret;
-	struct easynmc_handle *h = malloc(sizeof(struct easynmc_handle));
+	struct easynmc_handle *h = calloc(1, sizeof(struct easynmc_handle));
 	if (!h)
 		return NULL;
-	/* let's open core mem, io, and do the mmap */
-	h->id = coreid;
-
-	h->sfilters = NULL;
-
-	sprintf(path, "/dev/nmc%dio", coreid);
-	h->iofd = open(path, O_RDWR);
-	if (!h->iofd) {
-		err("Couldn't open NMC IO device\n");
-		goto errfreenmc;
-	}
-	sprintf(path, "/dev/nmc%dmem", coreid);
-	h->memfd = open(path, O_RDWR);
-	if (!h->memfd) {
-		err("Couldn't open NMC MEM device\n");
-		goto errcloseiofd;
-	}
-	ret = ioctl(h->iofd, IOCTL_NMC3_GET_IMEMSZ, &h->imem_size);
-	if (ret!=0) {
-		err("Couldn't get NMC internal memory size\n");
-		goto errclosememfd;
-	}
 
-	h->imem = mmap(NULL, h->imem_size, PROT_READ | PROT_WRITE, MAP_SHARED, h->memfd, 0);
-	if (h->imem == MAP_FAILED) {
-		err("Couldn't MMAP internal memory\n");
-		goto errclosememfd;
+	h->map = mapping_get(coreid);
+	if (!h->map) {
+		free(h);
+		return NULL;
 	}
 
-	h->imem32 = (uint32_t *) h->imem;
-
-	dbg("Opened core %d iofd %d memfd %d. mmap imem %u bytes @ 0x%lx\n",
-	    coreid, h->iofd, h->memfd, h->imem_size, (unsigned long) h->imem);
+	h->id        = coreid;
+	h->dev       = &h->map->dev;
+	h->iofd      = h->dev->iofd;
+	h->memfd     = h->dev->memfd;
+	h->imem      = h->dev->imem;
+	h->imem32    = (uint32_t *) h->dev->imem;
+	h->imem_size = h->dev->imem_size;
+	h->sfilters  = NULL;
+	h->lockfd    = -1;
 
 	easynmc_init_default_filters(h);
 
 	return h;
-
-errclosememfd:
-	close(h->memfd);
-errcloseiofd:
-	close(h->iofd);
-errfreenmc:
-	free(h);
-	err("Device was: %s\n", path);
-	return NULL;
 }
 
 
@@ -313,6 +459,8 @@ int easynmc_boot_core(struct easynmc_handle *h, int debug)
 	int ret;
 	uint32_t ep;
 	const char* startupfile = getenv("NMC_STARTUPCODE");
+	const struct easynmc_ipl_plan *plan = NULL;
+	char *installed = NULL;
 	char name[64];
 
 	if (easynmc_core_state(h) != EASYNMC_CORE_COLD) {
@@ -324,20 +472,35 @@ int easynmc_boot_core(struct easynmc_handle *h, int debug)
 	if (ret)
 		return ret;
 
+	/* 
+	 * NMC_STARTUPCODE is the only override of the built-in IPL, installed 
+	 * files are only looked for on cores the library has no plan for 
+	 */
 	if (!startupfile)
-		startupfile = easynmc_get_default_ipl(name, debug);
-
-	if (!startupfile) {
-		err("Didn't find startup code file. Did you install one?\n");
-		err("HINT: You can set env variable NMC_STARTUPCODE\n");
-		return -1;
-	}
+		plan = easynmc_get_builtin_ipl(name, debug);
+	if (!startupfile && !plan)
+		startupfile = installed = easynmc_get_default_ipl(name, debug);
+
+	if (plan) {
+		dbg("Booting core using built-in %s%s IPL\n", name, debug ? "-debug" : "");
+		ep = plan->entry;
+		ret = easynmc_writev(h, plan->iov, plan->num);
+		if (ret != 0)
+			return ret;
+	} else {
+		if (!startupfile) {
+			err("Didn't find startup code file. Did you install one?\n");
+			err("HINT: You can set env variable NMC_STARTUPCODE\n");
+			return -1;
+		}
 
-	dbg("Booting core using: %s file\n", startupfile);
+		dbg("Booting core using: %s file\n", startupfile);
 
-	ret = easynmc_load_abs(h, startupfile, &ep, 0);
-	if (ret!=0)
-		return ret;
+		ret = easynmc_load_abs(h, startupfile, &ep, ABSLOAD_FLAG_IPL);
+		free(installed);
+		if (ret!=0)
+			return ret;
+	}
 
 	if (ep != 0) {
 		err("ERROR: Startup code entry point must be 0x0!\n");
@@ -368,12 +531,15 @@ int easynmc_boot_core(struct easynmc_handle *h, int debug)
 		if (easynmc_core_state(h) == EASYNMC_CORE_IDLE) {
 			err("But init code reports being ready. \n");
 			err("Did you mix up HP and LP interrupts in DeviceTree?\n");
+			easynmc_stdio_forget(h);
 			return 0; /* Okay, nevertheless */
 		}
 		return 1;
 		break;
 	case EASYNMC_EVT_HP:
 		dbg("Initial code loaded & ready \n");
+		/* Left over from before the reboot */
+		easynmc_stdio_forget(h);
 		return 0;
 		break;
 	default:
@@ -444,7 +610,7 @@ int easynmc_boot_core(struct easynmc_handle *h, int debug)
  *
  * @return 0 if everything is OK; -1 - current handle has no argument offset.
  * 		   -2 - arguments size exceed the space available in the relevant section
- * 		   of the DSP program.
+ * 		   of the DSP program. -3 - failed to write the arguments to the core.
  */
 int easynmc_set_args(struct easynmc_handle *h, char* self, int argc, char **argv)
 {
@@ -465,28 +631,513 @@ int easynmc_set_args(struct easynmc_handle *h, char* self, int argc, char **argv
 		return -2;
 	}
 	
-	/* Let's make some black magic */
+	/* Let's make some black magic. The block is built on the host and written at once */
+	uint32_t *blk = calloc(needspace + 3, sizeof(uint32_t));
+	if (!blk)
+		return -3;
 
-	h->imem32[h->argoffset]   = argc + 1 ;
-	h->imem32[h->argoffset+1] = h->argoffset + 2;
+	blk[0] = argc + 1 ;
+	blk[1] = h->argoffset + 2;
 
-	uint32_t *ptroff  = &h->imem32[h->argoffset + 2]; 
-	uint32_t *dataoff = &h->imem32[h->argoffset + 2 + argc + 1];
+	uint32_t *ptroff  = &blk[2]; 
+	uint32_t *dataoff = &blk[2 + argc + 1];
 	
-	*ptroff = dataoff - h->imem32;
+	*ptroff = h->argoffset + (dataoff - blk);
 	len = str2nmc(dataoff, self, strlen(self)+1); 
 	dataoff += len;
 	
 	for (i=0; i<argc; i++) {
-		ptroff[i+1] = dataoff - h->imem32;
+		ptroff[i+1] = h->argoffset + (dataoff - blk);
 		len = str2nmc(dataoff, argv[i], strlen(argv[i])+1); 
 		dataoff += len;
 	}
-	
+
+	i = easynmc_write(h, h->argoffset << 2, blk, (dataoff - blk) * sizeof(uint32_t));
+	free(blk);
+	if (i != 0) {
+		err("Failed to write arguments to core %d\n", h->id);
+		return -3;
+	}
 	return 0;
 }
 
 
+/*
+ * Host-side copy of everything an app may have changed in memory:
+ * initialized writable sections (with data) and .bss/nobits (zero fill).
+ * Sections claimed by filters are remembered so that the filters can
+ * be replayed on relaunch.
+ */
+struct easynmc_relaunch_range {
+	uint32_t  addr; /* bytes */
+	uint32_t  len;  /* bytes */
+	char     *data; /* NULL - zero fill */
+};
+
+struct easynmc_relaunch_section {
+	char      *name;
+	GElf_Shdr  shdr;
+};
+
+struct easynmc_relaunch_image {
+	uint32_t  entry;
+	int       num_ranges;
+	struct easynmc_relaunch_range *ranges;
+	int       num_sections;
+	struct easynmc_relaunch_section *sections;
+};
+
+static void relaunch_image_free(struct easynmc_relaunch_image *img)
+{
+	int i;
+	if (!img)
+		return;
+	for (i=0; i<img->num_ranges; i++)
+		free(img->ranges[i].data);
+	for (i=0; i<img->num_sections; i++)
+		free(img->sections[i].name);
+	free(img->ranges);
+	free(img->sections);
+	free(img);
+}
+
+static int relaunch_add_range(struct easynmc_relaunch_image *img, 
+			      uint32_t addr, uint32_t len, char *data)
+{
+	struct easynmc_relaunch_range *tmp;
+	tmp = realloc(img->ranges, (img->num_ranges + 1) * sizeof(*tmp));
+	if (!tmp)
+		return -1;
+	img->ranges = tmp;
+	tmp[img->num_ranges].addr = addr;
+	tmp[img->num_ranges].len  = len;
+	tmp[img->num_ranges].data = data;
+	img->num_ranges++;
+	return 0;
+}
+
+static int relaunch_add_section(struct easynmc_relaunch_image *img, 
+				char *name, GElf_Shdr shdr)
+{
+	struct easynmc_relaunch_section *tmp;
+	tmp = realloc(img->sections, (img->num_sections + 1) * sizeof(*tmp));
+	if (!tmp)
+		return -1;
+	img->sections = tmp;
+	tmp[img->num_sections].name = strdup(name);
+	tmp[img->num_sections].shdr = shdr;
+	if (!tmp[img->num_sections].name)
+		return -1;
+	img->num_sections++;
+	return 0;
+}
+
+/* 
+ * Not every toolchain sets SHF_WRITE, so anything that is not code
+ * is considered writable.
+ */
+static int section_is_writable(GElf_Shdr *shdr)
+{
+	return (shdr->sh_flags & SHF_WRITE) || !(shdr->sh_flags & SHF_EXECINSTR);
+}
+
+/**
+ * Decide what the loader does with a section of an abs file. 
+ * Used by easynmc_load_abs() and by tools that convert abs files, 
+ * so that they agree on what gets uploaded.
+ *
+ * @param name section name
+ * @param shdr section header
+ * @param why if not NULL, set to a human-readable reason when the section is not uploaded
+ * @return one of EASYNMC_SECTION_*
+ */
+int easynmc_section_action(const char *name, GElf_Shdr *shdr, const char **why)
+{
+	const char *dummy;
+	if (!why)
+		why = &dummy;
+	*why = NULL;
+
+	if (shdr->sh_size == 0) {  /* Skip empty sections */
+		*why = "(empty section)";
+		return EASYNMC_SECTION_SKIP;
+	}
+
+	if (0==strncmp(name, EASYNMC_OVERLAY_PREFIX, strlen(EASYNMC_OVERLAY_PREFIX))) {
+		*why = "(overlay)";
+		return EASYNMC_SECTION_OVERLAY;
+	}
+
+	if (0==strcmp(name,".bss")) {
+		*why = "(cleansing)";
+		return EASYNMC_SECTION_FILL;
+	}
+
+	if (shdr->sh_type == SHT_NOBITS) { 
+		*why = "(nobits)";
+		return EASYNMC_SECTION_FILL;
+	}
+
+	if ((0==strcmp(name,".memBankMap")) || (0==strcmp(name,".shstrtab"))) {
+		*why = "(not needed)";
+		return EASYNMC_SECTION_SKIP;
+	}
+
+	/* Unstripped images carry symbols, these never go to the core */
+	if ((shdr->sh_type == SHT_SYMTAB) || (shdr->sh_type == SHT_STRTAB)) {
+		*why = "(symbols)";
+		return EASYNMC_SECTION_SKIP;
+	}
+
+	return EASYNMC_SECTION_UPLOAD;
+}
+
+static int section_fits(struct easynmc_handle *h, GElf_Shdr *shdr)
+{
+	return ((uint64_t) (shdr->sh_addr << 2) + shdr->sh_size) <= h->imem_size;
+}
+
+/* 
+ * Apps linked with an old K1879.cfg may still put data at the top of IM1,
+ * where the IPL now keeps its extended code. Only the IPL itself may go there.
+ */
+static int section_placeable(struct easynmc_handle *h, const char *name, 
+			     GElf_Shdr *shdr, int action, int flags)
+{
+	if (action == EASYNMC_SECTION_SKIP)
+		return 1;
+
+	if ((action != EASYNMC_SECTION_OVERLAY) && !section_fits(h, shdr)) { 
+		err("Section %s does not fit into core memory\n", name);
+		return 0;
+	}
+
+	if (!(flags & ABSLOAD_FLAG_IPL) && 
+	    easynmc_ipl_owns(shdr->sh_addr, (shdr->sh_size + 3) >> 2)) {
+		err("Section %s at 0x%lx overlaps memory used by the IPL\n", 
+		    name, (unsigned long) shdr->sh_addr);
+		err("HINT: Relink the app with the current K1879.cfg\n");
+		return 0;
+	}
+	return 1;
+}
+
+static int fill_section(struct easynmc_handle *h, struct easynmc_relaunch_image *img, 
+			uint32_t addr, uint32_t len)
+{
+	struct easynmc_memop op = { EASYNMC_MEMOP_FILL, addr >> 2, 0, len >> 2 };
+
+	/* Large sections are zeroed by the IPL at core speed, if it can */
+	if ((len >= IPL_FILL_MIN) && !(addr & 3) &&
+	    (easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_MEMOPS) && 
+	    (easynmc_core_state(h) == EASYNMC_CORE_IDLE)) {
+		if (0 != easynmc_memops(h, &op, 1))
+			return -1;
+		if ((len & 3) && (0 != easynmc_write(h, addr + (len & ~3), NULL, len & 3)))
+			return -1;
+	} else if (0 != easynmc_write(h, addr, NULL, len)) {
+		return -1;
+	}
+	if (img && (0 != relaunch_add_range(img, addr, len, NULL)))
+		return -1;
+	return easynmc_verify_add(h, addr >> 2, NULL, len);
+}
+
+/* 
+ * Write section data to the core. The buffer is either kept for relaunch 
+ * or freed, in any case.
+ */
+static int upload_section(struct easynmc_handle *h, struct easynmc_relaunch_image *img, 
+			  GElf_Shdr *shdr, char *data)
+{
+	uint32_t addr = shdr->sh_addr << 2;
+
+	if ((0 != easynmc_write(h, addr, data, shdr->sh_size)) ||
+	    (0 != easynmc_verify_add(h, shdr->sh_addr, data, shdr->sh_size))) {
+		free(data);
+		return -1;
+	}
+
+	if (img && section_is_writable(shdr)) {
+		if (0 != relaunch_add_range(img, addr, shdr->sh_size, data)) {
+			free(data);
+			return -1;
+		}
+	} else {
+		free(data);
+	}
+	return 0;
+}
+
+/* Run the section filter chain */
+static int filter_section(struct easynmc_handle *h, struct easynmc_relaunch_image *img, 
+			  char *name, FILE *rfd, GElf_Shdr shdr)
+{
+	struct easynmc_section_filter *f = h->sfilters;		
+	int handled = 0;
+
+	while (!handled && f) {
+		dbg("Aplying section filter %s\n", f->name);
+		handled = f->handle_section(h, name, rfd, shdr);
+		f = f->next;
+	}
+
+	/* Filters may write to their sections, there's nothing to verify */
+	if (handled)
+		easynmc_verify_drop(h, shdr.sh_addr);
+
+	if (img && handled && (0 != relaunch_add_section(img, name, shdr)))
+		return -1;
+	return 0;
+}
+
+/*
+ * Compressed images (see nmc-abzip) carry the same sections as the abs 
+ * they were made from, with payloads compressed by easynmc_lz_compress().
+ * Every payload is decoded into a host buffer and then copied to the core 
+ * in one pass: decoding in place would read back-references from uncached
+ * device memory.
+ */
+static int load_compressed(struct easynmc_handle *h, int fd, const char *path,
+			   struct easynmc_relaunch_image *img, uint32_t *ep, int flags)
+{
+	struct easynmc_abz_header *hdr;
+	struct stat sb;
+	size_t pos;
+	char *map;
+	int i, ret = -1;
+
+	if (fstat(fd, &sb) != 0) {
+		perror("fstat");
+		return -1;
+	}
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	hdr = (struct easynmc_abz_header *) map;
+	if ((sb.st_size < sizeof(*hdr)) || (hdr->version != EASYNMC_ABZ_VERSION)) {
+		err("%s: unsupported compressed image\n", path);
+		goto errunmap;
+	}
+
+	h->build_hash = hdr->build_hash;
+	dbg("Compressed image, %d sections, build hash 0x%08x\n", 
+	    hdr->num_sections, h->build_hash);
+	if (h->expected_hash && (h->expected_hash != h->build_hash)) {
+		err("ERROR: %s has build hash 0x%08x, host code expects 0x%08x\n", 
+		    path, h->build_hash, h->expected_hash);
+		err("ERROR: Regenerate host bindings with nmc-bindgen\n");
+		goto errunmap;
+	}
+
+	*ep = hdr->entry;
+	pos = sizeof(*hdr);
+
+	for (i=0; i<hdr->num_sections; i++) {
+		struct easynmc_abz_section sec;
+		const char *why_skip = NULL;
+		GElf_Shdr shdr;
+		char *name, *data;
+		int action, addr;
+
+		if (pos + sizeof(sec) > sb.st_size)
+			goto errtrunc;
+		memcpy(&sec, &map[pos], sizeof(sec));
+		pos += sizeof(sec);
+
+		name = &map[pos];
+		if (sec.name_len > sb.st_size - pos)
+			goto errtrunc;
+		pos += EASYNMC_ABZ_ALIGN(sec.name_len);
+		/* zsize comes from the file, check it before it can wrap pos */
+		if ((pos > sb.st_size) || (sec.zsize > sb.st_size - pos))
+			goto errtrunc;
+		data = &map[pos];
+		pos += EASYNMC_ABZ_ALIGN(sec.zsize);
+		if ((pos > sb.st_size) || !sec.name_len || name[sec.name_len - 1])
+			goto errtrunc;
+
+		memset(&shdr, 0x0, sizeof(shdr));
+		shdr.sh_type  = sec.sh_type;
+		shdr.sh_flags = sec.sh_flags;
+		shdr.sh_addr  = sec.sh_addr;
+		shdr.sh_size  = sec.sh_size;
+		addr = shdr.sh_addr << 2;
+		action = easynmc_section_action(name, &shdr, &why_skip);
+
+		if (!section_placeable(h, name, &shdr, action, flags))
+			goto errunmap;
+
+		dbg("%s section %s %s %ld bytes (%u stored) @ 0x%x\n", 
+		    why_skip ? "Skipping" : "Uploading", name, 
+		    why_skip ? why_skip : "", (unsigned long) shdr.sh_size, 
+		    sec.zsize, addr);
+
+		if ((action == EASYNMC_SECTION_FILL) && (0 != fill_section(h, img, addr, shdr.sh_size)))
+			goto errunmap;
+
+		if ((action == EASYNMC_SECTION_UPLOAD) || (action == EASYNMC_SECTION_OVERLAY)) {
+			char *buf = malloc(shdr.sh_size);
+			int bad = 1;
+			if (!buf)
+				goto errunmap;
+
+			if (sec.encoding == EASYNMC_ABZ_LZ) {
+				bad = easynmc_lz_decompress(data, sec.zsize, buf, shdr.sh_size);
+			} else if ((sec.encoding == EASYNMC_ABZ_RAW) && (sec.zsize == shdr.sh_size)) {
+				memcpy(buf, data, sec.zsize);
+				bad = 0;
+			}
+
+			if (bad) {
+				err("Corrupted payload in section %s\n", name);
+				free(buf);
+				goto errunmap;
+			}
+
+			if ((action == EASYNMC_SECTION_OVERLAY) ? 
+			    easynmc_overlay_add(h, name, &shdr, buf) : 
+			    upload_section(h, img, &shdr, buf))
+				goto errunmap;
+		}
+
+		if (0 != filter_section(h, img, name, NULL, shdr))
+			goto errunmap;
+	}
+	ret = 0;
+	goto errunmap;
+
+errtrunc:
+	err("%s: truncated compressed image\n", path);
+errunmap:
+	munmap(map, sb.st_size);
+	return ret;
+}
+
+static int is_compressed(FILE *rfd)
+{
+	char magic[4];
+	int ret = (fread(magic, 1, sizeof(magic), rfd) == sizeof(magic)) &&
+		(0 == memcmp(magic, EASYNMC_ABZ_MAGIC, sizeof(magic)));
+	rewind(rfd);
+	return ret;
+}
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	while (len--) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static uint32_t fnv1a_word(uint32_t hash, uint32_t v)
+{
+	unsigned char b[4] = { v, v >> 8, v >> 16, v >> 24 };
+	return fnv1a(hash, b, sizeof(b));
+}
+
+/**
+ * Calculate the build hash of an opened abs file.
+ * The hash covers names, addresses and sizes of all global symbols, so it
+ * changes whenever the app is relinked in a way that moves its globals. 
+ * This is the same hash nmc-bindgen puts into generated headers. 
+ *
+ * @param elf
+ * @return
+ */
+uint32_t easynmc_elf_build_hash(Elf *elf)
+{
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	uint32_t hash = 2166136261U;
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		Elf_Data *data;
+		int i, count;
+
+		gelf_getshdr(scn, &shdr);
+		if ((shdr.sh_type != SHT_SYMTAB) || !shdr.sh_entsize)
+			continue;
+
+		data  = elf_getdata(scn, NULL);
+		count = shdr.sh_size / shdr.sh_entsize;
+		for (i=0; data && i<count; i++) {
+			GElf_Sym sym;
+			char *name;
+			if (!gelf_getsym(data, i, &sym) || 
+			    (GELF_ST_BIND(sym.st_info) != STB_GLOBAL))
+				continue;
+			name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+			if (name)
+				hash = fnv1a(hash, name, strlen(name) + 1);
+			hash = fnv1a_word(hash, sym.st_value);
+			hash = fnv1a_word(hash, sym.st_size);
+		}
+	}
+	return hash;
+}
+
+/**
+ * Calculate the build hash of an abs file. See easynmc_elf_build_hash()
+ *
+ * @param path
+ * @param hash
+ * @return 0 if OK
+ */
+int easynmc_abs_build_hash(const char *path, uint32_t *hash)
+{
+	Elf *elf;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror("open");
+		return -1;
+	}
+
+	elf_version(EV_CURRENT);
+	elf = elf_begin(fd, ELF_C_READ, NULL);
+	if (!elf) {
+		err("elf_begin() failed: %s.\n", elf_errmsg(-1));
+		close(fd);
+		return -1;
+	}
+
+	*hash = easynmc_elf_build_hash(elf);
+	elf_end(elf);
+	close(fd);
+	return 0;
+}
+
+/**
+ * Make easynmc_load_abs() refuse images with a different build hash.
+ * Use the *_BUILD_HASH constant from a header generated by nmc-bindgen 
+ * to make sure the offsets compiled into host code match the app.
+ *
+ * @param h
+ * @param hash expected hash, 0 disables the check
+ */
+void easynmc_expect_build_hash(struct easynmc_handle *h, uint32_t hash)
+{
+	h->expected_hash = hash;
+}
+
+/**
+ * Get the build hash of the last image loaded with easynmc_load_abs()
+ *
+ * @param h
+ * @return
+ */
+uint32_t easynmc_get_build_hash(struct easynmc_handle *h)
+{
+	return h->build_hash;
+}
+
 /**
  * Load an abs file into DSP memory and get a reference to the entry point.
  * The entry point can only e considered valid if loading succeeds. You can later
@@ -501,6 +1152,22 @@ int easynmc_set_args(struct easynmc_handle *h, char* self, int argc, char **argv
  * However, in some weird cases you may want to override this check. This can be
  * done via ABSLOAD_FLAG_FORCE. Just don't shoot yourself in the knee.
  *
+ * With ABSLOAD_FLAG_RELAUNCH the loader keeps a host-side copy of writable
+ * sections, so that the app can be later restarted with easynmc_relaunch_app()
+ * without reloading the whole image.
+ *
+ * If an expected build hash was set with easynmc_expect_build_hash() images
+ * with a different hash are rejected before anything is uploaded.
+ *
+ * Compressed images made by nmc-abzip are accepted as well. Section filters
+ * get a NULL rfd for them.
+ *
+ * With ABSLOAD_FLAG_VERIFY uploaded sections are checked by CRC after 
+ * loading, see \ref verify_api.
+ *
+ * Sections that overlap the memory used by the IPL (LOADERMEM and 
+ * NMC_IPL_EXT_ADDR) are rejected, unless ABSLOAD_FLAG_IPL is given.
+ *
  * @param h device handle
  * @param path file path
  * @param ep a pointer to uint32_t, will be used to store entry point if loading succeeds.
@@ -516,6 +1183,7 @@ int easynmc_load_abs(struct easynmc_handle *h, const char *path, uint32_t* ep, i
 	Elf *elf;
 	int fd; 
 	Elf_Scn *scn = NULL;
+	struct easynmc_relaunch_image *img = NULL;
 
 	const char *state = easynmc_state_name(easynmc_core_state(h));
 
@@ -537,8 +1205,37 @@ int easynmc_load_abs(struct easynmc_handle *h, const char *path, uint32_t* ep, i
 		perror("open");
 		goto errfclose;
 	}
+
+	/* Whatever was loaded before is gone now */
+	relaunch_image_free(h->relaunch);
+	h->relaunch = NULL;
+
+	if (flags & ABSLOAD_FLAG_RELAUNCH) {
+		img = calloc(1, sizeof(*img));
+		if (!img)
+			goto errclose;
+	}
 	
 
+	h->argoffset  = 0;
+	h->liveoffset = 0;
+	h->paramoffset = 0;
+	h->inputoffset = 0;
+	h->outputoffset = 0;
+	h->queueoffset = 0;
+	h->calloffset = 0;
+	easynmc_stdio_forget(h);
+	easynmc_overlay_free(h);
+
+	if ((flags & ABSLOAD_FLAG_VERIFY) && (0 != easynmc_verify_begin(h)))
+		goto errclose;
+
+	if (is_compressed(rfd)) {
+		if (0 != load_compressed(h, fd, path, img, ep, flags))
+			goto errclose;
+		goto done;
+	}
+
 	if(elf_version(EV_CURRENT) == EV_NONE)
 	{
 		err("WARNING: Elf Library is out of date!\n");
@@ -572,41 +1269,33 @@ int easynmc_load_abs(struct easynmc_handle *h, const char *path, uint32_t* ep, i
 	}
 	
 	dbg("ELF Machine id: 0x%x\n", ehdr.e_machine);
+
+	h->build_hash = easynmc_elf_build_hash(elf);
+	dbg("ELF build hash: 0x%08x\n", h->build_hash);
+	if (h->expected_hash && (h->expected_hash != h->build_hash)) {
+		err("ERROR: %s has build hash 0x%08x, host code expects 0x%08x\n", 
+		    path, h->build_hash, h->expected_hash);
+		err("ERROR: Regenerate host bindings with nmc-bindgen\n");
+		goto errclose;
+	}
 	
 	*ep = ehdr.e_entry;
 	
 	elf = elf_begin(fd, ELF_C_READ , NULL);
-		
-	h->argoffset = 0;
 
 	while((scn = elf_nextscn(elf, scn)) != 0)
 	{
-		char* why_skip = NULL;
+		const char* why_skip = NULL;
 		gelf_getshdr(scn, &shdr);
 		char* name = elf_strptr(elf, ehdr.e_shstrndx, shdr.sh_name);
 		int addr = shdr.sh_addr << 2;
+		int action = easynmc_section_action(name, &shdr, &why_skip);
 
-		if (shdr.sh_size == 0)  /* Skip empty sections */
-			why_skip = "(empty section)";
-
-		if (0==strcmp(name,".memBankMap")) {
-			why_skip = "(not needed)";
-		}
-
-		if (0==strcmp(name,".shstrtab")) {
-			why_skip = "(not needed)";
-		}
-		
-		if (shdr.sh_type == SHT_NOBITS) { 
-			why_skip = "(nobits)";
-			memset(&h->imem[addr], 0x0, shdr.sh_size);
-		}
+		if (!section_placeable(h, name, &shdr, action, flags))
+			goto errclose;
 
-		if (0==strcmp(name,".bss")) {
-			why_skip = "(cleansing)";
-			memset(&h->imem[addr], 0x0, shdr.sh_size);
-		}
-		
+		if ((action == EASYNMC_SECTION_FILL) && (0 != fill_section(h, img, addr, shdr.sh_size)))
+			goto errclose;
 		
 		dbg("%s section %s %s %ld bytes @ 0x%x\n", 
 		    why_skip ? "Skipping" : "Uploading", 
@@ -618,39 +1307,64 @@ int easynmc_load_abs(struct easynmc_handle *h, const char *path, uint32_t* ep, i
 
 		size_t ret; 
 
-		if (!why_skip) { 
+		if ((action == EASYNMC_SECTION_UPLOAD) || (action == EASYNMC_SECTION_OVERLAY)) { 
 			ret = fseek(rfd, shdr.sh_offset, SEEK_SET);
 			if (ret !=0 ) { 
 				err("Seek failed, bad elf\n");
 				goto errclose;
 			}	
 			dbg("read to %d size %ld\n", addr, (unsigned long) shdr.sh_size);
-			ret = fread(&h->imem[addr], 1, shdr.sh_size, rfd);
+			/* Read into host memory first, the core gets it in bursts */
+			char *data = malloc(shdr.sh_size);
+			if (!data)
+				goto errclose;
+			ret = fread(data, 1, shdr.sh_size, rfd);
 			if (ret != shdr.sh_size ) { 
 				err("Ooops, failed to read all data: want %ld got %zd\n", 
 				    (unsigned long) shdr.sh_size, ret);
 				perror("fread");
+				free(data);
+				goto errclose;
+			}
+			if (action == EASYNMC_SECTION_OVERLAY) {
+				/* Stays in host memory until the core asks for it */
+				if (0 != easynmc_overlay_add(h, name, &shdr, data))
+					goto errclose;
+			} else if (0 != upload_section(h, img, &shdr, data)) {
+				err("Failed to upload section %s\n", name);
 				goto errclose;
 			}
 		}
 
-		/* Now call the section filter chain */
-		struct easynmc_section_filter *f = h->sfilters;		
-		int handled = 0;
-
-		while (!handled && f) {
-			dbg("Aplying section filter %s\n", f->name);
-			handled = f->handle_section(h, name, rfd, shdr);
-			f = f->next;
-		}
-		
+		if (0 != filter_section(h, img, name, rfd, shdr))
+			goto errclose;
 	}
+
+done:
 	close(fd);
 	fclose(rfd);
+
+	if ((flags & ABSLOAD_FLAG_VERIFY) && (0 != easynmc_verify_run(h))) {
+		err("ERROR: %s didn't load intact\n", path);
+		relaunch_image_free(img);
+		return -1;
+	}
+
+	/* Let other processes know what to start */
+	if (easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_EXTREGS)
+		h->imem32[NMC_REG_APP_ENTRY] = *ep;
+
+	if (img) {
+		img->entry  = *ep;
+		h->relaunch = img;
+	}
+
 	dbg("Elvish loading done!\n");
 	return 0;
 
 errclose:
+	relaunch_image_free(img);
+	easynmc_verify_free(h);
 	close(fd);
 
 errfclose:
@@ -675,9 +1389,285 @@ int easynmc_start_app(struct easynmc_handle *h, uint32_t entry)
 		return 1;
 	}
 	
+	easynmc_record(h, EASYNMC_REC_START, entry, 0, NULL, 0);
 	h->imem32[NMC_REG_PROG_ENTRY] = entry;
-	h->imem32[NMC_REG_CORE_START] = 1; 
-	return 0; 
+	return easynmc_ipl_command(h, NMC_CMD_RUN, 1) ? 1 : 0; 
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Post a command to the IPL through NMC_REG_CORE_START. IPLs with
+ * EASYNMC_IPL_CAP_IRQSTART sleep until an HP interrupt, so they get one 
+ * after the command. They acknowledge it by clearing NMC_REG_CORE_START,
+ * which is polled if asked to: HP and LP from the core are left to app
+ * completion, overlays and queues. Older IPLs poll and are only written to.
+ *
+ * @param h
+ * @param cmd NMC_CMD_*
+ * @param wait wait for the IPL to pick the command up
+ * @return 0 if OK, -1 on error, -2 if the IPL didn't acknowledge in time
+ */
+int easynmc_ipl_command(struct easynmc_handle *h, uint32_t cmd, int wait)
+{
+	enum nmc_irq irq;
+	uint64_t deadline;
+
+	if (!(easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_IRQSTART)) {
+		h->imem32[NMC_REG_CORE_START] = cmd;
+		return 0;
+	}
+
+	__sync_synchronize();
+	h->imem32[NMC_REG_CORE_START] = cmd;
+	__sync_synchronize();
+
+	/* Not recorded, the wakeup is implied by the command on replay */
+	irq = NMC_IRQ_HP;
+	if (0 != easynmc_ioctl(h, IOCTL_NMC3_SEND_IRQ, &irq))
+		return -1;
+
+	deadline = now_ns() + IPL_ACK_TIMEOUT_MS * 1000000ULL;
+	while (wait && h->imem32[NMC_REG_CORE_START]) {
+		if (now_ns() >= deadline) {
+			err("Core %d didn't acknowledge command %u\n", h->id, cmd);
+			return -2;
+		}
+		usleep(IPL_ACK_POLL_US);
+	}
+	return 0;
+}
+
+/**
+ * Run an IPL command that takes its arguments from NMC_REG_CMD_ARGS and 
+ * wait until the IPL is back to idle, e.g. NMC_CMD_CRC. The core must be 
+ * idle and the IPL must have EASYNMC_IPL_CAP_IRQSTART.
+ *
+ * @param h
+ * @param cmd NMC_CMD_*
+ * @param timeout ms
+ * @return 0 if OK, -1 on error, -2 if the IPL didn't complete in time
+ */
+int easynmc_ipl_run(struct easynmc_handle *h, uint32_t cmd, uint32_t timeout)
+{
+	uint64_t deadline;
+	int ret;
+
+	ret = easynmc_ipl_command(h, cmd, 1);
+	if (ret == 0) {
+		if (h->imem32[NMC_REG_ISR_ON_START] & (EASYNMC_DONE_IRQ_HP | EASYNMC_DONE_IRQ_LP))
+			ret = easynmc_wait_app(h, timeout, NULL);
+		else {
+			/* Completion interrupts are off, poll */
+			deadline = now_ns() + (uint64_t) timeout * 1000000ULL;
+			while (easynmc_core_state(h) != EASYNMC_CORE_IDLE) {
+				if (now_ns() >= deadline) {
+					ret = -2;
+					break;
+				}
+				usleep(100);
+			}
+		}
+	}
+
+	if (ret != 0) {
+		err("Core %d didn't complete command %u\n", h->id, cmd);
+	}
+	return ret;
+}
+
+/**
+ * Start apps on several cores as close together as possible.
+ *
+ * Entry points are preloaded into every core first, then all cores are
+ * released back-to-back from a tight loop, with no syscalls in between.
+ * Cores running an interrupt-driven IPL (EASYNMC_IPL_CAP_IRQSTART) are 
+ * then woken up one by one, with one ioctl per core, so the reported skew 
+ * includes the time of these syscalls. Afterwards the function watches 
+ * the IPLs pick up the start command and reports how far apart the cores 
+ * actually started.
+ *
+ * As with easynmc_start_app(), recorded sessions get a start record per 
+ * core and the wakeup interrupts are not recorded.
+ *
+ * The observed start times are only as precise as one polling round over
+ * all the cores (a few uncached reads per core).
+ *
+ * @param h array of handles, all cores must be idle
+ * @param entries array of entry points, one per handle
+ * @param num number of handles
+ * @param rep if not NULL, filled with the measured skew (zeroed on early failure)
+ * @return 0 if all cores started, 1 if some core wasn't idle or didn't start in time,
+ *         -1 if there are no cores to start
+ */
+int easynmc_start_app_sync(struct easynmc_handle **h, uint32_t *entries, int num, 
+			   struct easynmc_start_report *rep)
+{
+	int i, pending = num;
+	uint64_t *seen, deadline, t;
+
+	if (rep)
+		memset(rep, 0x0, sizeof(*rep));
+
+	if ((num <= 0) || !h || !entries)
+		return -1;
+
+	for (i=0; i<num; i++) {
+		enum easynmc_core_state s = easynmc_core_state(h[i]);
+		if (s != EASYNMC_CORE_IDLE) { 
+			err("Core %d is in state %s, must be idle\n", h[i]->id, easynmc_state_name(s));
+			return 1;
+		}
+	}
+
+	seen = calloc(num, sizeof(*seen));
+	if (!seen)
+		return 1;
+
+	for (i=0; i<num; i++) {
+		easynmc_record(h[i], EASYNMC_REC_START, entries[i], 0, NULL, 0);
+		h[i]->imem32[NMC_REG_PROG_ENTRY] = entries[i];
+	}
+	__sync_synchronize();
+
+	t = now_ns();
+	for (i=0; i<num; i++)
+		h[i]->imem32[NMC_REG_CORE_START] = NMC_CMD_RUN;
+	__sync_synchronize();
+
+	/* 
+	 * Interrupt-driven IPLs sleep until woken up, this costs a syscall per core. 
+	 * Not recorded, the wakeup is implied by the start on replay 
+	 */
+	for (i=0; i<num; i++) {
+		enum nmc_irq irq = NMC_IRQ_HP;
+		if (easynmc_ipl_caps(h[i]) & EASYNMC_IPL_CAP_IRQSTART)
+			easynmc_ioctl(h[i], IOCTL_NMC3_SEND_IRQ, &irq);
+	}
+
+	if (rep)
+		rep->release_ns = now_ns() - t;
+
+	/* IPL clears the start flag right before jumping to the app */
+	deadline = t + 100000000ULL;
+	while (pending && (now_ns() < deadline)) {
+		for (i=0; i<num; i++) {
+			if (seen[i] || h[i]->imem32[NMC_REG_CORE_START])
+				continue;
+			seen[i] = now_ns();
+			pending--;
+		}
+	}
+
+	if (rep) {
+		uint64_t first = UINT64_MAX, last = 0;
+		for (i=0; i<num; i++) {
+			if (!seen[i])
+				continue;
+			rep->started++;
+			if (seen[i] < first)
+				first = seen[i];
+			if (seen[i] > last)
+				last = seen[i];
+		}
+		rep->skew_ns = rep->started ? last - first : 0;
+	}
+
+	if (pending) {
+		err("%d core(s) didn't pick up the start command\n", pending);
+	} else {
+		dbg("%d cores started\n", num);
+	}
+
+	free(seen);
+	return pending ? 1 : 0;
+}
+
+/**
+ * Fetch the entry point of the app last loaded onto the core.
+ * Unlike the one returned by easynmc_load_abs() this works from
+ * any process, e.g. to start an app loaded by somebody else.
+ *
+ * @param h
+ * @param ep a pointer to uint32_t to store the entry point
+ * @return 0 - ok, 1 - no app loaded, -1 - IPL doesn't support this
+ */
+int easynmc_get_app_entry(struct easynmc_handle *h, uint32_t *ep)
+{
+	if (!(easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_EXTREGS))
+		return -1;
+	
+	*ep = h->imem32[NMC_REG_APP_ENTRY];
+	/* Entry point 0x0 is the IPL itself */
+	return (*ep) ? 0 : 1;
+}
+
+/**
+ * Start the app loaded with ABSLOAD_FLAG_RELAUNCH once again, without 
+ * reloading it. Only writable sections and .bss are restored from the
+ * host-side copy, section filters are replayed and, if self is not NULL,
+ * arguments are set up anew. Code is left untouched.
+ *
+ * @param h
+ * @param self argv[0] or NULL to skip arguments setup
+ * @param argc argc
+ * @param argv Array of arguments. Starting at what would be argv[1] on nmc.
+ *
+ * @return 0 if everything is OK, -1 if there's nothing to relaunch,
+ *         error code from easynmc_set_args()/easynmc_start_app() otherwise
+ */
+int easynmc_relaunch_app(struct easynmc_handle *h, char* self, int argc, char **argv)
+{
+	int i, ret;
+	struct easynmc_iovec *iov;
+	struct easynmc_relaunch_image *img = h->relaunch;
+	enum easynmc_core_state s = easynmc_core_state(h);
+
+	if (!img) { 
+		err("Nothing to relaunch, load with ABSLOAD_FLAG_RELAUNCH first\n");
+		return -1;
+	}
+
+	if (s != EASYNMC_CORE_IDLE) { 
+		err("Core is in state %s, must be idle\n", easynmc_state_name(s));
+		return 1;
+	}
+
+	iov = calloc(img->num_ranges, sizeof(*iov));
+	if (!iov)
+		return -1;
+	for (i=0; i<img->num_ranges; i++) {
+		iov[i].addr = img->ranges[i].addr;
+		iov[i].data = img->ranges[i].data;
+		iov[i].len  = img->ranges[i].len;
+	}
+	ret = easynmc_writev(h, iov, img->num_ranges);
+	free(iov);
+	if (ret != 0)
+		return -1;
+
+	for (i=0; i<img->num_sections; i++) {
+		struct easynmc_section_filter *f = h->sfilters;		
+		int handled = 0;
+		while (!handled && f) {
+			handled = f->handle_section(h, img->sections[i].name, NULL, 
+						    img->sections[i].shdr);
+			f = f->next;
+		}
+	}
+
+	if (self) {
+		ret = easynmc_set_args(h, self, argc, argv);
+		if (ret != 0)
+			return ret;
+	}
+
+	return easynmc_start_app(h, img->entry);
 }
 
 /**
@@ -691,6 +1681,107 @@ int easynmc_exitcode(struct easynmc_handle *h)
 	return h->imem32[NMC_REG_PROG_RETURN];
 }
 
+/**
+ * Get the run count and timing kept by the IPL. Times are measured by 
+ * the core itself, so there's no interrupt or scheduling latency in them.
+ *
+ * @param h
+ * @param st
+ * @return 0 if OK, -1 if the IPL doesn't keep them
+ */
+int easynmc_run_stats(struct easynmc_handle *h, struct easynmc_run_stats *st)
+{
+	if (!(easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_TIMING))
+		return -1;
+
+	st->runs = h->imem32[NMC_REG_RUN_COUNT];
+	st->last = h->imem32[NMC_REG_RUN_LAST];
+	st->busy = h->imem32[NMC_REG_RUN_BUSY];
+	st->idle = h->imem32[NMC_REG_RUN_IDLE];
+	return 0;
+}
+
+/**
+ * Select the interrupts the IPL raises when an app completes (and when 
+ * the IPL itself starts). easynmc_boot_core() sets EASYNMC_DONE_IRQ_HP. 
+ * LP doesn't disturb apps and tools waiting for HP, but stdio waiters 
+ * will see it too.
+ *
+ * @param h
+ * @param irqs EASYNMC_DONE_IRQ_* mask
+ * @return 0 if OK, -1 if the IPL can't do that
+ */
+int easynmc_set_done_irq(struct easynmc_handle *h, uint32_t irqs)
+{
+	if ((irqs & ~EASYNMC_DONE_IRQ_HP) && 
+	    !(easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_DONEIRQ)) {
+		err("IPL on core %d only supports HP completion interrupts\n", h->id);
+		return -1;
+	}
+
+	h->imem32[NMC_REG_ISR_ON_START] = irqs;
+	return 0;
+}
+
+/**
+ * Wait for the app to complete, woken up by the completion interrupt.
+ * Returns at once if the core is already idle.
+ *
+ * @param h
+ * @param timeout ms
+ * @param exitcode if not NULL, gets the exit code
+ * @return 0 if the app has completed, -1 on error, -2 on timeout
+ */
+int easynmc_wait_app(struct easynmc_handle *h, uint32_t timeout, int *exitcode)
+{
+	uint32_t irqs = h->imem32[NMC_REG_ISR_ON_START];
+	struct easynmc_token *t;
+	uint64_t deadline;
+	int evt, ret = 0;
+
+	if (!(irqs & (EASYNMC_DONE_IRQ_HP | EASYNMC_DONE_IRQ_LP))) {
+		err("Completion interrupts are off on core %d\n", h->id);
+		return -1;
+	}
+
+	/* Armed before the check, so that a completion right now is not missed */
+	t = easynmc_token_new(h, ((irqs & EASYNMC_DONE_IRQ_HP) ? EASYNMC_EVT_HP : 0) | 
+			      ((irqs & EASYNMC_DONE_IRQ_LP) ? EASYNMC_EVT_LP : 0));
+	if (!t)
+		return -1;
+
+	deadline = now_ns() + (uint64_t) timeout * 1000000ULL;
+	while (1) {
+		enum easynmc_core_state s = easynmc_core_state(h);
+		uint64_t now = now_ns();
+
+		/* A start request not yet picked up by the IPL counts as running */
+		if ((s == EASYNMC_CORE_IDLE) && !h->imem32[NMC_REG_CORE_START])
+			break;
+		if ((s == EASYNMC_CORE_COLD) || (s == EASYNMC_CORE_INVALID)) {
+			err("Core %d is %s, no app to wait for\n", h->id, easynmc_state_name(s));
+			ret = -1;
+			break;
+		}
+		if (now >= deadline) {
+			ret = -2;
+			break;
+		}
+		/* The app may raise the same interrupts, so check every time */
+		evt = easynmc_token_wait(t, (deadline - now + 999999) / 1000000);
+		if (evt & (EASYNMC_EVT_ERROR | EASYNMC_EVT_CANCELLED)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if ((ret == 0) && exitcode)
+		*exitcode = easynmc_exitcode(h);
+
+	free(t);
+	return ret;
+}
+
 /**
  * Terminate a running application and return to IPL.
  * This function may block for a little while.
@@ -756,32 +1847,198 @@ void easynmc_register_section_filter(struct easynmc_handle *h, struct easynmc_se
 
 
 
+/**
+ * \brief Reserve an opened core for exclusive use by this handle.
+ *
+ * Reservation is an advisory exclusive lock on a per-core lock file
+ * (NMC_LOCKDIR env variable, /var/lock by default). It is dropped by
+ * easynmc_close() or when the process dies, so a crashed job never
+ * leaves a core reserved. easynmc_open(EASYNMC_CORE_ANY) only picks
+ * cores it managed to reserve.
+ *
+ * @param h
+ * @return 0 - core reserved, 1 - core is reserved by somebody else, -1 - error
+ */
+int easynmc_reserve_core(struct easynmc_handle *h)
+{
+	char path[1024];
+	const char *lockdir = getenv("NMC_LOCKDIR");
+
+	if (h->lockfd != -1)
+		return 0; /* Already ours */
+
+	if (!lockdir)
+		lockdir = "/var/lock";
+
+	if (h->dev->backend == &easynmc_driver_backend)
+		snprintf(path, sizeof(path), "%s/easynmc-core%d.lock", lockdir, h->id);
+	else /* Other backends' cores only exist in this process */
+		snprintf(path, sizeof(path), "%s/easynmc-%s-%d-core%d.lock", lockdir, 
+			 h->dev->backend->name, getpid(), h->id);
+	h->lockfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (h->lockfd == -1) {
+		err("Couldn't open lock file %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (flock(h->lockfd, LOCK_EX | LOCK_NB) != 0) {
+		int busy = (errno == EWOULDBLOCK);
+		if (!busy)
+			err("flock() on %s failed: %s\n", path, strerror(errno));
+		close(h->lockfd);
+		h->lockfd = -1;
+		return busy ? 1 : -1;
+	}
+
+	dbg("Reserved core %d via %s\n", h->id, path);
+	return 0;
+}
+
+struct easynmc_candidate {
+	int       id;
+	int       rank; /* 0 - booted & idle, 1 - cold */
+	uint32_t  load;
+	struct easynmc_core_info *info;
+};
+
+static int candidate_cmp(const void *a, const void *b)
+{
+	const struct easynmc_candidate *ca = a;
+	const struct easynmc_candidate *cb = b;
+
+	if (ca->rank != cb->rank)
+		return ca->rank - cb->rank;
+	if (ca->load != cb->load)
+		return (ca->load < cb->load) ? -1 : 1;
+	return ca->id - cb->id;
+}
+
+/*
+ * Pick and reserve a free core. Booted idle cores are preferred over
+ * cold ones (no IPL upload needed). Among the booted ones the least busy
+ * wins if all their IPLs keep run timing (EASYNMC_IPL_CAP_TIMING), else
+ * the one with the least IRQ traffic since the last stats reset, which
+ * is only an approximation of the load.
+ */
+static struct easynmc_handle *easynmc_open_any(void)
+{
+	struct easynmc_inventory *inv = easynmc_inventory_scan();
+	struct easynmc_candidate *cand;
+	struct easynmc_handle *ret = NULL;
+	int i, num = 0, timed = 1;
+
+	if (!inv)
+		return NULL;
+
+	cand = calloc(inv->num_cores + 1, sizeof(*cand));
+	if (!cand)
+		goto errfreeinv;
+
+	for (i=0; i<inv->num_cores; i++) {
+		struct easynmc_core_info *c = &inv->cores[i];
+
+		if ((c->state != EASYNMC_CORE_IDLE) && (c->state != EASYNMC_CORE_COLD)) {
+			dbg("core %d is %s, skipping\n", c->id, easynmc_state_name(c->state));
+			continue;
+		}
+
+		cand[num].id   = c->id;
+		cand[num].rank = (c->state == EASYNMC_CORE_IDLE) ? 0 : 1;
+		cand[num].info = c;
+		cand[num].load =
+			c->stats.irqs_recv[NMC_IRQ_HP] + c->stats.irqs_recv[NMC_IRQ_LP] +
+			c->stats.irqs_sent[NMC_IRQ_NMI] + c->stats.irqs_sent[NMC_IRQ_HP] +
+			c->stats.irqs_sent[NMC_IRQ_LP];
+		if (!cand[num].rank && !c->has_run_stats)
+			timed = 0;
+		num++;
+	}
+
+	/* 
+	 * Busy time per mille, comparable only if all booted cores have it. 
+	 * The counters wrap, so this is exact only until the first wrap 
+	 */
+	for (i=0; timed && (i<num); i++) {
+		struct easynmc_run_stats *run = &cand[i].info->run;
+		uint64_t total = (uint64_t) run->busy + run->idle;
+		if (!cand[i].rank)
+			cand[i].load = total ? (uint32_t) (run->busy * 1000ULL / total) : 0;
+	}
+
+	qsort(cand, num, sizeof(*cand), candidate_cmp);
+
+	for (i=0; (i<num) && !ret; i++) {
+		struct easynmc_handle *h = easynmc_open_noboot(cand[i].id);
+		enum easynmc_core_state state;
+
+		if (!h)
+			continue;
+
+		if (easynmc_reserve_core(h) != 0) {
+			easynmc_close(h);
+			continue;
+		}
+
+		/* 
+		 * Somebody might have used and released the core while we
+		 * were scanning. Now that we hold the lock, check again.
+		 */
+		state = easynmc_core_state(h);
+		if ((state == EASYNMC_CORE_COLD) && (0 == easynmc_boot_core(h, 0)))
+			state = EASYNMC_CORE_IDLE;
+
+		if (state != EASYNMC_CORE_IDLE) {
+			easynmc_close(h);
+			continue;
+		}
+
+		dbg("Picked core %d\n", h->id);
+		ret = h;
+	}
+
+	if (!ret)
+		err("No free cores available\n");
+
+	free(cand);
+errfreeinv:
+	easynmc_inventory_free(inv);
+	return ret;
+}
+
 /**
  * Open a Neuromatix core (and boot it, when needed).
  * This function returns a handle, that should be used for all operations with this core.
  * The handle itself is just a pointer to a structure that contains a few file descriptors and mmaped DSP memory.
  *
- * @param coreid
+ * Passing EASYNMC_CORE_ANY selects a free core and reserves it for this
+ * handle (See easynmc_reserve_core()). A cold core given by number is
+ * reserved before it is booted as well, so that nobody else boots it
+ * at the same time.
+ *
+ * @param coreid core number or EASYNMC_CORE_ANY
  * @return
  */
 struct easynmc_handle *easynmc_open(int coreid)
 {
+	if (coreid == EASYNMC_CORE_ANY)
+		return easynmc_open_any();
+
 	struct easynmc_handle *h = easynmc_open_noboot(coreid);
 	if (!h)
 		return NULL;
 
-	struct nmc_core_stats stats; 
-	int ret;
-	ret = ioctl(h->iofd, IOCTL_NMC3_GET_STATS, &stats);
-	if (ret != 0) {
-		perror("ioctl");
+	if (easynmc_core_state(h) != EASYNMC_CORE_COLD)
+		return h;
+
+	/* Without a usable lock directory (-1) boot anyway, as it always did */
+	if (easynmc_reserve_core(h) == 1) {
+		err("Core %d is cold and reserved by another process\n", coreid);
 		goto errfreeh;
 	}
-	
-	if (!stats.started) 
-		ret = easynmc_boot_core(h, 0);			       
-	
-	if (ret != 0) 
+
+	/* Somebody might have booted and released it before we got the lock */
+	if ((easynmc_core_state(h) == EASYNMC_CORE_COLD) && 
+	    (0 != easynmc_boot_core(h, 0)))
 		goto errfreeh;
 	
 	return h;
@@ -798,9 +2055,14 @@ errfreeh:
  */
 void easynmc_close(struct easynmc_handle *hndl)
 {
-	close(hndl->iofd);
-	close(hndl->memfd);
-	munmap(hndl->imem, hndl->imem_size);
+	if (hndl->lockfd != -1)
+		close(hndl->lockfd);
+	easynmc_record_stop(hndl);
+	mapping_put(hndl->map);
+	relaunch_image_free(hndl->relaunch);
+	easynmc_overlay_free(hndl);
+	easynmc_verify_free(hndl);
+	free(hndl->builtin_filters);
 	free(hndl);
 }
 
@@ -831,7 +2093,7 @@ void easynmc_close(struct easynmc_handle *hndl)
 int easynmc_token_clear(struct easynmc_token *t)
 {
 	int ret;
-	ret = ioctl(t->h->iofd, IOCTL_NMC3_RESET_TOKEN, &t->tok);
+	ret = easynmc_ioctl(t->h, IOCTL_NMC3_RESET_TOKEN, &t->tok);
 	if (ret != 0)
 		perror("ioctl");
 	dbg("New token id %d\n", t->tok.id);
@@ -900,12 +2162,13 @@ const char* easynmc_evt_name(int evt)
 int easynmc_token_wait(struct easynmc_token *t, uint32_t timeout) {
 	int ret; 
 	t->tok.timeout = timeout; 
-	ret = ioctl(t->h->iofd, IOCTL_NMC3_WAIT_ON_TOKEN, &t->tok);
+	ret = easynmc_ioctl(t->h, IOCTL_NMC3_WAIT_ON_TOKEN, &t->tok);
 	if (ret != 0) {
 		err("ioctl returned %d\n", ret);
 		perror("ioctl");
 		return EASYNMC_EVT_ERROR;
 	}
+	easynmc_record(t->h, EASYNMC_REC_EVENT, t->tok.event, 0, NULL, 0);
 	return t->tok.event;
 }
 
@@ -941,7 +2204,7 @@ int easynmc_token_wait(struct easynmc_token *t, uint32_t timeout) {
  */
 int easynmc_pollmark(struct easynmc_handle *h)
 {
-	return ioctl(h->iofd, IOCTL_NMC3_POLLMARK, NULL);
+	return easynmc_ioctl(h, IOCTL_NMC3_POLLMARK, NULL);
 }
 
 /**
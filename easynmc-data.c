@@ -0,0 +1,207 @@
+/*
+ * libEasyNMC DSP communication library.
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup data_api Job input and output
+ * Bulk data for batch jobs bypasses stdio. The app declares raw input and
+ * output buffers with EASYNMC_INPUT(len) and EASYNMC_OUTPUT(len) macros
+ * (See easynmc.mlb). The host copies input bytes as they are before the
+ * app starts, and reads back as many output bytes as the app has reported
+ * in the output header after it exits. Nothing is reformatted on the way.
+ *
+ * \addtogroup data_api
+ * @{
+ */
+
+#define DATA_LEN   0
+#define DATA_SIZE  1
+#define DATA_DATA  4
+
+static uint32_t *data_hdr(struct easynmc_handle *h, int offset, const char *what)
+{
+	uint32_t *hdr;
+
+	if (!offset) {
+		err("No %s section found for this handle\n", what);
+		return NULL;
+	}
+
+	hdr = &h->imem32[offset];
+	if (((uint64_t) offset + DATA_DATA + hdr[DATA_SIZE]) * 4 > h->imem_size) {
+		err("Corrupted %s section\n", what);
+		return NULL;
+	}
+	return hdr;
+}
+
+/**
+ * Copy data to the input section and set its length.
+ *
+ * @param h
+ * @param data
+ * @param len bytes
+ * @return 0 if OK, -1 if the app has no input section, -2 if data does not fit
+ */
+int easynmc_input_write(struct easynmc_handle *h, const void *data, size_t len)
+{
+	uint32_t *hdr = data_hdr(h, h->inputoffset, "input");
+	uint32_t blen = len;
+
+	if (!hdr)
+		return -1;
+
+	if (len > (size_t) hdr[DATA_SIZE] * 4) {
+		err("Input of %zu bytes exceeds %u bytes available\n", len, hdr[DATA_SIZE] * 4);
+		return -2;
+	}
+
+	if (0 != easynmc_write(h, (h->inputoffset + DATA_DATA) << 2, data, len))
+		return -1;
+	return easynmc_write(h, (h->inputoffset + DATA_LEN) << 2, &blen, sizeof(blen));
+}
+
+/**
+ * Copy a file to the input section.
+ *
+ * @param h
+ * @param path
+ * @return same as easynmc_input_write()
+ */
+int easynmc_input_load(struct easynmc_handle *h, const char *path)
+{
+	struct stat sb;
+	char *buf;
+	int ret = -1;
+	FILE *fd = fopen(path, "rb");
+
+	if (!fd) {
+		perror(path);
+		return -1;
+	}
+
+	if (fstat(fileno(fd), &sb) != 0) {
+		perror("fstat");
+		goto bailout;
+	}
+
+	buf = malloc(sb.st_size ? sb.st_size : 1);
+	if (!buf)
+		goto bailout;
+
+	if (fread(buf, 1, sb.st_size, fd) != sb.st_size) {
+		err("%s: short read\n", path);
+	} else {
+		ret = easynmc_input_write(h, buf, sb.st_size);
+		dbg("Loaded %lld bytes of input from %s\n", (long long) sb.st_size, path);
+	}
+	free(buf);
+
+bailout:
+	fclose(fd);
+	return ret;
+}
+
+/**
+ * Read the output the app has produced.
+ *
+ * @param h
+ * @param buf
+ * @param max size of buf
+ * @return number of bytes copied, -1 if the app has no output section
+ */
+long easynmc_output_read(struct easynmc_handle *h, void *buf, size_t max)
+{
+	uint32_t *hdr = data_hdr(h, h->outputoffset, "output");
+	size_t len;
+
+	if (!hdr)
+		return -1;
+
+	len = hdr[DATA_LEN];
+	if (len > (size_t) hdr[DATA_SIZE] * 4) {
+		err("App reports %zu bytes of output, section holds %u\n", len, hdr[DATA_SIZE] * 4);
+		len = hdr[DATA_SIZE] * 4;
+	}
+	if (len > max)
+		len = max;
+
+	memcpy(buf, &hdr[DATA_DATA], len);
+	return len;
+}
+
+/**
+ * Save the output the app has produced to a file.
+ *
+ * @param h
+ * @param path
+ * @return 0 if OK, -1 otherwise
+ */
+int easynmc_output_save(struct easynmc_handle *h, const char *path)
+{
+	uint32_t *hdr = data_hdr(h, h->outputoffset, "output");
+	long len;
+	char *buf;
+	FILE *fd;
+	int ret = -1;
+
+	if (!hdr)
+		return -1;
+
+	buf = malloc((size_t) hdr[DATA_SIZE] * 4 + 1);
+	if (!buf)
+		return -1;
+
+	len = easynmc_output_read(h, buf, (size_t) hdr[DATA_SIZE] * 4);
+	fd = fopen(path, "wb");
+	if (!fd) {
+		perror(path);
+	} else {
+		if (fwrite(buf, 1, len, fd) == len)
+			ret = 0;
+		else
+			perror("fwrite");
+		if (fclose(fd) != 0)
+			ret = -1;
+		dbg("Saved %ld bytes of output to %s\n", len, path);
+	}
+
+	free(buf);
+	return ret;
+}
+
+/**
+ * @}
+ */
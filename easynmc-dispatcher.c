@@ -0,0 +1,449 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup dispatcher_api Real-time event dispatcher
+ * The dispatcher is an optional helper that runs event handling for one or
+ * more cores on a dedicated thread. The thread can be pinned to a CPU and
+ * run with SCHED_FIFO priority, and process memory can be locked, so that
+ * control loops see low and predictable event latency.
+ *
+ * User callbacks are called from the dispatcher thread for LP/HP/NMI events
+ * and for data the app writes to its stdout.
+ *
+ * To see how well the thread is doing, enable the latency probe: a periodic
+ * timer is serviced by the same thread and the delay between the timer expiry
+ * and the actual wakeup is collected into a histogram.
+ *
+ * \addtogroup dispatcher_api
+ * @{
+ */
+
+#define DISPATCHER_MAX_EVENTS  16
+#define LATENCY_BUCKETS        10000 /* 1us each, the last one is overflow */
+
+enum { 
+	SRC_STOP, 
+	SRC_TIMER, 
+	SRC_MEM, 
+	SRC_IO 
+};
+
+struct dispatcher_source {
+	int                             type;
+	struct easynmc_handle          *h;
+	struct easynmc_dispatcher_ops  *ops;
+	void                           *arg;
+	int                             iofl;  /* SRC_IO: flags to put back on free */
+};
+
+struct easynmc_dispatcher {
+	struct easynmc_dispatcher_config cfg;
+	int                       efd;
+	int                       stopfd;
+	int                       timerfd;
+	int                       running;
+	pthread_t                 thread;
+	int                       num_sources;
+	struct dispatcher_source *sources[2 * EASYNMC_DISPATCHER_MAX_HANDLES + 2];
+	struct dispatcher_source  stop_src;
+	struct dispatcher_source  timer_src;
+	uint64_t                  next_expiry;
+	uint32_t                  hist[LATENCY_BUCKETS];
+	uint64_t                  samples;
+	uint64_t                  max_ns;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int watch(struct easynmc_dispatcher *d, int fd, uint32_t events, 
+		 struct dispatcher_source *src)
+{
+	struct epoll_event ev;
+	ev.events   = events;
+	ev.data.ptr = src;
+	if (epoll_ctl(d->efd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		perror("epoll_ctl");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Create a new dispatcher. Nothing is started until easynmc_dispatcher_start()
+ *
+ * @param cfg configuration, NULL for defaults (no pinning, default policy)
+ * @return
+ */
+struct easynmc_dispatcher *easynmc_dispatcher_new(struct easynmc_dispatcher_config *cfg)
+{
+	struct easynmc_dispatcher *d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+
+	if (cfg) { 
+		d->cfg = *cfg;
+	} else {
+		d->cfg.cpu = -1;
+	}
+
+	d->timerfd = -1;
+	d->efd = epoll_create1(EPOLL_CLOEXEC);
+	if (d->efd == -1)
+		goto errfree;
+
+	d->stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (d->stopfd == -1)
+		goto errcloseefd;
+
+	d->stop_src.type = SRC_STOP;
+	if (watch(d, d->stopfd, EPOLLIN, &d->stop_src))
+		goto errclosestop;
+
+	if (d->cfg.latency_probe_us) {
+		d->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		if (d->timerfd == -1)
+			goto errclosestop;
+		d->timer_src.type = SRC_TIMER;
+		if (watch(d, d->timerfd, EPOLLIN, &d->timer_src))
+			goto errclosetimer;
+	}
+
+	return d;
+
+errclosetimer:
+	close(d->timerfd);
+errclosestop:
+	close(d->stopfd);
+errcloseefd:
+	close(d->efd);
+errfree:
+	err("Failed to create dispatcher\n");
+	free(d);
+	return NULL;
+}
+
+/**
+ * Add a core to the dispatcher. Must be called before the dispatcher is started.
+ * Stdout of the core is only monitored if ops->on_stdout is set; the io
+ * descriptor is switched to non-blocking mode in this case, until
+ * easynmc_dispatcher_free(). Other handles of the core share it.
+ *
+ * @param d
+ * @param h
+ * @param ops callbacks, must stay valid while the dispatcher is running
+ * @param arg user argument passed to callbacks
+ * @return 0 if OK
+ */
+int easynmc_dispatcher_add(struct easynmc_dispatcher *d, struct easynmc_handle *h,
+			   struct easynmc_dispatcher_ops *ops, void *arg)
+{
+	int i;
+	if (d->running || (d->num_sources + 2 > ARRAY_SIZE(d->sources))) {
+		err("Can't add core %d to dispatcher\n", h->id);
+		return -1;
+	}
+
+	for (i=0; i<2; i++) {
+		struct dispatcher_source *src;
+		int ret;
+
+		if ((i == 1) && !ops->on_stdout)
+			break;
+
+		src = calloc(1, sizeof(*src));
+		if (!src)
+			return -1;
+		src->type = i ? SRC_IO : SRC_MEM;
+		src->h    = h;
+		src->ops  = ops;
+		src->arg  = arg;
+
+		if (src->type == SRC_MEM) {
+			easynmc_pollmark(h);
+			/* Edge triggered: simulated cores never clear their memfd */
+			ret = watch(d, h->memfd, EPOLLNMI | EPOLLHP | EPOLLLP | EPOLLET, src);
+		} else {
+			src->iofl = fcntl(h->iofd, F_GETFL, 0);
+			fcntl(h->iofd, F_SETFL, src->iofl | O_NONBLOCK);
+			ret = watch(d, h->iofd, EPOLLIN, src);
+			if (ret)
+				fcntl(h->iofd, F_SETFL, src->iofl);
+		}
+
+		if (ret) {
+			free(src);
+			return -1;
+		}
+		d->sources[d->num_sources++] = src;
+	}
+
+	return 0;
+}
+
+static void record_latency(struct easynmc_dispatcher *d, uint64_t lat)
+{
+	uint64_t bucket = lat / 1000;
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1;
+	d->hist[bucket]++;
+	d->samples++;
+	if (lat > d->max_ns)
+		d->max_ns = lat;
+}
+
+static void handle_timer(struct easynmc_dispatcher *d, uint64_t now)
+{
+	uint64_t expirations;
+	uint64_t period = (uint64_t) d->cfg.latency_probe_us * 1000;
+
+	if (read(d->timerfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	record_latency(d, (now > d->next_expiry) ? now - d->next_expiry : 0);
+	d->next_expiry += expirations * period;
+}
+
+static void handle_io(struct dispatcher_source *src)
+{
+	char buf[1024];
+	int n;
+	while ((n = read(src->h->iofd, buf, sizeof(buf))) > 0)
+		src->ops->on_stdout(src->h, buf, n, src->arg);
+}
+
+static void handle_mem(struct dispatcher_source *src, uint32_t events)
+{
+	if (!src->ops->on_event)
+		return;
+	if (events & EPOLLNMI)
+		src->ops->on_event(src->h, EASYNMC_EVT_NMI, src->arg);
+	if (events & EPOLLHP)
+		src->ops->on_event(src->h, EASYNMC_EVT_HP, src->arg);
+	if (events & EPOLLLP)
+		src->ops->on_event(src->h, EASYNMC_EVT_LP, src->arg);
+}
+
+static void *dispatcher_thread(void *arg)
+{
+	struct easynmc_dispatcher *d = arg;
+	struct epoll_event events[DISPATCHER_MAX_EVENTS];
+
+	while (1) {
+		int i, n;
+		uint64_t now;
+
+		n = epoll_wait(d->efd, events, DISPATCHER_MAX_EVENTS, -1);
+		now = now_ns();
+		if ((n == -1) && (errno != EINTR)) {
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i=0; i<n; i++) {
+			struct dispatcher_source *src = events[i].data.ptr;
+			switch (src->type) {
+			case SRC_STOP:
+				return NULL;
+			case SRC_TIMER:
+				handle_timer(d, now);
+				break;
+			case SRC_MEM:
+				handle_mem(src, events[i].events);
+				break;
+			case SRC_IO:
+				handle_io(src);
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Start the dispatcher thread, applying CPU affinity, scheduling policy 
+ * and memory locking from the configuration.
+ *
+ * @param d
+ * @return 0 if OK, error code otherwise. SCHED_FIFO usually needs CAP_SYS_NICE
+ */
+int easynmc_dispatcher_start(struct easynmc_dispatcher *d)
+{
+	pthread_attr_t attr;
+	int ret;
+
+	if (d->running)
+		return 0;
+
+	if (d->cfg.lock_memory && (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)) {
+		perror("mlockall");
+		return -1;
+	}
+
+	pthread_attr_init(&attr);
+
+	if (d->cfg.cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(d->cfg.cpu, &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	}
+
+	if (d->cfg.priority > 0) {
+		struct sched_param param;
+		param.sched_priority = d->cfg.priority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+
+	if (d->timerfd != -1) {
+		struct itimerspec its;
+		uint64_t period = (uint64_t) d->cfg.latency_probe_us * 1000;
+		memset(&its, 0x0, sizeof(its));
+		its.it_interval.tv_sec  = period / 1000000000ULL;
+		its.it_interval.tv_nsec = period % 1000000000ULL;
+		its.it_value = its.it_interval;
+		d->next_expiry = now_ns() + period;
+		timerfd_settime(d->timerfd, 0, &its, NULL);
+	}
+
+	ret = pthread_create(&d->thread, &attr, dispatcher_thread, d);
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		err("Failed to start dispatcher thread: %s\n", strerror(ret));
+		return ret;
+	}
+
+	d->running = 1;
+	dbg("Dispatcher started, cpu %d prio %d\n", d->cfg.cpu, d->cfg.priority);
+	return 0;
+}
+
+/**
+ * Stop the dispatcher thread and wait for it to exit.
+ *
+ * @param d
+ */
+void easynmc_dispatcher_stop(struct easynmc_dispatcher *d)
+{
+	uint64_t one = 1;
+	if (!d->running)
+		return;
+	if (write(d->stopfd, &one, sizeof(one)) != sizeof(one))
+		perror("write");
+	pthread_join(d->thread, NULL);
+	d->running = 0;
+}
+
+static uint64_t percentile(struct easynmc_dispatcher *d, uint64_t per_mille)
+{
+	uint64_t want = (d->samples * per_mille + 999) / 1000;
+	uint64_t cnt = 0;
+	int i;
+	for (i=0; i<LATENCY_BUCKETS; i++) {
+		cnt += d->hist[i];
+		if (cnt >= want)
+			return (uint64_t) (i + 1) * 1000;
+	}
+	return d->max_ns;
+}
+
+/**
+ * Get wakeup latency statistics collected by the latency probe.
+ * Percentiles have 1us resolution. The numbers are collected by the dispatcher
+ * thread without locking, so they are approximate while it is running.
+ *
+ * @param d
+ * @param st
+ * @return 0 if OK, -1 if latency probe is disabled
+ */
+int easynmc_dispatcher_latency(struct easynmc_dispatcher *d, struct easynmc_latency_stats *st)
+{
+	memset(st, 0x0, sizeof(*st));
+	if (d->timerfd == -1)
+		return -1;
+
+	st->samples = d->samples;
+	if (!d->samples)
+		return 0;
+
+	st->p50_ns  = percentile(d, 500);
+	st->p90_ns  = percentile(d, 900);
+	st->p99_ns  = percentile(d, 990);
+	st->p999_ns = percentile(d, 999);
+	st->max_ns  = d->max_ns;
+	return 0;
+}
+
+/**
+ * Stop (if needed) and free the dispatcher. Handles are not closed.
+ *
+ * @param d
+ */
+void easynmc_dispatcher_free(struct easynmc_dispatcher *d)
+{
+	int i;
+	easynmc_dispatcher_stop(d);
+	for (i=0; i<d->num_sources; i++) {
+		if (d->sources[i]->type == SRC_IO)
+			fcntl(d->sources[i]->h->iofd, F_SETFL, d->sources[i]->iofl);
+		free(d->sources[i]);
+	}
+	if (d->timerfd != -1)
+		close(d->timerfd);
+	close(d->stopfd);
+	close(d->efd);
+	free(d);
+}
+
+/**
+ * @}
+ */
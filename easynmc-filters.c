@@ -43,6 +43,86 @@
 	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
 	}
 
+/* Where the ring offsets are kept for other processes, NULL with IPLs that don't leave room */
+static uint32_t *stdio_slots(struct easynmc_handle *h)
+{
+	if (!(easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_EXTREGS) || 
+	    (h->imem_size < (NMC_IPL_HOST_ADDR + NMC_IPL_HOST_LEN) * 4))
+		return NULL;
+	return &h->imem32[NMC_IPL_HOST_ADDR];
+}
+
+/**
+ * Attach the driver's stdin or stdout to a ring in core memory, with
+ * reformatting on. Used by the stdio filter and to restore snapshots.
+ * The offset is remembered in IPL memory, so other processes can
+ * find the ring with easynmc_stdio_offset().
+ *
+ * @param h
+ * @param out 0 - stdin, 1 - stdout
+ * @param offset ring, words
+ * @return 0 if OK, -1 otherwise
+ */
+int easynmc_stdio_attach(struct easynmc_handle *h, int out, uint32_t offset)
+{
+	int rq = out ? IOCTL_NMC3_ATTACH_STDOUT : IOCTL_NMC3_ATTACH_STDIN;
+	uint32_t addr = offset << 2;
+	uint32_t rfmt = 1; /* reformat stdio by default */ 
+
+	if (0 != easynmc_ioctl(h, rq, &addr)) { 
+		perror("ioctl");
+		return -1;
+	}
+
+	rq = out ? IOCTL_NMC3_REFORMAT_STDOUT : IOCTL_NMC3_REFORMAT_STDIN;
+	if (0 != easynmc_ioctl(h, rq, &rfmt)) { 
+		perror("ioctl");
+		return -1;
+	}
+
+	if (out)
+		h->stdoutoffset = offset;
+	else
+		h->stdinoffset = offset;
+	if (stdio_slots(h))
+		stdio_slots(h)[out ? NMC_HOST_STDOUT : NMC_HOST_STDIN] = offset;
+	easynmc_record(h, EASYNMC_REC_STDIO, out, offset, NULL, 0);
+	return 0;
+}
+
+/**
+ * Get the stdin or stdout ring of the app loaded onto the core, possibly 
+ * by another process. With IPLs that don't keep it (no 
+ * EASYNMC_IPL_CAP_EXTREGS) only apps loaded through this handle are known.
+ *
+ * @param h
+ * @param out 0 - stdin, 1 - stdout
+ * @return ring offset in words, 0 if none
+ */
+uint32_t easynmc_stdio_offset(struct easynmc_handle *h, int out)
+{
+	uint32_t *slots = stdio_slots(h);
+	if (slots)
+		return slots[out ? NMC_HOST_STDOUT : NMC_HOST_STDIN];
+	return out ? h->stdoutoffset : h->stdinoffset;
+}
+
+/**
+ * Forget the stdio rings, e.g. when a new app is loaded or the IPL booted.
+ *
+ * @param h
+ */
+void easynmc_stdio_forget(struct easynmc_handle *h)
+{
+	uint32_t *slots = stdio_slots(h);
+	h->stdinoffset  = 0;
+	h->stdoutoffset = 0;
+	if (slots) {
+		slots[NMC_HOST_STDIN]  = 0;
+		slots[NMC_HOST_STDOUT] = 0;
+	}
+}
+
 static int stdio_handle_section(struct easynmc_handle *h, char* name, FILE *rfd, GElf_Shdr shdr)
 {
 	int type = -1; 
@@ -59,24 +139,10 @@ static int stdio_handle_section(struct easynmc_handle *h, char* name, FILE *rfd,
 		return 0;
 	
 	
-	int rq = (type) ? IOCTL_NMC3_ATTACH_STDOUT : IOCTL_NMC3_ATTACH_STDIN;
-	uint32_t addr = shdr.sh_addr << 2;
 	dbg("Attaching %s io buffer size %d words\n", name, h->imem32[shdr.sh_addr + 1]);
 	
-	int ret = ioctl(h->iofd, rq, &addr);
-	if (ret != 0) { 
-		perror("ioctl");
+	if (0 != easynmc_stdio_attach(h, type, shdr.sh_addr))
 		return 0;
-	}
-
-	rq = (type) ? IOCTL_NMC3_REFORMAT_STDOUT : IOCTL_NMC3_REFORMAT_STDIN;
-	uint32_t rfmt = 1; /* reformat stdio by default */ 
-
-	ret = ioctl(h->iofd, rq, &rfmt);
-	if (ret != 0) { 
-		perror("ioctl");
-		return 0;
-	}
 	
 	return 1; /* Handled! */
 }
@@ -109,8 +175,161 @@ static struct easynmc_section_filter arg_filter = {
 
 
 
+static int live_handle_section(struct easynmc_handle *h, char* name, FILE *rfd, GElf_Shdr shdr)
+{
+	if (strcmp(name, ".easynmc_live")!=0)
+		return 0;
+
+	if (shdr.sh_size == 0) 
+		return 0; /* If section optimized out - only name remains */
+
+	h->liveoffset = shdr.sh_addr;
+
+	dbg("Live parameters @0x%x size %d words\n", h->liveoffset, h->imem32[h->liveoffset + 2]);
+	return 1; /* Handled! */
+}
+
+static struct easynmc_section_filter live_filter = {
+	.name = "live",
+	.handle_section = live_handle_section
+};
+
+
+static int params_handle_section(struct easynmc_handle *h, char* name, FILE *rfd, GElf_Shdr shdr)
+{
+	if (strcmp(name, ".easynmc_params")!=0)
+		return 0;
+
+	if (shdr.sh_size == 0) 
+		return 0; /* If section optimized out - only name remains */
+
+	h->paramoffset = shdr.sh_addr;
+
+	dbg("Parameters @0x%x size %d words\n", h->paramoffset, h->imem32[h->paramoffset + 1]);
+	return 1; /* Handled! */
+}
+
+static struct easynmc_section_filter params_filter = {
+	.name = "params",
+	.handle_section = params_handle_section
+};
+
+
+static int data_handle_section(struct easynmc_handle *h, char* name, FILE *rfd, GElf_Shdr shdr)
+{
+	int *offset;
+
+	if (strcmp(name, ".easynmc_input")==0)
+		offset = &h->inputoffset;
+	else if (strcmp(name, ".easynmc_output")==0)
+		offset = &h->outputoffset;
+	else
+		return 0;
+
+	if (shdr.sh_size == 0) 
+		return 0; /* If section optimized out - only name remains */
+
+	*offset = shdr.sh_addr;
+
+	dbg("%s @0x%x size %d words\n", name, *offset, h->imem32[*offset + 1]);
+	return 1; /* Handled! */
+}
+
+static struct easynmc_section_filter data_filter = {
+	.name = "data",
+	.handle_section = data_handle_section
+};
+
+
+static int queue_handle_section(struct easynmc_handle *h, char* name, FILE *rfd, GElf_Shdr shdr)
+{
+	if (strcmp(name, ".easynmc_queue")!=0)
+		return 0;
+
+	if (shdr.sh_size == 0) 
+		return 0; /* If section optimized out - only name remains */
+
+	easynmc_queue_attach(h, shdr.sh_addr);
+
+	dbg("Command queue @0x%x depth %d\n", h->queueoffset, h->imem32[h->queueoffset]);
+	return 1; /* Handled! */
+}
+
+static struct easynmc_section_filter queue_filter = {
+	.name = "queue",
+	.handle_section = queue_handle_section
+};
+
+
+static int call_handle_section(struct easynmc_handle *h, char* name, FILE *rfd, GElf_Shdr shdr)
+{
+	if (strcmp(name, ".easynmc_calls")!=0)
+		return 0;
+
+	if (shdr.sh_size == 0) 
+		return 0; /* If section optimized out - only name remains */
+
+	h->calloffset = shdr.sh_addr;
+
+	dbg("Function table @0x%x, %d functions\n", h->imem32[h->calloffset], 
+	    h->imem32[h->calloffset + 1]);
+	return 1; /* Handled! */
+}
+
+static struct easynmc_section_filter call_filter = {
+	.name = "calls",
+	.handle_section = call_handle_section
+};
+
+
+static int overlay_handle_section(struct easynmc_handle *h, char* name, FILE *rfd, GElf_Shdr shdr)
+{
+	if (strcmp(name, ".easynmc_overlays")!=0)
+		return 0;
+
+	if (shdr.sh_size == 0) 
+		return 0; /* If section optimized out - only name remains */
+
+	easynmc_overlay_attach(h, shdr.sh_addr);
+
+	dbg("Overlay area @0x%x %d slots of %d words\n", h->ovloffset, 
+	    h->imem32[h->ovloffset + 4], h->imem32[h->ovloffset + 5]);
+	return 1; /* Handled! */
+}
+
+static struct easynmc_section_filter overlay_filter = {
+	.name = "overlays",
+	.handle_section = overlay_handle_section
+};
+
+
+static struct easynmc_section_filter *default_filters[] = {
+	&stdio_filter,
+	&arg_filter,
+	&live_filter,
+	&params_filter,
+	&data_filter,
+	&queue_filter,
+	&call_filter,
+	&overlay_filter,
+};
+
+/* 
+ * Every handle gets its own copy of the default filters, so that
+ * filters registered later on one handle never leak into another's chain
+ */
 void easynmc_init_default_filters(struct easynmc_handle *h) 
 {
-	easynmc_register_section_filter(h, &stdio_filter);	
-	easynmc_register_section_filter(h, &arg_filter);	
+	int i;
+	h->builtin_filters = calloc(ARRAY_SIZE(default_filters), 
+				    sizeof(struct easynmc_section_filter));
+	if (!h->builtin_filters) {
+		err("Failed to allocate default filters\n");
+		return;
+	}
+
+	for (i=0; i<ARRAY_SIZE(default_filters); i++) {
+		h->builtin_filters[i] = *default_filters[i];
+		easynmc_register_section_filter(h, &h->builtin_filters[i]);	
+	}
 }
@@ -0,0 +1,224 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup inventory_api Core inventory
+ * The inventory is a single-pass snapshot of every NMC core in the system.
+ * easynmc_inventory_scan() asks the device backend for the cores present (with the
+ * driver these are /dev/nmcXio nodes, gaps in numbering are fine) and fetches 
+ * everything that never changes (name, type, memory size) once.
+ * The device descriptors and a tiny mapping of the IPL registers are kept open,
+ * so easynmc_inventory_refresh() only costs one ioctl per core.
+ *
+ * \addtogroup inventory_api
+ * @{
+ */
+
+struct easynmc_inventory_priv {
+	struct easynmc_device dev;
+};
+
+static int id_cmp(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+#define MAX_CORES 256
+
+static int inventory_open_core(struct easynmc_core_info *c, 
+			       struct easynmc_inventory_priv *p, int id)
+{
+	const struct easynmc_backend *b = easynmc_get_backend();
+
+	c->id         = id;
+	p->dev.id      = id;
+	p->dev.backend = b;
+
+	/* We only need the IPL register block, not the whole memory */
+	if (0 != b->open(&p->dev, EASYNMC_DEV_REGS_ONLY))
+		goto err;
+
+	if (b->ioctl(&p->dev, IOCTL_NMC3_GET_NAME, c->name) || 
+	    b->ioctl(&p->dev, IOCTL_NMC3_GET_TYPE, c->type))
+		goto errclose;
+	c->imem_size = p->dev.imem_size;
+
+	return 0;
+errclose:
+	b->close(&p->dev);
+err:
+	err("Couldn't probe core %d\n", id);
+	return -1;
+}
+
+/**
+ * Update dynamic information (started flag, state, IRQ stats) for every core
+ * in the inventory. Static information is not re-read.
+ *
+ * @param inv
+ * @return 0 if all cores were refreshed, number of failed cores otherwise
+ */
+int easynmc_inventory_refresh(struct easynmc_inventory *inv)
+{
+	int i;
+	int ret = 0;
+	for (i=0; i<inv->num_cores; i++) {
+		struct easynmc_core_info *c = &inv->cores[i];
+		struct easynmc_inventory_priv *p = &inv->priv[i];
+
+		uint32_t *regs = (uint32_t *) p->dev.imem;
+
+		if (0 != p->dev.backend->ioctl(&p->dev, IOCTL_NMC3_GET_STATS, &c->stats)) {
+			c->state = EASYNMC_CORE_INVALID;
+			ret++;
+			continue;
+		}
+
+		c->started = c->stats.started;
+		c->codever = regs[NMC_REG_CODEVERSION];
+
+		if (!c->started)
+			c->state = EASYNMC_CORE_COLD;
+		else if (!easynmc_startupcode_is_compatible(c->codever))
+			c->state = EASYNMC_CORE_INVALID;
+		else if (regs[NMC_REG_CORE_STATUS] > EASYNMC_CORE_INVALID)
+			c->state = EASYNMC_CORE_INVALID;
+		else
+			c->state = regs[NMC_REG_CORE_STATUS];
+
+		c->has_run_stats = (c->state != EASYNMC_CORE_COLD) && 
+			(c->state != EASYNMC_CORE_INVALID) &&
+			(c->codever != EASYNMC_LEGACY_STARTUPCODE) &&
+			(regs[NMC_REG_IPL_CAPS] & EASYNMC_IPL_CAP_TIMING);
+		if (c->has_run_stats) {
+			c->run.runs = regs[NMC_REG_RUN_COUNT];
+			c->run.last = regs[NMC_REG_RUN_LAST];
+			c->run.busy = regs[NMC_REG_RUN_BUSY];
+			c->run.idle = regs[NMC_REG_RUN_IDLE];
+		}
+	}
+	return ret;
+}
+
+/**
+ * Scan the system for NMC cores and fill in an inventory.
+ * The inventory holds a few descriptors per core until freed with
+ * easynmc_inventory_free(). To pick up cores that appeared later,
+ * free the inventory and scan again.
+ *
+ * @return inventory (possibly with zero cores) or NULL on error
+ */
+struct easynmc_inventory *easynmc_inventory_scan(void)
+{
+	int *ids;
+	int i, num;
+	struct easynmc_inventory *inv = calloc(1, sizeof(*inv));
+	if (!inv)
+		return NULL;
+
+	ids = malloc(MAX_CORES * sizeof(int));
+	if (!ids)
+		goto errfreeinv;
+	num = easynmc_get_backend()->probe(ids, MAX_CORES);
+	if (num < 0)
+		goto errfreeids;
+	qsort(ids, num, sizeof(int), id_cmp);
+
+	inv->cores = calloc(num + 1, sizeof(*inv->cores));
+	inv->priv  = calloc(num + 1, sizeof(*inv->priv));
+	if (!inv->cores || !inv->priv)
+		goto errfreeids;
+
+	for (i=0; i<num; i++) {
+		if (0 != inventory_open_core(&inv->cores[inv->num_cores], 
+					     &inv->priv[inv->num_cores], ids[i]))
+			continue;
+		inv->num_cores++;
+	}
+	free(ids);
+
+	dbg("Inventory: %d cores found\n", inv->num_cores);
+	easynmc_inventory_refresh(inv);
+	return inv;
+
+errfreeids:
+	free(ids);
+	free(inv->cores);
+	free(inv->priv);
+errfreeinv:
+	free(inv);
+	return NULL;
+}
+
+/**
+ * Find a core in the inventory by its id
+ *
+ * @param inv
+ * @param coreid
+ * @return core descriptor or NULL if there's no such core
+ */
+struct easynmc_core_info *easynmc_inventory_find(struct easynmc_inventory *inv, int coreid)
+{
+	int i;
+	for (i=0; i<inv->num_cores; i++)
+		if (inv->cores[i].id == coreid)
+			return &inv->cores[i];
+	return NULL;
+}
+
+/**
+ * Release an inventory and all descriptors it holds
+ *
+ * @param inv
+ */
+void easynmc_inventory_free(struct easynmc_inventory *inv)
+{
+	int i;
+	for (i=0; i<inv->num_cores; i++) {
+		inv->priv[i].dev.backend->close(&inv->priv[i].dev);
+	}
+	free(inv->cores);
+	free(inv->priv);
+	free(inv);
+}
+
+/**
+ * @}
+ */
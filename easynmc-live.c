@@ -0,0 +1,163 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup live_api Live parameter updates
+ * Live parameters let the host change coefficients, gains and the like
+ * while the app is running, without stopping it. The app declares the block
+ * with EASYNMC_LIVE_PARAMS(len) macro (See easynmc.mlb) and picks up new
+ * values at block boundaries with easynmc_live_poll() on the nmc side.
+ *
+ * The block is double-buffered: the host writes the inactive copy, flips
+ * the active copy index and bumps a sequence word. The DSP never takes a lock
+ * and never waits for an interrupt; a copy is consistent if the sequence
+ * word did not change while it was being read.
+ *
+ * There must be only one writer per core.
+ *
+ * \addtogroup live_api
+ * @{
+ */
+
+#define LIVE_SEQ     0
+#define LIVE_ACTIVE  1
+#define LIVE_LEN     2
+#define LIVE_DATA    4
+
+static uint32_t *live_hdr(struct easynmc_handle *h)
+{
+	if (!h->liveoffset) {
+		err("No live parameter block found for this handle\n");
+		return NULL;
+	}
+	return &h->imem32[h->liveoffset];
+}
+
+/**
+ * Get the length of live parameter block (one copy)
+ *
+ * @param h
+ * @return length in 32-bit words, -1 if the app has no live parameters
+ */
+int easynmc_live_params_len(struct easynmc_handle *h)
+{
+	uint32_t *hdr = live_hdr(h);
+	return hdr ? hdr[LIVE_LEN] : -1;
+}
+
+/**
+ * Publish a new version of live parameters. If len is less than the block
+ * length, the rest of the block keeps its current values.
+ *
+ * @param h
+ * @param params
+ * @param len number of 32-bit words in params
+ * @return 0 if OK, -1 if the app has no live parameters or on write error, 
+ *         -2 if len is too big
+ */
+int easynmc_live_params_write(struct easynmc_handle *h, const uint32_t *params, uint32_t len)
+{
+	uint32_t *hdr = live_hdr(h);
+	uint32_t copylen, active, flip, seq;
+	struct easynmc_iovec iov[2];
+	uint32_t *src, *dst;
+
+	if (!hdr)
+		return -1;
+
+	copylen = hdr[LIVE_LEN];
+	if (len > copylen) {
+		err("Live parameters exceed available space.\n");
+		return -2;
+	}
+
+	active = hdr[LIVE_ACTIVE] ? 1 : 0;
+	src = &hdr[LIVE_DATA + active * copylen];
+	dst = &hdr[LIVE_DATA + (!active) * copylen];
+
+	/* The untouched tail is carried over from the active copy */
+	iov[0].addr = (dst - h->imem32) << 2;
+	iov[0].data = params;
+	iov[0].len  = len * 4;
+	iov[1].addr = (&dst[len] - h->imem32) << 2;
+	iov[1].data = &src[len];
+	iov[1].len  = (copylen - len) * 4;
+	if (0 != easynmc_writev(h, iov, (len < copylen) ? 2 : 1))
+		return -1;
+
+	/* The new copy must land before the flip, the flip before the seq bump */
+	flip = !active;
+	seq  = hdr[LIVE_SEQ] + 1;
+	__sync_synchronize();
+	if (0 != easynmc_write(h, (h->liveoffset + LIVE_ACTIVE) << 2, &flip, 4))
+		return -1;
+	__sync_synchronize();
+	if (0 != easynmc_write(h, (h->liveoffset + LIVE_SEQ) << 2, &seq, 4))
+		return -1;
+
+	dbg("Live parameters v%u published to core %d\n", hdr[LIVE_SEQ], h->id);
+	return 0;
+}
+
+/**
+ * Read back the current version of live parameters
+ *
+ * @param h
+ * @param params
+ * @param len number of 32-bit words to read
+ * @param seq if not NULL, the sequence number is stored here
+ * @return 0 if OK, -1 if the app has no live parameters, -2 if len is too big
+ */
+int easynmc_live_params_read(struct easynmc_handle *h, uint32_t *params, uint32_t len, uint32_t *seq)
+{
+	uint32_t *hdr = live_hdr(h);
+	uint32_t copylen;
+
+	if (!hdr)
+		return -1;
+
+	copylen = hdr[LIVE_LEN];
+	if (len > copylen)
+		return -2;
+
+	/* We're the only writer, so no need to retry */
+	if (seq)
+		*seq = hdr[LIVE_SEQ];
+	memcpy(params, &hdr[LIVE_DATA + (hdr[LIVE_ACTIVE] ? copylen : 0)], len * 4);
+	return 0;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,259 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <easynmc.h>
+
+/** \defgroup lz_api Load image compression
+ * A small LZ77 codec used for compressed load images. 
+ *
+ * The stream is a sequence of (literals, match) pairs. Each pair starts with
+ * a token byte: the high nibble is the literal count, the low nibble is the 
+ * match length minus 4. A nibble of 15 means more length bytes follow, each 
+ * added to the length, until a byte other than 255. Then come the literals, 
+ * a 16-bit little-endian match offset and the optional match length bytes.
+ *
+ * Offset 0 means "match length zero bytes", so zero-initialized tables cost
+ * a few bytes regardless of the length. The last pair has no match and ends 
+ * exactly at the end of the decompressed data.
+ *
+ * \addtogroup lz_api
+ * @{
+ */
+
+#define MINMATCH     4
+#define MINZERORUN   8
+#define MAXOFFSET    65535
+#define HASH_BITS    13
+
+static uint32_t read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t hash4(const unsigned char *p)
+{
+	return (read32(p) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static unsigned char *put_len(unsigned char *op, unsigned char *oend, size_t len)
+{
+	while (len >= 255) {
+		if (op >= oend)
+			return NULL;
+		*op++ = 255;
+		len -= 255;
+	}
+	if (op >= oend)
+		return NULL;
+	*op++ = len;
+	return op;
+}
+
+static unsigned char *put_seq(unsigned char *op, unsigned char *oend, 
+			      const unsigned char *lit, size_t nlit, 
+			      size_t offset, size_t mlen)
+{
+	unsigned char *token = op++;
+	size_t ml = mlen ? mlen - MINMATCH : 0;
+
+	if (op > oend)
+		return NULL;
+	*token = ((nlit < 15 ? nlit : 15) << 4) | (ml < 15 ? ml : 15);
+
+	if ((nlit >= 15) && !(op = put_len(op, oend, nlit - 15)))
+		return NULL;
+	if (op + nlit > oend)
+		return NULL;
+	memcpy(op, lit, nlit);
+	op += nlit;
+
+	if (!mlen)
+		return op;
+
+	if (op + 2 > oend)
+		return NULL;
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	if ((ml >= 15) && !(op = put_len(op, oend, ml - 15)))
+		return NULL;
+	return op;
+}
+
+/**
+ * Worst-case compressed size for len bytes of input.
+ *
+ * @param len
+ * @return
+ */
+size_t easynmc_lz_bound(size_t len)
+{
+	return len + len / 255 + 16;
+}
+
+/**
+ * Compress a buffer.
+ *
+ * @param src
+ * @param len
+ * @param dst
+ * @param dstlen use easynmc_lz_bound() to be sure everything fits
+ * @return compressed size, -1 if dst is too small
+ */
+long easynmc_lz_compress(const void *src, size_t len, void *dst, size_t dstlen)
+{
+	const unsigned char *ip = src;
+	const unsigned char *anchor = ip;
+	const unsigned char *iend = ip + len;
+	unsigned char *op = dst;
+	unsigned char *oend = op + dstlen;
+	uint32_t *table = calloc(1 << HASH_BITS, sizeof(uint32_t));
+
+	if (!table)
+		return -1;
+
+	while (ip + MINMATCH <= iend) {
+		const unsigned char *ref;
+		size_t mlen = 0, offset = 0;
+		uint32_t h;
+
+		if (!*ip) { 
+			const unsigned char *z = ip;
+			while ((z < iend) && !*z)
+				z++;
+			if (z - ip >= MINZERORUN)
+				mlen = z - ip;
+		}
+
+		if (!mlen) {
+			h = hash4(ip);
+			ref = (const unsigned char *) src + table[h] - 1;
+			table[h] = ip - (const unsigned char *) src + 1;
+			if ((ref >= (const unsigned char *) src) && (ip - ref <= MAXOFFSET) &&
+			    (read32(ref) == read32(ip))) {
+				mlen = MINMATCH;
+				while ((ip + mlen < iend) && (ref[mlen] == ip[mlen]))
+					mlen++;
+				offset = ip - ref;
+			}
+		}
+
+		if (!mlen) {
+			ip++;
+			continue;
+		}
+
+		op = put_seq(op, oend, anchor, ip - anchor, offset, mlen);
+		if (!op)
+			goto overflow;
+		ip += mlen;
+		anchor = ip;
+	}
+
+	op = put_seq(op, oend, anchor, iend - anchor, 0, 0);
+	if (!op)
+		goto overflow;
+
+	free(table);
+	return op - (unsigned char *) dst;
+
+overflow:
+	free(table);
+	return -1;
+}
+
+static const unsigned char *get_len(const unsigned char *ip, const unsigned char *iend, 
+				    size_t *len)
+{
+	unsigned char b;
+	do {
+		if (ip >= iend)
+			return NULL;
+		b = *ip++;
+		*len += b;
+	} while (b == 255);
+	return ip;
+}
+
+/**
+ * Decompress a buffer compressed with easynmc_lz_compress().
+ *
+ * @param src
+ * @param len compressed size
+ * @param dst
+ * @param dstlen exact decompressed size
+ * @return 0 if OK, -1 if the data is corrupted
+ */
+int easynmc_lz_decompress(const void *src, size_t len, void *dst, size_t dstlen)
+{
+	const unsigned char *ip = src;
+	const unsigned char *iend = ip + len;
+	unsigned char *op = dst;
+	unsigned char *oend = op + dstlen;
+
+	while (ip < iend) {
+		unsigned char token = *ip++;
+		size_t nlit = token >> 4;
+		size_t mlen = token & 15;
+		size_t offset;
+
+		if ((nlit == 15) && !(ip = get_len(ip, iend, &nlit)))
+			return -1;
+		if ((nlit > (size_t) (iend - ip)) || (nlit > (size_t) (oend - op)))
+			return -1;
+		memcpy(op, ip, nlit);
+		ip += nlit;
+		op += nlit;
+
+		if (op == oend)
+			return (ip == iend) ? 0 : -1;
+
+		if (ip + 2 > iend)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((mlen == 15) && !(ip = get_len(ip, iend, &mlen)))
+			return -1;
+		mlen += MINMATCH;
+		if (mlen > (size_t) (oend - op))
+			return -1;
+
+		if (!offset) {
+			memset(op, 0x0, mlen);
+			op += mlen;
+		} else {
+			const unsigned char *ref = op - offset;
+			if (ref < (unsigned char *) dst)
+				return -1;
+			while (mlen--)
+				*op++ = *ref++;
+		}
+	}
+	return (op == oend) ? 0 : -1;
+}
+
+/**
+ * @}
+ */
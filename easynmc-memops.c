@@ -0,0 +1,161 @@
+/*
+ * libEasyNMC DSP communication library.
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup memops_api Fill and copy
+ * Bulk memory work the IPL does at core speed instead of the host doing
+ * it over the bus (NMC_CMD_MEMOPS): filling a range of core memory with
+ * a value, and copying into core memory from any address the core can
+ * read, e.g. an image staged in DDR while the previous app was running.
+ * easynmc_load_abs() has the IPL zero large NOBITS sections this way.
+ *
+ * Without EASYNMC_IPL_CAP_MEMOPS, or when the core is not idle, fills and
+ * copies within core memory are done by the host, copies from anywhere
+ * else fail.
+ *
+ * \addtogroup memops_api
+ * @{
+ */
+
+#define MEMOPS_TIMEOUT_MS  1000
+#define MEMOPS_BATCH       ((NMC_REG_CMD_ARGS_LEN - 1) / 4)
+
+static int in_imem(struct easynmc_handle *h, uint32_t addr, uint32_t len)
+{
+	return ((uint64_t) addr + len) * 4 <= h->imem_size;
+}
+
+static int memop_on_host(struct easynmc_handle *h, const struct easynmc_memop *op)
+{
+	uint32_t *buf;
+	uint32_t i;
+	int ret;
+
+	if ((op->op == EASYNMC_MEMOP_FILL) && !op->src)
+		return easynmc_write(h, op->dst << 2, NULL, op->len * 4);
+
+	if ((op->op == EASYNMC_MEMOP_COPY) && !in_imem(h, op->src, op->len)) {
+		err("Copying from 0x%x needs an idle IPL with EASYNMC_IPL_CAP_MEMOPS\n", op->src);
+		return -1;
+	}
+
+	buf = malloc(op->len * 4);
+	if (!buf)
+		return -1;
+	if (op->op == EASYNMC_MEMOP_FILL) {
+		for (i = 0; i < op->len; i++)
+			buf[i] = op->src;
+	} else {
+		memcpy(buf, &h->imem32[op->src], op->len * 4);
+	}
+
+	ret = easynmc_write(h, op->dst << 2, buf, op->len * 4);
+	free(buf);
+	return ret;
+}
+
+/* The IPL has written core memory behind the recorder's back */
+static void memop_record(struct easynmc_handle *h, const struct easynmc_memop *op)
+{
+	if ((op->op == EASYNMC_MEMOP_FILL) && !op->src)
+		easynmc_record(h, EASYNMC_REC_FILL, op->dst << 2, op->len * 4, NULL, op->len * 4);
+	else
+		easynmc_record(h, EASYNMC_REC_UPLOAD, op->dst << 2, op->len * 4,
+			       &h->imem32[op->dst], op->len * 4);
+}
+
+/**
+ * Fill and copy memory, in order.
+ *
+ * @param h
+ * @param ops
+ * @param n number of operations
+ * @return 0 if OK, -1 on error, -2 if the IPL didn't complete in time
+ */
+int easynmc_memops(struct easynmc_handle *h, const struct easynmc_memop *ops, int n)
+{
+	uint32_t *args = &h->imem32[NMC_REG_CMD_ARGS];
+	int i, j, num, ret;
+
+	for (i = 0; i < n; i++) {
+		if ((ops[i].op != EASYNMC_MEMOP_FILL) && (ops[i].op != EASYNMC_MEMOP_COPY)) {
+			err("Bad memory operation %u\n", ops[i].op);
+			return -1;
+		}
+		if (!in_imem(h, ops[i].dst, ops[i].len)) {
+			err("Memory operation target %u words @0x%x is out of core memory\n",
+			    ops[i].len, ops[i].dst);
+			return -1;
+		}
+		/* Would clobber the IPL code, its registers or this very batch */
+		if (easynmc_ipl_owns(ops[i].dst, ops[i].len)) {
+			err("Memory operation target %u words @0x%x overlaps the IPL\n",
+			    ops[i].len, ops[i].dst);
+			return -1;
+		}
+	}
+
+	if (!(easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_MEMOPS) ||
+	    (easynmc_core_state(h) != EASYNMC_CORE_IDLE)) {
+		for (i = 0; i < n; i++)
+			if (0 != memop_on_host(h, &ops[i]))
+				return -1;
+		return 0;
+	}
+
+	for (i = 0; i < n; i += num) {
+		num = ((n - i) > MEMOPS_BATCH) ? MEMOPS_BATCH : (n - i);
+		for (j = 0; j < num; j++) {
+			args[1 + 4 * j] = ops[i + j].op;
+			args[2 + 4 * j] = ops[i + j].dst;
+			args[3 + 4 * j] = ops[i + j].src;
+			args[4 + 4 * j] = ops[i + j].len;
+		}
+		args[0] = num;
+
+		ret = easynmc_ipl_run(h, NMC_CMD_MEMOPS, MEMOPS_TIMEOUT_MS);
+		if (ret != 0)
+			return ret;
+
+		for (j = 0; j < num; j++)
+			memop_record(h, &ops[i + j]);
+	}
+
+	dbg("Core %d: %d memory operations done by the IPL\n", h->id, n);
+	return 0;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,369 @@
+/*
+ * libEasyNMC DSP communication library.
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup overlay_api Overlays
+ * Overlays let an app use more code and data than fits into internal
+ * memory. Every section named EASYNMC_OVERLAY_PREFIX<id> (e.g.
+ * .easynmc_overlay.3) is kept in host memory by the loader instead of
+ * being uploaded. The app declares an overlay area with
+ * EASYNMC_OVERLAYS(slots, slotlen) (See easynmc.mlb) and gets overlays
+ * with easynmc_overlay_get(id) on the nmc side.
+ *
+ * Hits are handled by the core alone. On a miss the core posts the id and
+ * raises an HP interrupt; the host calls easynmc_overlay_service(), which
+ * copies the overlay into a slot and lets the core go on.
+ *
+ * Overlays linked at an address inside the area are pinned to the slot
+ * containing that address. All others must be position independent
+ * (tables, coefficients) and go to a free slot or the least recently
+ * used one.
+ *
+ * \addtogroup overlay_api
+ * @{
+ */
+
+#define OVL_REQ_SEQ    0
+#define OVL_REQ_ID     1
+#define OVL_DONE_SEQ   2
+#define OVL_ADDR       3
+#define OVL_SLOTS      4
+#define OVL_SLOTLEN    5
+#define OVL_CLOCK      6
+#define OVL_TABLES     8  /* ids + 1, last use stamps, hits, addresses - slots words each */
+#define OVL_NTABLES    4
+
+struct easynmc_overlay {
+	uint32_t  id;
+	uint32_t  addr;    /* Link address, words */
+	uint32_t  size;    /* Bytes */
+	char     *data;
+	struct easynmc_overlay_stats stats;
+	struct easynmc_overlay *next;
+};
+
+struct easynmc_overlays {
+	struct easynmc_overlay *list;
+	int num;
+};
+
+static struct easynmc_overlay *overlay_find(struct easynmc_handle *h, uint32_t id)
+{
+	struct easynmc_overlay *o;
+	if (!h->ovl)
+		return NULL;
+	for (o = h->ovl->list; o; o = o->next)
+		if (o->id == id)
+			return o;
+	return NULL;
+}
+
+static struct easynmc_overlay *overlay_in_slot(struct easynmc_handle *h, int slot)
+{
+	struct easynmc_overlay *o;
+	for (o = h->ovl->list; o; o = o->next)
+		if (o->stats.slot == slot)
+			return o;
+	return NULL;
+}
+
+/**
+ * Register an overlay section found by the loader.
+ * The data buffer is owned by the library afterwards, even on failure.
+ *
+ * @param h
+ * @param name section name
+ * @param shdr
+ * @param data section contents
+ * @return 0 if OK, -1 otherwise
+ */
+int easynmc_overlay_add(struct easynmc_handle *h, const char *name, GElf_Shdr *shdr, char *data)
+{
+	struct easynmc_overlay *o;
+	const char *num = name + strlen(EASYNMC_OVERLAY_PREFIX);
+	char *end;
+	unsigned long id = strtoul(num, &end, 10);
+
+	if (!*num || *end) {
+		err("Bad overlay section name %s, want %s<id>\n", name, EASYNMC_OVERLAY_PREFIX);
+		goto errfree;
+	}
+
+	if (overlay_find(h, id)) {
+		err("Duplicate overlay %lu\n", id);
+		goto errfree;
+	}
+
+	if (!h->ovl) {
+		h->ovl = calloc(1, sizeof(*h->ovl));
+		if (!h->ovl)
+			goto errfree;
+	}
+
+	o = calloc(1, sizeof(*o));
+	if (!o)
+		goto errfree;
+
+	o->id   = id;
+	o->addr = shdr->sh_addr;
+	o->size = shdr->sh_size;
+	o->data = data;
+	o->stats.slot = -1;
+	o->next = h->ovl->list;
+	h->ovl->list = o;
+	h->ovl->num++;
+
+	dbg("Overlay %u: %u bytes linked @0x%x\n", o->id, o->size, o->addr);
+	return 0;
+
+errfree:
+	free(data);
+	return -1;
+}
+
+/**
+ * Set up the overlay area found by the loader. All slots start empty.
+ *
+ * @param h
+ * @param offset area header, words
+ */
+void easynmc_overlay_attach(struct easynmc_handle *h, uint32_t offset)
+{
+	struct easynmc_overlay *o;
+	uint32_t *hdr = &h->imem32[offset];
+
+	h->ovloffset = offset;
+	easynmc_write(h, (offset + OVL_TABLES) << 2, NULL, hdr[OVL_SLOTS] * OVL_NTABLES * 4);
+
+	/* Hits of overlays resident in the previous run can't be collected anymore */
+	if (h->ovl)
+		for (o = h->ovl->list; o; o = o->next)
+			o->stats.slot = -1;
+}
+
+/**
+ * Free all overlays of the loaded app.
+ *
+ * @param h
+ */
+void easynmc_overlay_free(struct easynmc_handle *h)
+{
+	struct easynmc_overlay *o, *next;
+
+	h->ovloffset = 0;
+	if (!h->ovl)
+		return;
+
+	for (o = h->ovl->list; o; o = next) {
+		next = o->next;
+		free(o->data);
+		free(o);
+	}
+	free(h->ovl);
+	h->ovl = NULL;
+}
+
+static int overlay_load(struct easynmc_handle *h, struct easynmc_overlay *o, uint32_t *addr)
+{
+	uint32_t *hdr    = &h->imem32[h->ovloffset];
+	uint32_t slots   = hdr[OVL_SLOTS];
+	uint32_t slotlen = hdr[OVL_SLOTLEN];
+	uint32_t *ids    = &hdr[OVL_TABLES];
+	uint32_t *stamps = &ids[slots];
+	uint32_t *hits   = &stamps[slots];
+	uint32_t *addrs  = &hits[slots];
+	uint32_t area    = h->ovloffset + OVL_TABLES + OVL_NTABLES * slots;
+	uint32_t words   = (o->size + 3) / 4;
+	uint32_t clock   = hdr[OVL_CLOCK];
+	struct easynmc_overlay *victim;
+	int i, slot = -1;
+
+	if (!slots || !slotlen || ((uint64_t) area + slots * slotlen) * 4 > h->imem_size) {
+		err("Bad overlay area: %u slots of %u words\n", slots, slotlen);
+		return -1;
+	}
+
+	if ((o->addr >= area) && (o->addr < area + slots * slotlen)) {
+		slot  = (o->addr - area) / slotlen;
+		*addr = o->addr;
+		if (o->addr + words > area + (slot + 1) * slotlen) {
+			err("Overlay %u crosses the end of slot %d\n", o->id, slot);
+			return -1;
+		}
+	} else {
+		if (words > slotlen) {
+			err("Overlay %u is %u words, slots are %u words\n", o->id, words, slotlen);
+			return -1;
+		}
+		/* A free slot, else the oldest stamp. Clock wraparound is fine */
+		for (i = 0; i < slots; i++) {
+			if (!ids[i]) {
+				slot = i;
+				break;
+			}
+			if ((slot < 0) || ((clock - stamps[i]) > (clock - stamps[slot])))
+				slot = i;
+		}
+		*addr = area + slot * slotlen;
+	}
+
+	victim = overlay_in_slot(h, slot);
+	if (victim) {
+		victim->stats.hits += hits[slot];
+		victim->stats.evictions++;
+		victim->stats.slot = -1;
+		dbg("Overlay %u evicted from slot %d\n", victim->id, slot);
+	}
+
+	ids[slot] = 0;
+	if (0 != easynmc_write(h, *addr << 2, o->data, o->size))
+		return -1;
+	hits[slot]   = 0;
+	addrs[slot]  = *addr;
+	stamps[slot] = ++hdr[OVL_CLOCK];
+	__sync_synchronize();
+	ids[slot]    = o->id + 1;
+
+	o->stats.slot = slot;
+	o->stats.loads++;
+	o->stats.bytes += o->size;
+	dbg("Overlay %u loaded to slot %d @0x%x\n", o->id, slot, *addr);
+	return 0;
+}
+
+/**
+ * Serve a pending overlay request from the core, if any.
+ * Call this whenever an HP interrupt arrives while an app with
+ * overlays is running. nmrun does that for you.
+ *
+ * @param h
+ * @return 1 if a request was served, 0 if there was none
+ */
+int easynmc_overlay_service(struct easynmc_handle *h)
+{
+	struct easynmc_overlay *o;
+	uint32_t *hdr;
+	uint32_t seq, id, addr = 0;
+
+	if (!h->ovloffset)
+		return 0;
+
+	hdr = &h->imem32[h->ovloffset];
+	seq = hdr[OVL_REQ_SEQ];
+	if (seq == hdr[OVL_DONE_SEQ])
+		return 0;
+
+	id = hdr[OVL_REQ_ID];
+	o = overlay_find(h, id);
+	if (!o) {
+		err("Core %d requested unknown overlay %u\n", h->id, id);
+	} else if (0 != overlay_load(h, o, &addr)) {
+		err("Failed to load overlay %u\n", id);
+		addr = 0;
+	}
+
+	/* The core spins on the sequence, the address must land first */
+	hdr[OVL_ADDR] = addr;
+	__sync_synchronize();
+	hdr[OVL_DONE_SEQ] = seq;
+	return 1;
+}
+
+/**
+ * Get the ids of all overlays of the loaded app
+ *
+ * @param h
+ * @param ids
+ * @param max size of ids
+ * @return total number of overlays, may be more than max
+ */
+int easynmc_overlay_list(struct easynmc_handle *h, uint32_t *ids, int max)
+{
+	struct easynmc_overlay *o;
+	int n = 0;
+
+	if (!h->ovl)
+		return 0;
+	for (o = h->ovl->list; o; o = o->next, n++)
+		if (n < max)
+			ids[n] = o->id;
+	return n;
+}
+
+/**
+ * Get overlay usage counters, to tune which overlays should be pinned,
+ * merged or made resident.
+ *
+ * @param h
+ * @param id overlay id or EASYNMC_OVERLAY_ALL for totals
+ * @param st
+ * @return 0 if OK, -1 if there is no such overlay
+ */
+int easynmc_overlay_stats(struct easynmc_handle *h, int id, struct easynmc_overlay_stats *st)
+{
+	struct easynmc_overlay *o;
+	uint32_t *hits = NULL;
+	int found = 0;
+
+	memset(st, 0x0, sizeof(*st));
+	st->slot = -1;
+
+	if (!h->ovl)
+		return (id == EASYNMC_OVERLAY_ALL) ? 0 : -1;
+
+	if (h->ovloffset) {
+		uint32_t *hdr = &h->imem32[h->ovloffset];
+		hits = &hdr[OVL_TABLES + 2 * hdr[OVL_SLOTS]];
+	}
+
+	for (o = h->ovl->list; o; o = o->next) {
+		if ((id != EASYNMC_OVERLAY_ALL) && (o->id != id))
+			continue;
+		st->hits      += o->stats.hits;
+		st->loads     += o->stats.loads;
+		st->evictions += o->stats.evictions;
+		st->bytes     += o->stats.bytes;
+		if (hits && (o->stats.slot >= 0))
+			st->hits += hits[o->stats.slot];
+		if (id != EASYNMC_OVERLAY_ALL)
+			st->slot = o->stats.slot;
+		found++;
+	}
+
+	return ((id == EASYNMC_OVERLAY_ALL) || found) ? 0 : -1;
+}
+
+/**
+ * @}
+ */
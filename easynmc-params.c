@@ -0,0 +1,312 @@
+/*
+ * libEasyNMC DSP communication library.
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup params_api Typed parameters
+ * A typed alternative to easynmc_set_args(). The app declares a parameter
+ * block with EASYNMC_PARAMS(len) macro (See easynmc.mlb), the host stores
+ * native ints, floats, doubles, arrays of those and strings under string
+ * keys, and the app looks them up with easynmc_param_*() on the nmc side,
+ * without parsing anything.
+ *
+ * Every entry is a header, the key (one char per word) and the values.
+ * Entries take an even number of words and doubles are aligned to 64 bits.
+ * Parameters should be set after easynmc_load_abs() and before the app is
+ * started; relaunching the app resets the block.
+ *
+ * \addtogroup params_api
+ * @{
+ */
+
+#define PARAMS_COUNT  0
+#define PARAMS_LEN    1
+#define PARAMS_USED   2
+#define PARAMS_DATA   4
+
+#define PARAM_LEN     0
+#define PARAM_TYPE    1
+#define PARAM_COUNT   2
+#define PARAM_OFFSET  3
+#define PARAM_KEY     4
+
+static uint32_t *params_hdr(struct easynmc_handle *h)
+{
+	if (!h->paramoffset) {
+		err("No parameter block found for this handle\n");
+		return NULL;
+	}
+	return &h->imem32[h->paramoffset];
+}
+
+static int key_equals(const uint32_t *k, uint32_t maxlen, const char *key)
+{
+	uint32_t i;
+	for (i = 0; i < maxlen; i++) {
+		if (k[i] != (unsigned char) key[i])
+			return 0;
+		if (!key[i])
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Remove all parameters.
+ *
+ * @param h
+ * @return 0 if OK, -1 if the app has no parameter block
+ */
+int easynmc_params_clear(struct easynmc_handle *h)
+{
+	uint32_t *hdr = params_hdr(h);
+	uint32_t zero = 0;
+
+	if (!hdr)
+		return -1;
+	/* The count goes first, nobody looks at the entries after that */
+	easynmc_write(h, (h->paramoffset + PARAMS_COUNT) << 2, &zero, 4);
+	return easynmc_write(h, (h->paramoffset + PARAMS_USED) << 2, &zero, 4);
+}
+
+/**
+ * Set a parameter, replacing the one with the same key if any.
+ *
+ * @param h
+ * @param key
+ * @param type EASYNMC_PARAM_*
+ * @param values array of int32_t, float or double, or a NUL-terminated string
+ * @param count number of values, ignored for strings
+ * @return 0 if OK, -1 if the app has no parameter block or on a bad type,
+ *         -2 if the block is too small
+ */
+int easynmc_params_set(struct easynmc_handle *h, const char *key, int type,
+		       const void *values, uint32_t count)
+{
+	uint32_t *hdr = params_hdr(h);
+	uint32_t *blk, *e;
+	uint32_t cap, used, num, keylen, off, len, i, pos;
+	int ret;
+
+	if (!hdr)
+		return -1;
+
+	cap  = hdr[PARAMS_LEN];
+	used = hdr[PARAMS_USED];
+	num  = hdr[PARAMS_COUNT];
+	if ((used > cap) || (((uint64_t) h->paramoffset + PARAMS_DATA + cap) * 4 > h->imem_size)) {
+		err("Corrupted parameter block\n");
+		return -1;
+	}
+
+	if (type == EASYNMC_PARAM_STRING)
+		count = strlen(values) + 1;
+	else if ((type < EASYNMC_PARAM_INT) || (type > EASYNMC_PARAM_DOUBLE)) {
+		err("Bad parameter type %d\n", type);
+		return -1;
+	}
+
+	keylen = strlen(key) + 1;
+	off = PARAM_KEY + keylen;
+	/* Entries start at even offsets, keep the values 64-bit aligned for doubles */
+	if ((type == EASYNMC_PARAM_DOUBLE) && ((h->paramoffset + PARAMS_DATA + off) & 1))
+		off++;
+	len = off + count * ((type == EASYNMC_PARAM_DOUBLE) ? 2 : 1);
+	len = (len + 1) & ~1;
+
+	/* Edited on the host, then written back at once */
+	blk = calloc(cap + 1, sizeof(uint32_t));
+	if (!blk)
+		return -1;
+	memcpy(blk, &hdr[PARAMS_DATA], used * 4);
+
+	for (i = 0, pos = 0; i < num; i++) {
+		e = &blk[pos];
+		if ((e[PARAM_LEN] < PARAM_KEY) || (pos + e[PARAM_LEN] > used)) {
+			err("Corrupted parameter block\n");
+			ret = -1;
+			goto bailout;
+		}
+		if (key_equals(&e[PARAM_KEY], e[PARAM_LEN] - PARAM_KEY, key)) {
+			uint32_t elen = e[PARAM_LEN];
+			memmove(e, &e[elen], (used - pos - elen) * 4);
+			used -= elen;
+			num--;
+			break;
+		}
+		pos += e[PARAM_LEN];
+	}
+
+	if (used + len > cap) {
+		err("Parameter %s does not fit, %u of %u words used\n", key, used, cap);
+		ret = -2;
+		goto bailout;
+	}
+
+	e = &blk[used];
+	memset(e, 0x0, len * 4);
+	e[PARAM_LEN]    = len;
+	e[PARAM_TYPE]   = type;
+	e[PARAM_COUNT]  = count;
+	e[PARAM_OFFSET] = off;
+	for (i = 0; i < keylen; i++)
+		e[PARAM_KEY + i] = (unsigned char) key[i];
+
+	if (type == EASYNMC_PARAM_STRING) {
+		for (i = 0; i < count; i++)
+			e[off + i] = ((const unsigned char *) values)[i];
+	} else {
+		/* 32-bit values and IEEE doubles are laid out the same on both sides */
+		memcpy(&e[off], values, count * ((type == EASYNMC_PARAM_DOUBLE) ? 8 : 4));
+	}
+	used += len;
+	num++;
+
+	/* Entries first, then the header that makes them visible */
+	ret = easynmc_write(h, (h->paramoffset + PARAMS_DATA) << 2, blk, used * 4);
+	if (ret == 0) {
+		uint32_t newhdr[3] = { num, cap, used };
+		ret = easynmc_write(h, (h->paramoffset + PARAMS_COUNT) << 2, newhdr, sizeof(newhdr));
+	}
+
+	dbg("Parameter %s: type %d, %u values, %u of %u words used\n", key, type, count, used, cap);
+
+bailout:
+	free(blk);
+	return ret;
+}
+
+/* Parse count comma-separated values of a given type into w or d */
+static int parse_values(const char *val, int count, int type, uint32_t *w, double *d)
+{
+	const char *tok = val;
+	char *end;
+	int i;
+
+	for (i = 0; i < count; i++, tok = end + 1) {
+		if (type == EASYNMC_PARAM_INT) {
+			int32_t x = strtol(tok, &end, 0);
+			memcpy(&w[i], &x, 4);
+		} else if (type == EASYNMC_PARAM_FLOAT) {
+			float x = strtof(tok, &end);
+			memcpy(&w[i], &x, 4);
+		} else {
+			d[i] = strtod(tok, &end);
+		}
+		if ((end == tok) || ((*end != ',') && (*end != 0)))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Set a parameter from a "key=[type:]value[,value...]" string, where type
+ * is one of i (int), f (float), d (double) or s (string). Without a type
+ * the values are ints if they all look like ints, floats if they all look
+ * like numbers, and a string otherwise.
+ *
+ * @param h
+ * @param spec
+ * @return same as easynmc_params_set(), -3 for a malformed spec
+ */
+int easynmc_params_parse(struct easynmc_handle *h, const char *spec)
+{
+	char *s = strdup(spec);
+	char *key, *val, *tok;
+	uint32_t *w = NULL;
+	double *d = NULL;
+	int type = 0, count, ret = -3;
+
+	if (!s)
+		return -1;
+
+	val = strchr(s, '=');
+	if (!val || (val == s)) {
+		err("Bad parameter %s, want key=[type:]value[,value...]\n", spec);
+		goto bailout;
+	}
+	*val++ = 0;
+	key = s;
+
+	if (val[0] && (val[1] == ':')) {
+		switch (val[0]) {
+		case 'i': type = EASYNMC_PARAM_INT;    break;
+		case 'f': type = EASYNMC_PARAM_FLOAT;  break;
+		case 'd': type = EASYNMC_PARAM_DOUBLE; break;
+		case 's': type = EASYNMC_PARAM_STRING; break;
+		}
+		if (type)
+			val += 2;
+	}
+
+	if (type == EASYNMC_PARAM_STRING) {
+		ret = easynmc_params_set(h, key, type, val, 0);
+		goto bailout;
+	}
+
+	for (count = 1, tok = val; (tok = strchr(tok, ',')); tok++)
+		count++;
+
+	w = calloc(count, sizeof(*w));
+	d = calloc(count, sizeof(*d));
+	if (!w || !d) {
+		ret = -1;
+		goto bailout;
+	}
+
+	if (type) {
+		if (!parse_values(val, count, type, w, d)) {
+			err("Bad value for %s: %s\n", key, val);
+			goto bailout;
+		}
+	} else if (parse_values(val, count, EASYNMC_PARAM_INT, w, d)) {
+		type = EASYNMC_PARAM_INT;
+	} else if (parse_values(val, count, EASYNMC_PARAM_FLOAT, w, d)) {
+		type = EASYNMC_PARAM_FLOAT;
+	} else {
+		ret = easynmc_params_set(h, key, EASYNMC_PARAM_STRING, val, 0);
+		goto bailout;
+	}
+
+	ret = easynmc_params_set(h, key, type, (type == EASYNMC_PARAM_DOUBLE) ? (void *) d : (void *) w, count);
+
+bailout:
+	free(w);
+	free(d);
+	free(s);
+	return ret;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,275 @@
+/*
+ * libEasyNMC DSP communication library.
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup queue_api Command queue
+ * A persistent app declares a command queue with EASYNMC_QUEUE(depth,
+ * cmdwords) macro (See easynmc.mlb) and calls easynmc_queue_serve() on
+ * the nmc side, turning it into a job server: the app is loaded and
+ * started once, and every job after that is a command in a ring.
+ *
+ * The host stages any number of commands with easynmc_queue_submit(),
+ * then publishes them all and rings the doorbell (one HP interrupt) with
+ * easynmc_queue_kick(). The app runs everything there is and raises one
+ * LP interrupt per batch of completions, which are collected with
+ * easynmc_queue_poll() or easynmc_queue_wait().
+ *
+ * Both rings are single producer, single consumer. Use one thread per
+ * handle on the host side.
+ *
+ * \addtogroup queue_api
+ * @{
+ */
+
+#define Q_DEPTH      0
+#define Q_CMDWORDS   1
+#define Q_SQ_HEAD    2
+#define Q_SQ_TAIL    3
+#define Q_CQ_HEAD    4
+#define Q_CQ_TAIL    5
+#define Q_DOORBELLS  6
+#define Q_BATCHES    7
+#define Q_DATA       8
+
+static uint32_t *queue_hdr(struct easynmc_handle *h)
+{
+	uint32_t *hdr;
+	uint32_t depth;
+
+	if (!h->queueoffset) {
+		err("No command queue found for this handle\n");
+		return NULL;
+	}
+
+	hdr = &h->imem32[h->queueoffset];
+	depth = hdr[Q_DEPTH];
+	if (!depth || (depth & (depth - 1)) || (hdr[Q_CMDWORDS] < 2) ||
+	    (((uint64_t) h->queueoffset + Q_DATA + depth * (hdr[Q_CMDWORDS] + 2)) * 4 > h->imem_size)) {
+		err("Corrupted command queue\n");
+		return NULL;
+	}
+	return hdr;
+}
+
+/**
+ * Set up the command queue found by the loader.
+ *
+ * @param h
+ * @param offset queue header, words
+ */
+void easynmc_queue_attach(struct easynmc_handle *h, uint32_t offset)
+{
+	h->queueoffset = offset;
+	h->queuehead   = h->imem32[offset + Q_SQ_HEAD];
+}
+
+/**
+ * Stage a command. It is not visible to the app until easynmc_queue_kick().
+ *
+ * @param h
+ * @param op opcode, EASYNMC_QUEUE_EXIT (0) stops the server
+ * @param tag returned with the completion
+ * @param args
+ * @param nargs at most cmdwords - 2, the rest is zeroed
+ * @return 0 if OK, -1 if there is no queue or nargs is too big, -2 if the ring is full
+ */
+int easynmc_queue_submit(struct easynmc_handle *h, uint32_t op, uint32_t tag,
+			 const uint32_t *args, int nargs)
+{
+	uint32_t *hdr = queue_hdr(h);
+	uint32_t cmdwords, mask, head;
+	uint32_t *cmd;
+
+	if (!hdr)
+		return -1;
+
+	cmdwords = hdr[Q_CMDWORDS];
+	mask = hdr[Q_DEPTH] - 1;
+	head = h->queuehead & mask;
+
+	if ((nargs < 0) || (nargs > cmdwords - 2)) {
+		err("Command takes at most %u arguments\n", cmdwords - 2);
+		return -1;
+	}
+
+	if (((head + 1) & mask) == hdr[Q_SQ_TAIL])
+		return -2;
+
+	cmd = calloc(cmdwords, sizeof(uint32_t));
+	if (!cmd)
+		return -1;
+	cmd[0] = op;
+	cmd[1] = tag;
+	if (nargs)
+		memcpy(&cmd[2], args, nargs * sizeof(uint32_t));
+
+	if (0 != easynmc_write(h, (h->queueoffset + Q_DATA + head * cmdwords) << 2,
+			       cmd, cmdwords * sizeof(uint32_t))) {
+		free(cmd);
+		return -1;
+	}
+	free(cmd);
+
+	h->queuehead = (head + 1) & mask;
+	return 0;
+}
+
+/**
+ * Publish all staged commands and ring the doorbell.
+ *
+ * @param h
+ * @return number of commands published, -1 on error
+ */
+int easynmc_queue_kick(struct easynmc_handle *h)
+{
+	uint32_t *hdr = queue_hdr(h);
+	uint32_t n;
+
+	if (!hdr)
+		return -1;
+
+	n = (h->queuehead - hdr[Q_SQ_HEAD]) & (hdr[Q_DEPTH] - 1);
+	if (!n)
+		return 0;
+
+	/* Commands must land before the head that makes them visible */
+	__sync_synchronize();
+	hdr[Q_SQ_HEAD] = h->queuehead;
+	hdr[Q_DOORBELLS]++;
+
+	if (0 != easynmc_send_irq(h, NMC_IRQ_HP))
+		return -1;
+
+	dbg("Queued %u commands to core %d\n", n, h->id);
+	return n;
+}
+
+/**
+ * Collect completions without waiting.
+ *
+ * @param h
+ * @param c
+ * @param max size of c
+ * @return number of completions, -1 on error
+ */
+int easynmc_queue_poll(struct easynmc_handle *h, struct easynmc_completion *c, int max)
+{
+	uint32_t *hdr = queue_hdr(h);
+	uint32_t *cq, mask, head, tail;
+	int n = 0;
+
+	if (!hdr)
+		return -1;
+
+	cq   = &hdr[Q_DATA + hdr[Q_DEPTH] * hdr[Q_CMDWORDS]];
+	mask = hdr[Q_DEPTH] - 1;
+	head = hdr[Q_CQ_HEAD] & mask;
+	tail = hdr[Q_CQ_TAIL] & mask;
+
+	/* Entries up to head are complete once we see head */
+	__sync_synchronize();
+	while ((n < max) && (tail != head)) {
+		c[n].tag    = cq[tail * 2];
+		c[n].result = cq[tail * 2 + 1];
+		tail = (tail + 1) & mask;
+		n++;
+	}
+
+	__sync_synchronize();
+	hdr[Q_CQ_TAIL] = tail;
+	return n;
+}
+
+/**
+ * Collect completions, waiting for the next batch if there are none.
+ *
+ * @param h
+ * @param c
+ * @param max size of c
+ * @param timeout ms, for each interrupt
+ * @return number of completions, 0 on timeout, -1 on error
+ */
+int easynmc_queue_wait(struct easynmc_handle *h, struct easynmc_completion *c, int max,
+		       uint32_t timeout)
+{
+	struct easynmc_token *t;
+	int n, evt;
+
+	/* Arm the token first, so that a batch completed right now is not missed */
+	t = easynmc_token_new(h, EASYNMC_EVT_LP);
+	if (!t)
+		return -1;
+
+	n = easynmc_queue_poll(h, c, max);
+	while (n == 0) {
+		/* LP is also used for stdio, so there may be nothing for us */
+		evt = easynmc_token_wait(t, timeout);
+		if (evt & EASYNMC_EVT_ERROR)
+			n = -1;
+		if (evt & (EASYNMC_EVT_ERROR | EASYNMC_EVT_TIMEOUT | EASYNMC_EVT_CANCELLED))
+			break;
+		n = easynmc_queue_poll(h, c, max);
+	}
+
+	free(t);
+	return n;
+}
+
+/**
+ * Get queue counters.
+ *
+ * @param h
+ * @param st
+ * @return 0 if OK, -1 if there is no queue
+ */
+int easynmc_queue_stats(struct easynmc_handle *h, struct easynmc_queue_stats *st)
+{
+	uint32_t *hdr = queue_hdr(h);
+	uint32_t mask;
+
+	if (!hdr)
+		return -1;
+
+	mask = hdr[Q_DEPTH] - 1;
+	st->doorbells = hdr[Q_DOORBELLS];
+	st->batches   = hdr[Q_BATCHES];
+	st->staged    = (h->queuehead - hdr[Q_SQ_HEAD]) & mask;
+	st->queued    = (hdr[Q_SQ_HEAD] - hdr[Q_SQ_TAIL]) & mask;
+	st->completed = (hdr[Q_CQ_HEAD] - hdr[Q_CQ_TAIL]) & mask;
+	return 0;
+}
+
+/**
+ * @}
+ */
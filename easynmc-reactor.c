@@ -0,0 +1,569 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup reactor_api Event reactor
+ * The reactor runs an event loop for any number of cores in the calling
+ * thread. For every core it calls back on data from the app's stdout,
+ * when the app's stdin can take more data, on LP/HP/NMI events and when
+ * the app exits. Other descriptors (e.g. the terminal) can be added to the
+ * same loop. For a dedicated real-time thread see the dispatcher instead.
+ *
+ * Callbacks may add and remove cores and descriptors and stop the reactor.
+ *
+ * \addtogroup reactor_api
+ * @{
+ */
+
+#define REACTOR_MAX_EVENTS 64 /* Per epoll_wait(), the rest come on the next round */
+
+enum { 
+	SRC_STOP, 
+	SRC_MEM, 
+	SRC_IO, 
+	SRC_FD 
+};
+
+struct reactor_source {
+	int   type;
+	void *owner;
+};
+
+struct reactor_core {
+	struct easynmc_handle        *h;
+	struct easynmc_reactor_ops   *ops;
+	void                         *arg;
+	int                           busy;  /* App running or about to be started */
+	uint32_t                      ioevents;
+	int                           iofl;  /* io descriptor flags before add, -1 - not watched */
+	int                           recheck; /* Look at the core once without an event */
+	int                           dead;
+	struct reactor_source         mem;
+	struct reactor_source         io;
+	struct reactor_core          *next;
+};
+
+struct reactor_fd {
+	int                           fd;
+	void                        (*cb)(int fd, uint32_t events, void *arg);
+	void                         *arg;
+	int                           dead;
+	struct reactor_source         src;
+	struct reactor_fd            *next;
+};
+
+struct easynmc_reactor {
+	int                       efd;
+	int                       stopfd;
+	int                       stop;
+	struct reactor_source     stop_src;
+	struct reactor_core      *cores;
+	struct reactor_fd        *fds;
+	int                       num_cores;
+};
+
+static int watch(struct easynmc_reactor *r, int op, int fd, uint32_t events, 
+		 struct reactor_source *src)
+{
+	struct epoll_event ev;
+	ev.events   = events;
+	ev.data.ptr = src;
+	if (epoll_ctl(r->efd, op, fd, &ev) != 0) {
+		perror("epoll_ctl");
+		return -1;
+	}
+	return 0;
+}
+
+static int core_busy(struct easynmc_handle *h)
+{
+	/* A start request not yet picked up by the IPL counts as running */
+	return (easynmc_core_state(h) == EASYNMC_CORE_RUNNING) || 
+		h->imem32[NMC_REG_CORE_START];
+}
+
+/**
+ * Create a new reactor.
+ *
+ * @return
+ */
+struct easynmc_reactor *easynmc_reactor_new(void)
+{
+	struct easynmc_reactor *r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->efd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->efd == -1)
+		goto errfree;
+
+	r->stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (r->stopfd == -1)
+		goto errcloseefd;
+
+	r->stop_src.type = SRC_STOP;
+	if (watch(r, EPOLL_CTL_ADD, r->stopfd, EPOLLIN, &r->stop_src))
+		goto errclosestop;
+
+	return r;
+
+errclosestop:
+	close(r->stopfd);
+errcloseefd:
+	close(r->efd);
+errfree:
+	err("Failed to create reactor\n");
+	free(r);
+	return NULL;
+}
+
+/* Stop watching the core, the io descriptor is shared with other handles */
+static void core_unwatch(struct easynmc_reactor *r, struct reactor_core *c)
+{
+	epoll_ctl(r->efd, EPOLL_CTL_DEL, c->h->memfd, NULL);
+	if (c->iofl != -1) {
+		epoll_ctl(r->efd, EPOLL_CTL_DEL, c->h->iofd, NULL);
+		fcntl(c->h->iofd, F_SETFL, c->iofl);
+		c->iofl = -1;
+	}
+}
+
+static struct reactor_core *core_find(struct easynmc_reactor *r, struct easynmc_handle *h)
+{
+	struct reactor_core *c;
+	for (c = r->cores; c; c = c->next)
+		if ((c->h == h) && !c->dead)
+			return c;
+	return NULL;
+}
+
+/**
+ * Add a core to the reactor. Stdout is only monitored if ops->on_stdout is 
+ * set and stdin only if ops->on_stdin is set; the io descriptor is switched 
+ * to non-blocking mode in this case, until the core is removed. Pending 
+ * events are discarded, but the next easynmc_reactor_poll() checks whether 
+ * the app has exited or requested an overlay meanwhile, so the app can be 
+ * started before the core is added.
+ *
+ * @param r
+ * @param h
+ * @param ops callbacks, must stay valid until the core is removed
+ * @param arg user argument passed to callbacks
+ * @return 0 if OK
+ */
+int easynmc_reactor_add(struct easynmc_reactor *r, struct easynmc_handle *h,
+			struct easynmc_reactor_ops *ops, void *arg)
+{
+	struct reactor_core *c;
+
+	if (core_find(r, h)) {
+		err("Core %d is already in the reactor\n", h->id);
+		return -1;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -1;
+	c->h    = h;
+	c->ops  = ops;
+	c->arg  = arg;
+	c->busy = core_busy(h);
+	c->mem.type  = SRC_MEM;
+	c->mem.owner = c;
+	c->io.type   = SRC_IO;
+	c->io.owner  = c;
+	c->iofl      = -1;
+
+	easynmc_pollmark(h);
+	/* Edge triggered: simulated cores never clear their memfd */
+	if (watch(r, EPOLL_CTL_ADD, h->memfd, EPOLLNMI | EPOLLHP | EPOLLLP | EPOLLET, &c->mem))
+		goto errfree;
+
+	if (ops->on_stdout)
+		c->ioevents |= EPOLLIN;
+
+	if (ops->on_stdout || ops->on_stdin) {
+		int fl = fcntl(h->iofd, F_GETFL, 0);
+		fcntl(h->iofd, F_SETFL, fl | O_NONBLOCK);
+		if (watch(r, EPOLL_CTL_ADD, h->iofd, c->ioevents, &c->io)) {
+			fcntl(h->iofd, F_SETFL, fl);
+			goto errunwatch;
+		}
+		c->iofl = fl;
+	}
+
+	c->recheck = 1;
+	c->next = r->cores;
+	r->cores = c;
+	r->num_cores++;
+	dbg("Reactor: added core %d, %s\n", h->id, c->busy ? "running" : "idle");
+	return 0;
+
+errunwatch:
+	epoll_ctl(r->efd, EPOLL_CTL_DEL, h->memfd, NULL);
+errfree:
+	free(c);
+	return -1;
+}
+
+/**
+ * Remove a core from the reactor. The handle is not closed.
+ *
+ * @param r
+ * @param h
+ * @return 0 if OK, -1 if the core was not added
+ */
+int easynmc_reactor_remove(struct easynmc_reactor *r, struct easynmc_handle *h)
+{
+	struct reactor_core *c = core_find(r, h);
+	if (!c)
+		return -1;
+
+	core_unwatch(r, c);
+
+	/* Events of this round may still point here, freed after the round */
+	c->dead = 1;
+	r->num_cores--;
+	return 0;
+}
+
+/**
+ * Start an app on a core already added to the reactor. Unlike 
+ * easynmc_start_app() followed by easynmc_reactor_add() no events are 
+ * lost in between, and on_exit is called even if the app exits before 
+ * the next easynmc_reactor_poll().
+ *
+ * @param r
+ * @param h
+ * @param entry
+ * @return 0 if OK, -1 if the core was not added, 1 if the app didn't start
+ */
+int easynmc_reactor_start_app(struct easynmc_reactor *r, struct easynmc_handle *h, uint32_t entry)
+{
+	struct reactor_core *c = core_find(r, h);
+	if (!c)
+		return -1;
+	if (easynmc_start_app(h, entry) != 0)
+		return 1;
+	c->busy = 1;
+	return 0;
+}
+
+/**
+ * Turn on_stdin callbacks on or off. They are off after easynmc_reactor_add(),
+ * turn them on when there is something to send to the app, and off again
+ * when it's all sent.
+ *
+ * @param r
+ * @param h
+ * @param on
+ * @return 0 if OK
+ */
+int easynmc_reactor_want_stdin(struct easynmc_reactor *r, struct easynmc_handle *h, int on)
+{
+	struct reactor_core *c = core_find(r, h);
+	uint32_t events;
+
+	if (!c || !c->ops->on_stdin)
+		return -1;
+
+	events = on ? (c->ioevents | EPOLLOUT) : (c->ioevents & ~EPOLLOUT);
+	if (events == c->ioevents)
+		return 0;
+
+	c->ioevents = events;
+	return watch(r, EPOLL_CTL_MOD, h->iofd, events, &c->io);
+}
+
+/**
+ * Add any other descriptor to the reactor.
+ *
+ * @param r
+ * @param fd
+ * @param events EPOLL* events to watch for
+ * @param cb called with the events that occurred
+ * @param arg user argument passed to cb
+ * @return 0 if OK
+ */
+int easynmc_reactor_add_fd(struct easynmc_reactor *r, int fd, uint32_t events,
+			   void (*cb)(int fd, uint32_t events, void *arg), void *arg)
+{
+	struct reactor_fd *f = calloc(1, sizeof(*f));
+	if (!f)
+		return -1;
+	f->fd  = fd;
+	f->cb  = cb;
+	f->arg = arg;
+	f->src.type  = SRC_FD;
+	f->src.owner = f;
+
+	if (watch(r, EPOLL_CTL_ADD, fd, events, &f->src)) {
+		free(f);
+		return -1;
+	}
+
+	f->next = r->fds;
+	r->fds = f;
+	return 0;
+}
+
+/**
+ * Remove a descriptor added with easynmc_reactor_add_fd(). It is not closed.
+ *
+ * @param r
+ * @param fd
+ * @return 0 if OK, -1 if the descriptor was not added
+ */
+int easynmc_reactor_remove_fd(struct easynmc_reactor *r, int fd)
+{
+	struct reactor_fd *f;
+	for (f = r->fds; f; f = f->next) {
+		if ((f->fd == fd) && !f->dead) {
+			epoll_ctl(r->efd, EPOLL_CTL_DEL, fd, NULL);
+			f->dead = 1;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void drain_stdout(struct reactor_core *c)
+{
+	char buf[1024];
+	int n;
+	while (!c->dead && ((n = read(c->h->iofd, buf, sizeof(buf))) > 0))
+		c->ops->on_stdout(c->h, buf, n, c->arg);
+}
+
+static void handle_io(struct reactor_core *c, uint32_t events)
+{
+	if ((events & EPOLLIN) && c->ops->on_stdout)
+		drain_stdout(c);
+	if (!c->dead && (events & EPOLLOUT) && c->ops->on_stdin)
+		c->ops->on_stdin(c->h, c->arg);
+}
+
+static void handle_mem(struct reactor_core *c, uint32_t events)
+{
+	static const struct { 
+		uint32_t epoll; 
+		int      evt; 
+	} map[] = {
+		{ EPOLLNMI, EASYNMC_EVT_NMI   },
+		{ EPOLLHP,  EASYNMC_EVT_HP    },
+		{ EPOLLLP,  EASYNMC_EVT_LP    },
+		{ EPOLLERR, EASYNMC_EVT_ERROR },
+	};
+	int i, busy;
+
+	for (i = 0; i < ARRAY_SIZE(map); i++) {
+		if (!(events & map[i].epoll) || c->dead)
+			continue;
+		/* Same records as easynmc_token_wait(), for --replay-sync */
+		if (map[i].evt != EASYNMC_EVT_ERROR)
+			easynmc_record(c->h, EASYNMC_REC_EVENT, map[i].evt, 0, NULL, 0);
+		if (c->ops->on_event)
+			c->ops->on_event(c->h, map[i].evt, c->arg);
+	}
+
+	if (c->dead)
+		return;
+
+	busy = core_busy(c->h);
+	if (c->busy && !busy) {
+		/* Whatever the app has written before exiting comes first */
+		if (c->ops->on_stdout)
+			drain_stdout(c);
+		c->busy = 0;
+		if (!c->dead && c->ops->on_exit)
+			c->ops->on_exit(c->h, easynmc_exitcode(c->h), c->arg);
+	}
+	c->busy = busy;
+}
+
+static void collect_garbage(struct easynmc_reactor *r)
+{
+	struct reactor_core **c = &r->cores;
+	struct reactor_fd **f = &r->fds;
+
+	while (*c) {
+		struct reactor_core *tmp = *c;
+		if (!tmp->dead) {
+			c = &tmp->next;
+			continue;
+		}
+		*c = tmp->next;
+		free(tmp);
+	}
+
+	while (*f) {
+		struct reactor_fd *tmp = *f;
+		if (!tmp->dead) {
+			f = &tmp->next;
+			continue;
+		}
+		*f = tmp->next;
+		free(tmp);
+	}
+}
+
+/**
+ * Wait for events and dispatch them once.
+ *
+ * @param r
+ * @param timeout ms, -1 - wait forever
+ * @return number of events dispatched, 0 on timeout, -1 on error
+ */
+int easynmc_reactor_poll(struct easynmc_reactor *r, int timeout)
+{
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	struct reactor_core *c;
+	int i, n, rechecked = 0;
+
+	/* Events that came before the core was armed are gone, catch up on what they were for */
+	for (c = r->cores; c; c = c->next) {
+		if (!c->recheck || c->dead)
+			continue;
+		c->recheck = 0;
+		easynmc_overlay_service(c->h);
+		handle_mem(c, 0);
+		rechecked++;
+	}
+
+	n = epoll_wait(r->efd, events, REACTOR_MAX_EVENTS, rechecked ? 0 : timeout);
+	if (n == -1) {
+		if (errno == EINTR) {
+			collect_garbage(r);
+			return rechecked;
+		}
+		perror("epoll_wait");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct reactor_source *src = events[i].data.ptr;
+		switch (src->type) {
+		case SRC_STOP:
+			r->stop = 1;
+			break;
+		case SRC_MEM:
+			if (!((struct reactor_core *) src->owner)->dead)
+				handle_mem(src->owner, events[i].events);
+			break;
+		case SRC_IO:
+			if (!((struct reactor_core *) src->owner)->dead)
+				handle_io(src->owner, events[i].events);
+			break;
+		case SRC_FD: {
+			struct reactor_fd *f = src->owner;
+			if (!f->dead)
+				f->cb(f->fd, events[i].events, f->arg);
+			break;
+		}
+		}
+	}
+
+	collect_garbage(r);
+	return n + rechecked;
+}
+
+/**
+ * Run the reactor until easynmc_reactor_stop() is called or there are 
+ * no cores left.
+ *
+ * @param r
+ * @return 0 if OK, -1 on error
+ */
+int easynmc_reactor_run(struct easynmc_reactor *r)
+{
+	uint64_t cnt;
+
+	r->stop = 0;
+	while (!r->stop && r->num_cores) {
+		if (easynmc_reactor_poll(r, -1) == -1)
+			return -1;
+	}
+
+	/* Eat the stop request, so that the next run doesn't return at once */
+	if (read(r->stopfd, &cnt, sizeof(cnt)) == -1) { 
+		/* Nothing there */
+	}
+	return 0;
+}
+
+/**
+ * Make easynmc_reactor_run() return. Can be called from callbacks, other
+ * threads and signal handlers.
+ *
+ * @param r
+ */
+void easynmc_reactor_stop(struct easynmc_reactor *r)
+{
+	uint64_t one = 1;
+	if (write(r->stopfd, &one, sizeof(one)) != sizeof(one))
+		perror("write");
+}
+
+/**
+ * Free the reactor. Handles and descriptors are not closed.
+ *
+ * @param r
+ */
+void easynmc_reactor_free(struct easynmc_reactor *r)
+{
+	struct reactor_core *c;
+	struct reactor_fd *f;
+
+	for (c = r->cores; c; c = c->next) {
+		if (!c->dead)
+			core_unwatch(r, c);
+		c->dead = 1;
+	}
+	for (f = r->fds; f; f = f->next)
+		f->dead = 1;
+	collect_garbage(r);
+
+	close(r->stopfd);
+	close(r->efd);
+	free(r);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,467 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup record_api Session record and replay
+ * The recorder logs everything the library does to a core (uploads, irqs, 
+ * app starts, stdio attachment), everything it observes (token and reactor
+ * events, state changes) and,
+ * if the application reports it, stdio traffic. Every record carries a 
+ * monotonic timestamp relative to the start of the recording.
+ *
+ * The replayer reads such a log and drives the same interactions against 
+ * a core, either with original timing or as fast as possible.
+ *
+ * NOTE: Writes done by the application directly through h->imem are 
+ * not seen by the recorder. Use easynmc_record_upload() to log them.
+ *
+ * \addtogroup record_api
+ * @{
+ */
+
+#define REC_MAGIC    "NMCREC"
+#define REC_VERSION  1
+
+struct rec_file_header {
+	char      magic[8];
+	uint32_t  version;
+	uint32_t  core_id;
+	char      core_name[64];
+	uint64_t  start_realtime_ns;
+};
+
+struct rec_entry {
+	uint64_t  ts_ns;
+	uint16_t  type;
+	uint16_t  reserved;
+	uint32_t  arg0;
+	uint32_t  arg1;
+	uint32_t  len;
+};
+
+struct easynmc_recorder {
+	FILE            *fd;
+	pthread_mutex_t  lock;
+	uint64_t         start_ns;
+	int              last_state;
+	int              failed;
+};
+
+static uint64_t mono_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Start recording all interactions with the core to a file.
+ *
+ * @param h
+ * @param path
+ * @return 0 if OK
+ */
+int easynmc_record_start(struct easynmc_handle *h, const char *path)
+{
+	struct rec_file_header hdr;
+	struct easynmc_recorder *r;
+	struct timespec ts;
+
+	if (h->rec) {
+		err("Already recording core %d\n", h->id);
+		return -1;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -1;
+
+	r->fd = fopen(path, "wb");
+	if (!r->fd) {
+		perror("fopen");
+		free(r);
+		return -1;
+	}
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	strcpy(hdr.magic, REC_MAGIC);
+	hdr.version = REC_VERSION;
+	hdr.core_id = h->id;
+	easynmc_get_core_name(h, hdr.core_name);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	hdr.start_realtime_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, r->fd) != 1) {
+		perror("fwrite");
+		fclose(r->fd);
+		free(r);
+		return -1;
+	}
+
+	pthread_mutex_init(&r->lock, NULL);
+	r->start_ns   = mono_ns();
+	r->last_state = -1;
+	h->rec = r;
+	dbg("Recording core %d to %s\n", h->id, path);
+	return 0;
+}
+
+/**
+ * Stop recording and close the log.
+ *
+ * @param h
+ * @return 0 if OK, -1 if some records were lost
+ */
+int easynmc_record_stop(struct easynmc_handle *h)
+{
+	struct easynmc_recorder *r = h->rec;
+	int ret;
+	if (!r)
+		return 0;
+	h->rec = NULL;
+	ret = (fclose(r->fd) || r->failed) ? -1 : 0;
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+	return ret;
+}
+
+/**
+ * Append a record to the log. Does nothing if the handle is not being recorded.
+ * Normally called by the library itself, but applications may log their own
+ * stdio traffic (EASYNMC_REC_STDIN, EASYNMC_REC_STDOUT) or EASYNMC_REC_MARK records.
+ *
+ * @param h
+ * @param type one of EASYNMC_REC_*
+ * @param arg0
+ * @param arg1
+ * @param data payload, may be NULL
+ * @param len payload length in bytes
+ */
+void easynmc_record(struct easynmc_handle *h, int type, uint32_t arg0, uint32_t arg1,
+		    const void *data, uint32_t len)
+{
+	struct easynmc_recorder *r = h->rec;
+	struct rec_entry e;
+
+	if (!r)
+		return;
+
+	e.ts_ns    = mono_ns() - r->start_ns;
+	e.type     = type;
+	e.reserved = 0;
+	e.arg0     = arg0;
+	e.arg1     = arg1;
+	e.len      = data ? len : 0;
+
+	pthread_mutex_lock(&r->lock);
+	if ((fwrite(&e, sizeof(e), 1, r->fd) != 1) || 
+	    (e.len && (fwrite(data, e.len, 1, r->fd) != 1)))
+		r->failed = 1;
+	pthread_mutex_unlock(&r->lock);
+}
+
+/**
+ * Log a block of internal memory the application has written directly.
+ *
+ * @param h
+ * @param addr byte offset in imem
+ * @param len length in bytes
+ */
+void easynmc_record_upload(struct easynmc_handle *h, uint32_t addr, uint32_t len)
+{
+	if (h->rec)
+		easynmc_record(h, EASYNMC_REC_UPLOAD, addr, len, &h->imem[addr], len);
+}
+
+/* Called from easynmc_core_state(), only logs changes */
+void easynmc_record_state(struct easynmc_handle *h, int state)
+{
+	struct easynmc_recorder *r = h->rec;
+	if (!r || (r->last_state == state))
+		return;
+	r->last_state = state;
+	easynmc_record(h, EASYNMC_REC_STATE, state, 0, NULL, 0);
+}
+
+static void sleep_until(uint64_t deadline)
+{
+	struct timespec ts;
+	ts.tv_sec  = deadline / 1000000000ULL;
+	ts.tv_nsec = deadline % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static void drain_stdout(struct easynmc_handle *h, struct easynmc_replay_opts *o, 
+			 struct easynmc_replay_stats *st)
+{
+	char buf[1024];
+	int n;
+	while ((n = read(h->iofd, buf, sizeof(buf))) > 0) {
+		st->stdout_bytes += n;
+		if ((o->stdout_fd >= 0) && (write(o->stdout_fd, buf, n) != n))
+			perror("write");
+	}
+}
+
+/*
+ * The io fd is non-blocking during replay and the stdin ring may be full,
+ * so keep feeding it (and draining stdout, the app may be stuck on it)
+ * until everything is in or timeout_ms runs out.
+ */
+static void replay_stdin(struct easynmc_handle *h, const char *data, uint32_t len,
+			 struct easynmc_replay_opts *o, struct easynmc_replay_stats *st)
+{
+	uint64_t deadline = mono_ns() + (uint64_t) o->timeout_ms * 1000000ULL;
+	uint32_t done = 0;
+
+	while (done < len) {
+		struct pollfd pfd = { h->iofd, POLLIN | POLLOUT, 0 };
+		uint64_t now;
+		ssize_t n = write(h->iofd, &data[done], len - done);
+		if (n > 0) {
+			done += n;
+			continue;
+		}
+		if ((n < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+			perror("write");
+			break;
+		}
+		now = mono_ns();
+		if (now >= deadline)
+			break;
+		if (poll(&pfd, 1, (deadline - now + 999999) / 1000000) < 0 && errno != EINTR)
+			break;
+		if (pfd.revents & POLLIN)
+			drain_stdout(h, o, st);
+	}
+
+	st->stdin_bytes += done;
+	if (done < len) {
+		dbg("Replay: dropped %u bytes of stdin\n", len - done);
+		st->stdin_dropped += len - done;
+	}
+}
+
+static int wait_state(struct easynmc_handle *h, int state, uint32_t timeout_ms)
+{
+	uint64_t deadline = mono_ns() + (uint64_t) timeout_ms * 1000000ULL;
+	while (easynmc_core_state(h) != state) {
+		if (mono_ns() > deadline)
+			return -1;
+		usleep(100);
+	}
+	return 0;
+}
+
+static int replay_one(struct easynmc_handle *h, struct rec_entry *e, char *data, 
+		      struct easynmc_token *tok, struct easynmc_replay_opts *o, 
+		      struct easynmc_replay_stats *st)
+{
+	int sync = o->flags & EASYNMC_REPLAY_SYNC;
+	int evt;
+
+	switch (e->type) {
+	case EASYNMC_REC_UPLOAD:
+	case EASYNMC_REC_FILL:
+		if ((e->type == EASYNMC_REC_UPLOAD) && (e->len != e->arg1))
+			return -1;
+		if (0 != easynmc_write(h, e->arg0, 
+				       (e->type == EASYNMC_REC_FILL) ? NULL : data, e->arg1))
+			return -1;
+		st->uploads++;
+		break;
+	case EASYNMC_REC_IRQ:
+		easynmc_send_irq(h, e->arg0);
+		st->irqs++;
+		break;
+	case EASYNMC_REC_START:
+		if (easynmc_start_app(h, e->arg0) != 0)
+			return -1;
+		break;
+	case EASYNMC_REC_STDIO:
+		if (easynmc_stdio_attach(h, e->arg0, e->arg1) != 0)
+			return -1;
+		break;
+	case EASYNMC_REC_STDIN:
+		replay_stdin(h, data, e->len, o, st);
+		break;
+	case EASYNMC_REC_EVENT:
+		if (!sync)
+			break;
+		evt = easynmc_token_wait(tok, o->timeout_ms);
+		if (evt == e->arg0) {
+			st->events_matched++;
+		} else {
+			dbg("Replay: expected event 0x%x got 0x%x\n", e->arg0, evt);
+			st->events_missed++;
+		}
+		break;
+	case EASYNMC_REC_STATE:
+		if (sync && (e->arg0 == EASYNMC_CORE_IDLE) && 
+		    (wait_state(h, e->arg0, o->timeout_ms) != 0)) {
+			dbg("Replay: core did not become %s\n", easynmc_state_name(e->arg0));
+			st->events_missed++;
+		}
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/**
+ * Replay a recorded session against a core.
+ *
+ * Uploads, irqs, stdio attachment, app starts and stdin traffic are sent
+ * to the core. 
+ * With EASYNMC_REPLAY_REALTIME they are issued at the recorded times, 
+ * otherwise as fast as possible. With EASYNMC_REPLAY_SYNC the replayer 
+ * also waits (up to timeout_ms) for each recorded event and for the core 
+ * to become idle where it was idle in the recording, so that interactions 
+ * happen in the same order relative to the app as in the original session.
+ *
+ * App stdout is drained continuously so that the app never blocks on it.
+ *
+ * @param h core to replay against, must not be running
+ * @param path log file
+ * @param o options, NULL for defaults (max speed, no sync, stdout discarded)
+ * @param st if not NULL, filled with replay statistics
+ * @return 0 if OK
+ */
+int easynmc_replay(struct easynmc_handle *h, const char *path, 
+		   struct easynmc_replay_opts *o, struct easynmc_replay_stats *st)
+{
+	struct easynmc_replay_opts defopts = { 0, 1000, -1 };
+	struct easynmc_replay_stats dummy;
+	struct rec_file_header *hdr;
+	struct easynmc_token *tok = NULL;
+	struct stat sb;
+	uint64_t start;
+	size_t pos;
+	char *log;
+	int fd, iofl, ret = -1;
+
+	if (!o)
+		o = &defopts;
+	if (!st)
+		st = &dummy;
+	memset(st, 0x0, sizeof(*st));
+
+	if (easynmc_core_state(h) == EASYNMC_CORE_RUNNING) {
+		err("Replay: core %d is running\n", h->id);
+		return -1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror("open");
+		return -1;
+	}
+	if ((fstat(fd, &sb) != 0) || (sb.st_size < sizeof(*hdr))) {
+		err("Replay: %s is too short\n", path);
+		goto errclose;
+	}
+	log = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (log == MAP_FAILED) {
+		perror("mmap");
+		goto errclose;
+	}
+
+	hdr = (struct rec_file_header *) log;
+	if (strncmp(hdr->magic, REC_MAGIC, sizeof(hdr->magic)) || (hdr->version != REC_VERSION)) {
+		err("Replay: %s is not a session log\n", path);
+		goto errunmap;
+	}
+	dbg("Replaying session recorded on %s (core %d)\n", hdr->core_name, hdr->core_id);
+
+	if (o->flags & EASYNMC_REPLAY_SYNC) {
+		tok = easynmc_token_new(h, EASYNMC_EVT_ALL);
+		if (!tok)
+			goto errunmap;
+	}
+
+	/* The io descriptor is shared with other handles, put the flags back after */
+	iofl = fcntl(h->iofd, F_GETFL, 0);
+	fcntl(h->iofd, F_SETFL, iofl | O_NONBLOCK);
+	easynmc_pollmark(h);
+
+	start = mono_ns();
+	pos = sizeof(*hdr);
+	while (pos + sizeof(struct rec_entry) <= sb.st_size) {
+		struct rec_entry e;
+		memcpy(&e, &log[pos], sizeof(e));
+		pos += sizeof(e);
+		if (pos + e.len > sb.st_size) {
+			err("Replay: truncated record at offset %zu\n", pos);
+			goto errtok;
+		}
+
+		if (o->flags & EASYNMC_REPLAY_REALTIME)
+			sleep_until(start + e.ts_ns);
+
+		drain_stdout(h, o, st);
+		if (replay_one(h, &e, &log[pos], tok, o, st) != 0) {
+			err("Replay: failed at record %llu (type %d)\n", 
+			    (unsigned long long) st->records, e.type);
+			goto errtok;
+		}
+		pos += e.len;
+		st->records++;
+	}
+	drain_stdout(h, o, st);
+	st->duration_ns = mono_ns() - start;
+	ret = 0;
+
+errtok:
+	fcntl(h->iofd, F_SETFL, iofl);
+	free(tok);
+errunmap:
+	munmap(log, sb.st_size);
+errclose:
+	close(fd);
+	return ret;
+}
+
+/**
+ * @}
+ */
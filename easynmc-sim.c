@@ -0,0 +1,768 @@
+/*
+ * libEasyNMC DSP communication library.
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc-sim: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc-sim: " fmt, ##__VA_ARGS__); \
+	}
+
+#define SIM_DEFAULT_CORES     1
+#define SIM_DEFAULT_IMEM      (256 * 1024)
+#define SIM_MAX_CORES         16
+#define SIM_EVENTS            256   /* Core to host events kept for tokens */
+#define SIM_IDLE_POLL_US      100   /* How often the idle loop looks at CORE_START */
+#define SIM_PUMP_POLL_MS      1     /* How often stdio rings are serviced */
+/* 
+ * Everything the in-tree IPL source implements, plus run timing that it 
+ * doesn't claim yet. By default the sim reports the legacy IPL that 
+ * prebuilt-ipl/ still ships, EASYNMC_SIM_IPL_CAPS picks a subset of these 
+ * instead.
+ */
+#define SIM_IPL_CAPS          (EASYNMC_IPL_CAP_EXTREGS | EASYNMC_IPL_CAP_CALL | \
+			       EASYNMC_IPL_CAP_IRQSTART | EASYNMC_IPL_CAP_DONEIRQ | \
+			       EASYNMC_IPL_CAP_CRC | EASYNMC_IPL_CAP_MEMOPS | \
+			       EASYNMC_IPL_CAP_TIMING)
+
+/* Ring header layout, see struct nmc_stdio_channel */
+#define RING_ISR_ON_IO  0
+#define RING_SIZE       1
+#define RING_HEAD       2
+#define RING_TAIL       3
+#define RING_DATA       4
+
+struct easynmc_sim_core {
+	int              id;
+	uint32_t        *imem32;
+	uint32_t         imem_size;
+	uint32_t         ipl_version; /* What sim_ipl_enter() reports */
+	uint32_t         ipl_caps;
+	int              app_io;      /* Handed out as iofd */
+	int              sim_io;      /* Our end of the stdio socket */
+	int              evfd;        /* Handed out as memfd */
+
+	pthread_mutex_t  lock;
+	pthread_cond_t   cond;
+	struct nmc_core_stats stats;
+	uint32_t         seq;                 /* Number of events raised so far */
+	uint32_t         events[SIM_EVENTS];  /* Last events, indexed by seq */
+	uint32_t         cancel_id;
+	uint32_t         cancel_gen;
+	int              nmi;         /* NMI pending for the idle loop */
+	volatile int     stopping;    /* Running app was asked to stop */
+	uint32_t         stdin_addr;  /* Byte addresses of attached rings, 0 - none */
+	uint32_t         stdout_addr;
+	uint32_t         run_since;   /* Run timing, nanoseconds serve as ticks */
+	uint32_t         idle_since;
+	uint32_t         busy_frac;
+	uint32_t         idle_frac;
+
+	const struct easynmc_sim_app *app;
+	void            *app_arg;
+	pthread_t        ctl;
+	pthread_t        pump;
+};
+
+static pthread_mutex_t g_sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct easynmc_sim_core *g_sim_cores[SIM_MAX_CORES];
+
+static int sim_env_int(const char *name, int def)
+{
+	char *v = getenv(name);
+	if (!v || !*v)
+		return def;
+	return strtol(v, NULL, 0);
+}
+
+static int sim_num_cores(void)
+{
+	int n = sim_env_int("EASYNMC_SIM_CORES", SIM_DEFAULT_CORES);
+	if (n < 0)
+		n = 0;
+	if (n > SIM_MAX_CORES)
+		n = SIM_MAX_CORES;
+	return n;
+}
+
+/* Core to host interrupt. Call with c->lock held */
+static void sim_raise(struct easynmc_sim_core *c, enum nmc_irq irq)
+{
+	uint64_t one = 1;
+	c->seq++;
+	c->events[c->seq % SIM_EVENTS] = (1 << irq);
+	c->stats.irqs_recv[irq]++;
+	pthread_cond_broadcast(&c->cond);
+	if (write(c->evfd, &one, sizeof(one)) != sizeof(one)) {
+		err("core %d: failed to signal event\n", c->id);
+	}
+}
+
+/* Completion interrupts, see easynmc_set_done_irq(). Call with c->lock held */
+static void sim_raise_done(struct easynmc_sim_core *c)
+{
+	if (c->imem32[NMC_REG_ISR_ON_START] & EASYNMC_DONE_IRQ_HP)
+		sim_raise(c, NMC_IRQ_HP);
+	if (c->imem32[NMC_REG_ISR_ON_START] & EASYNMC_DONE_IRQ_LP)
+		sim_raise(c, NMC_IRQ_LP);
+}
+
+static uint32_t sim_ticks(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Same as the IPL keeps NMC_REG_RUN_BUSY and NMC_REG_RUN_IDLE */
+static void sim_add_time(uint32_t *reg, uint32_t *frac, uint32_t ticks)
+{
+	uint64_t t = (uint64_t) *frac + ticks;
+	*reg  += t >> EASYNMC_RUN_TIME_SHIFT;
+	*frac  = t & ((1 << EASYNMC_RUN_TIME_SHIFT) - 1);
+}
+
+/* What the IPL does after reset or NMI. Call with c->lock held */
+static void sim_ipl_enter(struct easynmc_sim_core *c)
+{
+	c->nmi = 0;
+	c->stats.started = 1;
+	c->imem32[NMC_REG_CODEVERSION] = c->ipl_version;
+	c->imem32[NMC_REG_IPL_CAPS]    = c->ipl_caps;
+	c->imem32[NMC_REG_CORE_START]  = 0;
+	c->imem32[NMC_REG_CORE_STATUS] = EASYNMC_CORE_IDLE;
+	c->idle_since = sim_ticks();
+	sim_raise_done(c);
+}
+
+/* NMC_CMD_CRC, see easynmc_crc(). Call with c->lock held */
+static void sim_crc(struct easynmc_sim_core *c)
+{
+	uint32_t *args = &c->imem32[NMC_REG_CMD_ARGS];
+	uint32_t i, addr, len;
+
+	for (i = 0; (i < args[0]) && (i < (NMC_REG_CMD_ARGS_LEN - 1) / 2); i++) {
+		addr = args[1 + 2 * i];
+		len  = args[2 + 2 * i];
+		if (((uint64_t) addr + len) * 4 > c->imem_size)
+			len = 0;
+		args[2 + 2 * i] = easynmc_crc32(0, &c->imem32[addr], len * 4);
+	}
+}
+
+/* NMC_CMD_MEMOPS, see easynmc_memops(). Call with c->lock held */
+static void sim_memops(struct easynmc_sim_core *c)
+{
+	uint32_t *args = &c->imem32[NMC_REG_CMD_ARGS];
+	uint32_t words = c->imem_size / 4;
+	uint32_t i, j, *op;
+
+	for (i = 0; (i < args[0]) && (i < (NMC_REG_CMD_ARGS_LEN - 1) / 4); i++) {
+		op = &args[1 + 4 * i];
+		/* There's nothing but internal memory here */
+		if (((uint64_t) op[1] + op[3] > words) || 
+		    ((op[0] == EASYNMC_MEMOP_COPY) && ((uint64_t) op[2] + op[3] > words)))
+			continue;
+		for (j = 0; j < op[3]; j++) {
+			if (op[0] == EASYNMC_MEMOP_FILL)
+				c->imem32[op[1] + j] = op[2];
+			else if (op[0] == EASYNMC_MEMOP_COPY)
+				c->imem32[op[1] + j] = c->imem32[op[2] + j];
+		}
+	}
+}
+
+static void sim_deadline(struct timespec *ts, int us)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_nsec += (long) us * 1000;
+	ts->tv_sec  += ts->tv_nsec / 1000000000;
+	ts->tv_nsec %= 1000000000;
+}
+
+/* The IPL idle loop */
+static void *sim_control(void *arg)
+{
+	struct easynmc_sim_core *c = arg;
+	struct timespec ts;
+
+	pthread_mutex_lock(&c->lock);
+	while (1) {
+		if (c->nmi) {
+			sim_ipl_enter(c);
+			continue;
+		}
+
+		if (!c->stats.started ||
+		    (c->imem32[NMC_REG_CORE_STATUS] != EASYNMC_CORE_IDLE) ||
+		    !c->imem32[NMC_REG_CORE_START]) {
+			sim_deadline(&ts, SIM_IDLE_POLL_US);
+			pthread_cond_timedwait(&c->cond, &c->lock, &ts);
+			continue;
+		}
+
+		uint32_t cmd   = c->imem32[NMC_REG_CORE_START];
+		uint32_t entry = c->imem32[NMC_REG_PROG_ENTRY];
+		uint32_t fn    = c->imem32[NMC_REG_CALL_FN];
+		uint32_t table = c->imem32[NMC_REG_CALL_TABLE];
+		const struct easynmc_sim_app *app = c->app;
+		void *app_arg = c->app_arg;
+		int code = 0;
+
+		/* Same as the IPL: unknown commands are left alone */
+		if ((cmd != NMC_CMD_CALL) && (cmd != NMC_CMD_CRC) && (cmd != NMC_CMD_MEMOPS) && 
+		    !(cmd & NMC_CMD_RUN)) {
+			sim_deadline(&ts, SIM_IDLE_POLL_US);
+			pthread_cond_timedwait(&c->cond, &c->lock, &ts);
+			continue;
+		}
+
+		/* Done before the ack, the host reads the results right after it */
+		if ((cmd == NMC_CMD_CRC) || (cmd == NMC_CMD_MEMOPS)) {
+			if (cmd == NMC_CMD_CRC)
+				sim_crc(c);
+			else
+				sim_memops(c);
+			__sync_synchronize();
+			c->imem32[NMC_REG_CORE_START] = 0;
+			sim_raise_done(c);
+			continue;
+		}
+
+		if (cmd == NMC_CMD_CALL)
+			entry = ((uint64_t) table + fn < c->imem_size / 4) ? c->imem32[table + fn] : 0;
+
+		c->imem32[NMC_REG_CORE_START]  = 0;
+		c->imem32[NMC_REG_CORE_STATUS] = EASYNMC_CORE_RUNNING;
+		c->stopping = 0;
+
+		c->run_since = sim_ticks();
+		sim_add_time(&c->imem32[NMC_REG_RUN_IDLE], &c->idle_frac, c->run_since - c->idle_since);
+		pthread_mutex_unlock(&c->lock);
+
+		if (cmd == NMC_CMD_CALL) {
+			dbg("core %d: calling function %u @0x%x\n", c->id, fn, entry);
+			if (app && app->call)
+				code = app->call(c, fn, entry, c->imem32[NMC_REG_CALL_ARGS], app_arg);
+		} else {
+			dbg("core %d: starting app @0x%x\n", c->id, entry);
+			if (app && app->run)
+				code = app->run(c, entry, app_arg);
+		}
+
+		pthread_mutex_lock(&c->lock);
+		dbg("core %d: app returned %d\n", c->id, code);
+
+		/* Stopped runs count too */
+		c->idle_since = sim_ticks();
+		c->imem32[NMC_REG_RUN_LAST] = c->idle_since - c->run_since;
+		c->imem32[NMC_REG_RUN_COUNT]++;
+		sim_add_time(&c->imem32[NMC_REG_RUN_BUSY], &c->busy_frac, c->idle_since - c->run_since);
+		/* An NMI restarts the IPL and the app never returns there */
+		if (!c->nmi) {
+			c->imem32[NMC_REG_PROG_RETURN] = code;
+			c->imem32[NMC_REG_CORE_STATUS] = EASYNMC_CORE_IDLE;
+			sim_raise_done(c);
+		}
+	}
+	return NULL;
+}
+
+static uint32_t *sim_ring(struct easynmc_sim_core *c, uint32_t addr)
+{
+	if (!addr || (addr + RING_DATA * 4 > c->imem_size))
+		return NULL;
+	uint32_t *ring = &c->imem32[addr >> 2];
+	uint32_t size = ring[RING_SIZE];
+	/* The app may not have been uploaded yet or has a broken ring */
+	if (!size || (size & (size - 1)) ||
+	    (addr + (RING_DATA + size) * 4 > c->imem_size))
+		return NULL;
+	return ring;
+}
+
+/* Copies up to len chars from a ring to buf, returns the count */
+static int ring_peek(uint32_t *ring, char *buf, int len)
+{
+	uint32_t size = ring[RING_SIZE];
+	uint32_t head = ring[RING_HEAD];
+	uint32_t tail = ring[RING_TAIL];
+	int n = 0;
+
+	while ((n < len) && (head != tail)) {
+		buf[n++] = ring[RING_DATA + tail] & 0xff;
+		tail = (tail + 1) & (size - 1);
+	}
+	return n;
+}
+
+static void ring_consume(uint32_t *ring, int n)
+{
+	ring[RING_TAIL] = (ring[RING_TAIL] + n) & (ring[RING_SIZE] - 1);
+}
+
+/* Moves up to len chars from buf to a ring, returns the count */
+static int ring_put(uint32_t *ring, const char *buf, int len)
+{
+	uint32_t size = ring[RING_SIZE];
+	uint32_t head = ring[RING_HEAD];
+	uint32_t tail = ring[RING_TAIL];
+	int n = 0;
+
+	while ((n < len) && (((head + 1) & (size - 1)) != tail)) {
+		ring[RING_DATA + head] = (unsigned char) buf[n++];
+		head = (head + 1) & (size - 1);
+	}
+	ring[RING_HEAD] = head;
+	return n;
+}
+
+/*
+ * Does what the driver does for stdio: drains the app stdout ring into the
+ * io descriptor and fills the stdin ring from it.
+ */
+static void *sim_pump(void *arg)
+{
+	struct easynmc_sim_core *c = arg;
+	char buf[1024];
+	int pending = 0; /* stdin bytes read but not yet in the ring */
+	int off = 0;
+
+	while (1) {
+		struct pollfd pfd = { .fd = c->sim_io, .events = pending ? 0 : POLLIN };
+		poll(&pfd, 1, SIM_PUMP_POLL_MS);
+
+		uint32_t *out = sim_ring(c, c->stdout_addr);
+		if (out) {
+			char obuf[1024];
+			/* Only free in the ring what the socket took */
+			int n = ring_peek(out, obuf, sizeof(obuf));
+			if (n > 0) {
+				int w = write(c->sim_io, obuf, n);
+				if (w > 0)
+					ring_consume(out, w);
+			}
+		}
+
+		uint32_t *in = sim_ring(c, c->stdin_addr);
+		if (!pending && (pfd.revents & POLLIN)) {
+			int r = read(c->sim_io, buf, sizeof(buf));
+			if (r > 0) {
+				pending = r;
+				off = 0;
+			}
+		}
+		if (in && pending) {
+			int n = ring_put(in, &buf[off], pending);
+			off += n;
+			pending -= n;
+		}
+	}
+	return NULL;
+}
+
+static struct easynmc_sim_core *sim_core_new(int id)
+{
+	struct easynmc_sim_core *c = calloc(1, sizeof(*c));
+	int sv[2];
+
+	if (!c)
+		return NULL;
+
+	c->id = id;
+	c->imem_size = sim_env_int("EASYNMC_SIM_IMEM", SIM_DEFAULT_IMEM) & ~3;
+	if (getenv("EASYNMC_SIM_IPL_CAPS")) {
+		c->ipl_version = EASYNMC_IPL_VERSION;
+		c->ipl_caps    = sim_env_int("EASYNMC_SIM_IPL_CAPS", 0) & SIM_IPL_CAPS;
+	} else {
+		c->ipl_version = EASYNMC_LEGACY_STARTUPCODE;
+	}
+	c->imem32 = mmap(NULL, c->imem_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (c->imem32 == MAP_FAILED)
+		goto errfree;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+		goto errunmap;
+	c->app_io = sv[0];
+	c->sim_io = sv[1];
+	fcntl(c->sim_io, F_SETFL, fcntl(c->sim_io, F_GETFL) | O_NONBLOCK);
+
+	c->evfd = eventfd(0, EFD_NONBLOCK);
+	if (c->evfd < 0)
+		goto errsock;
+
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->cond, NULL);
+
+	if (pthread_create(&c->ctl, NULL, sim_control, c) != 0)
+		goto errev;
+	pthread_detach(c->ctl);
+	if (pthread_create(&c->pump, NULL, sim_pump, c) != 0) {
+		/* The control thread can't be stopped, keep the core around */
+		err("core %d: failed to start stdio pump\n", id);
+		return c;
+	}
+	pthread_detach(c->pump);
+
+	dbg("core %d: %d bytes of imem\n", id, c->imem_size);
+	return c;
+
+errev:
+	close(c->evfd);
+errsock:
+	close(c->app_io);
+	close(c->sim_io);
+errunmap:
+	munmap(c->imem32, c->imem_size);
+errfree:
+	free(c);
+	return NULL;
+}
+
+/* Simulated cores live as long as the process does */
+static struct easynmc_sim_core *sim_core_get(int id)
+{
+	struct easynmc_sim_core *c = NULL;
+	if ((id < 0) || (id >= sim_num_cores()))
+		return NULL;
+	pthread_mutex_lock(&g_sim_lock);
+	if (!g_sim_cores[id])
+		g_sim_cores[id] = sim_core_new(id);
+	c = g_sim_cores[id];
+	pthread_mutex_unlock(&g_sim_lock);
+	return c;
+}
+
+static int sim_wait(struct easynmc_sim_core *c, struct nmc_irq_token *tok)
+{
+	struct timespec ts;
+	uint32_t gen = c->cancel_gen;
+	uint32_t start = tok->id;
+
+	sim_deadline(&ts, tok->timeout * 1000);
+	tok->event = 0;
+	while (1) {
+		if ((c->cancel_gen != gen) && (c->cancel_id == start)) {
+			tok->event = EASYNMC_EVT_CANCELLED;
+			return 0;
+		}
+		/* Events older than the log are lost, just like an overrun */
+		if (c->seq - tok->id > SIM_EVENTS)
+			tok->id = c->seq - SIM_EVENTS;
+		while (tok->id != c->seq) {
+			tok->id++;
+			if (c->events[tok->id % SIM_EVENTS] & tok->events_enabled) {
+				tok->event = c->events[tok->id % SIM_EVENTS];
+				return 0;
+			}
+		}
+		if (pthread_cond_timedwait(&c->cond, &c->lock, &ts) == ETIMEDOUT) {
+			tok->event = EASYNMC_EVT_TIMEOUT;
+			return 0;
+		}
+	}
+}
+
+static int sim_send_irq(struct easynmc_sim_core *c, enum nmc_irq irq)
+{
+	const struct easynmc_sim_app *app = NULL;
+	void *app_arg;
+
+	pthread_mutex_lock(&c->lock);
+	c->stats.irqs_sent[irq]++;
+	if (irq == NMC_IRQ_NMI) {
+		c->nmi = 1;
+		c->stopping = 1;
+	}
+	/* Wakes the idle loop up, the app only sees interrupts while running */
+	pthread_cond_broadcast(&c->cond);
+	if ((irq != NMC_IRQ_NMI) && (c->imem32[NMC_REG_CORE_STATUS] == EASYNMC_CORE_RUNNING)) {
+		app = c->app;
+		app_arg = c->app_arg;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	/* The handler may well talk back to the host, so no locks here */
+	if (app && app->irq)
+		app->irq(c, irq, app_arg);
+	return 0;
+}
+
+static int sim_ioctl(struct easynmc_device *dev, unsigned long req, void *arg)
+{
+	struct easynmc_sim_core *c = dev->priv;
+	uint64_t cnt;
+	int ret = 0;
+
+	switch (req) {
+	case IOCTL_NMC3_GET_NAME:
+		strcpy(arg, "K1879-nmc");
+		return 0;
+	case IOCTL_NMC3_GET_TYPE:
+		strcpy(arg, "sim");
+		return 0;
+	case IOCTL_NMC3_GET_IMEMSZ:
+		*(uint32_t *) arg = c->imem_size;
+		return 0;
+	case IOCTL_NMC3_SEND_IRQ:
+		if (*(uint32_t *) arg >= NMC_NUM_IRQS)
+			break;
+		return sim_send_irq(c, *(uint32_t *) arg);
+	case IOCTL_NMC3_POLLMARK:
+		while (read(c->evfd, &cnt, sizeof(cnt)) == sizeof(cnt));;
+		return 0;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	switch (req) {
+	case IOCTL_NMC3_RESET:
+		/* Cold core, the IPL has to be uploaded and kicked with an NMI */
+		c->stats.started = 0;
+		c->stopping = 1;
+		c->imem32[NMC_REG_CODEVERSION] = 0;
+		c->imem32[NMC_REG_CORE_STATUS] = 0;
+		c->stdin_addr = c->stdout_addr = 0;
+		break;
+	case IOCTL_NMC3_GET_STATS:
+		memcpy(arg, &c->stats, sizeof(c->stats));
+		break;
+	case IOCTL_NMC3_RESET_STATS:
+		memset(c->stats.irqs_sent, 0, sizeof(c->stats.irqs_sent));
+		memset(c->stats.irqs_recv, 0, sizeof(c->stats.irqs_recv));
+		break;
+	case IOCTL_NMC3_RESET_TOKEN:
+		((struct nmc_irq_token *) arg)->id = c->seq;
+		((struct nmc_irq_token *) arg)->event = 0;
+		break;
+	case IOCTL_NMC3_WAIT_ON_TOKEN:
+		ret = sim_wait(c, arg);
+		break;
+	case IOCTL_NMC3_CANCEL_WAIT:
+		c->cancel_id = ((struct nmc_irq_token *) arg)->id;
+		c->cancel_gen++;
+		pthread_cond_broadcast(&c->cond);
+		break;
+	case IOCTL_NMC3_ATTACH_STDIN:
+		c->stdin_addr = *(uint32_t *) arg;
+		break;
+	case IOCTL_NMC3_ATTACH_STDOUT:
+		c->stdout_addr = *(uint32_t *) arg;
+		break;
+	case IOCTL_NMC3_REFORMAT_STDIN:
+	case IOCTL_NMC3_REFORMAT_STDOUT:
+		/* Always one char per word */
+		break;
+	default:
+		errno = ENOTTY;
+		ret = -1;
+	}
+	pthread_mutex_unlock(&c->lock);
+	return ret;
+}
+
+static int sim_probe(int *ids, int max)
+{
+	int i, n = sim_num_cores();
+	if (n > max)
+		n = max;
+	for (i = 0; i < n; i++)
+		ids[i] = i;
+	return n;
+}
+
+static int sim_open(struct easynmc_device *dev, int flags)
+{
+	struct easynmc_sim_core *c = sim_core_get(dev->id);
+	if (!c) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	dev->iofd = dup(c->app_io);
+	dev->memfd = dup(c->evfd);
+	if ((dev->iofd < 0) || (dev->memfd < 0)) {
+		if (dev->iofd >= 0)
+			close(dev->iofd);
+		if (dev->memfd >= 0)
+			close(dev->memfd);
+		return -1;
+	}
+	dev->imem = (char *) c->imem32;
+	dev->imem_size = c->imem_size;
+	dev->priv = c;
+	return 0;
+}
+
+static void sim_close(struct easynmc_device *dev)
+{
+	close(dev->iofd);
+	close(dev->memfd);
+}
+
+/** \defgroup sim_api Simulated cores
+ * The "sim" backend emulates cores inside the calling process, so that
+ * tools, the dispatcher and application host code can be benchmarked
+ * without a board. No NMC code is executed: the IPL protocol (boot,
+ * start, stop, exit code), interrupts, tokens and stdio rings are
+ * emulated, while what the "application" does is up to a host callback
+ * set with easynmc_sim_set_app(). Without one, started apps return 0.
+ *
+ * Unlike the driver, the memfd of a simulated core reports every core
+ * interrupt as POLLIN/EPOLLIN. Use tokens to tell the LP and HP apart.
+ *
+ * \addtogroup sim_api
+ * @{
+ */
+
+const struct easynmc_backend easynmc_sim_backend = {
+	.name  = "sim",
+	.probe = sim_probe,
+	.open  = sim_open,
+	.close = sim_close,
+	.ioctl = sim_ioctl,
+};
+
+/**
+ * Set the host code that plays the application on a simulated core.
+ * app->run() is called from the core's own thread each time an app is
+ * started and should return promptly once easynmc_sim_stopping() is true.
+ *
+ * @param coreid
+ * @param app
+ * @param arg passed to the app callbacks
+ * @return 0 if OK, -1 if there is no such core
+ */
+int easynmc_sim_set_app(int coreid, const struct easynmc_sim_app *app, void *arg)
+{
+	struct easynmc_sim_core *c = sim_core_get(coreid);
+	if (!c)
+		return -1;
+	pthread_mutex_lock(&c->lock);
+	c->app = app;
+	c->app_arg = arg;
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+/**
+ * Get the internal memory of a simulated core, as the app sees it.
+ *
+ * @param c
+ * @return
+ */
+uint32_t *easynmc_sim_imem(struct easynmc_sim_core *c)
+{
+	return c->imem32;
+}
+
+/**
+ * Send an interrupt from the simulated core to the host.
+ *
+ * @param c
+ * @param irq NMC_IRQ_LP or NMC_IRQ_HP
+ * @return 0 if OK, -1 otherwise
+ */
+int easynmc_sim_irq(struct easynmc_sim_core *c, enum nmc_irq irq)
+{
+	if ((irq != NMC_IRQ_LP) && (irq != NMC_IRQ_HP))
+		return -1;
+	pthread_mutex_lock(&c->lock);
+	sim_raise(c, irq);
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+/**
+ * Write to the app stdout. Blocks while the ring is full, unless the
+ * app is being stopped.
+ *
+ * @param c
+ * @param buf
+ * @param len
+ * @return number of chars written, -1 if no stdout is attached
+ */
+int easynmc_sim_write(struct easynmc_sim_core *c, const char *buf, int len)
+{
+	uint32_t *ring = sim_ring(c, c->stdout_addr);
+	int n = 0;
+	if (!ring)
+		return -1;
+	while (n < len) {
+		n += ring_put(ring, &buf[n], len - n);
+		if ((n == len) || c->stopping)
+			break;
+		usleep(SIM_IDLE_POLL_US);
+	}
+	if (ring[RING_ISR_ON_IO])
+		easynmc_sim_irq(c, NMC_IRQ_LP);
+	return n;
+}
+
+/**
+ * Read from the app stdin without blocking.
+ *
+ * @param c
+ * @param buf
+ * @param len
+ * @return number of chars read, -1 if no stdin is attached
+ */
+int easynmc_sim_read(struct easynmc_sim_core *c, char *buf, int len)
+{
+	uint32_t *ring = sim_ring(c, c->stdin_addr);
+	if (!ring)
+		return -1;
+	int n = ring_peek(ring, buf, len);
+	ring_consume(ring, n);
+	return n;
+}
+
+/**
+ * Check if the host has asked the running app to stop (NMI or reset).
+ *
+ * @param c
+ * @return
+ */
+int easynmc_sim_stopping(struct easynmc_sim_core *c)
+{
+	return c->stopping;
+}
+
+/**
+ * @}
+ */
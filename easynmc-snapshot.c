@@ -0,0 +1,328 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stddef.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup snapshot_api Memory snapshots
+ * Snapshots capture the application part of NMC internal memory (everything
+ * above the IPL area) together with the IPL register block. This allows to
+ * skip a long application initialization after a reboot or a hang: boot the
+ * core, restore the snapshot, start the app.
+ *
+ * The file consists of a header followed by a list of ranges. Only non-zero
+ * runs of memory are stored, short zero gaps are merged into the surrounding
+ * ranges to keep the list compact. All values are in host byte order.
+ *
+ * \addtogroup snapshot_api
+ * @{
+ */
+
+#define SNAPSHOT_MAGIC    "NMCSNAP"
+#define SNAPSHOT_VERSION  2
+
+/* Zero gaps shorter than that (in words) are stored as is */
+#define SNAPSHOT_MIN_GAP  16
+
+struct snapshot_header {
+	char      magic[8];
+	uint32_t  version;
+	uint32_t  imem_size;   /* bytes */
+	uint32_t  num_ranges;
+	uint32_t  regs[NMC_REG_AREA_LEN];
+	char      core_name[64];
+	/* Version 2 and up */
+	uint32_t  stdio[2];    /* stdin and stdout rings, words, 0 - none */
+};
+
+/* Version 1 files end their header before stdio */
+#define SNAPSHOT_V1_HEADER_LEN  offsetof(struct snapshot_header, stdio)
+
+struct snapshot_range {
+	uint32_t  addr; /* words */
+	uint32_t  len;  /* words, data follows */
+};
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (n <= 0)
+			return -1;
+		p   += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Save application memory and IPL registers of a core to a file.
+ *
+ * The app should not be running (unless EASYNMC_SNAPSHOT_FLAG_FORCE is given),
+ * otherwise the snapshot will not be consistent.
+ *
+ * @param h
+ * @param path
+ * @param flags EASYNMC_SNAPSHOT_FLAG_*
+ * @return 0 if everything is OK, non-zero otherwise
+ */
+int easynmc_snapshot_save(struct easynmc_handle *h, const char *path, int flags)
+{
+	struct snapshot_header hdr;
+	uint32_t *copy;
+	uint32_t nwords = h->imem_size / 4;
+	uint32_t pos;
+	int fd, ret = -1;
+	enum easynmc_core_state state = easynmc_core_state(h);
+
+	if ((state != EASYNMC_CORE_IDLE) && !(flags & EASYNMC_SNAPSHOT_FLAG_FORCE)) {
+		err("Core is %s, must be idle to take a snapshot\n", easynmc_state_name(state));
+		return 1;
+	}
+
+	/* One big read over the bus, then scan in host memory */
+	copy = malloc(h->imem_size);
+	if (!copy)
+		return -1;
+	memcpy(copy, h->imem, h->imem_size);
+	/* The IPL's own area at the top of IM0 is not part of the app */
+	if (nwords >= NMC_IPL_EXT_ADDR + NMC_IPL_EXT_LEN)
+		memset(&copy[NMC_IPL_EXT_ADDR], 0x0, NMC_IPL_EXT_LEN * 4);
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	hdr.version   = SNAPSHOT_VERSION;
+	hdr.imem_size = h->imem_size;
+	memcpy(hdr.regs, &copy[NMC_REG_CODEVERSION], sizeof(hdr.regs));
+	easynmc_get_core_name(h, hdr.core_name);
+	hdr.stdio[0] = easynmc_stdio_offset(h, 0);
+	hdr.stdio[1] = easynmc_stdio_offset(h, 1);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror("open");
+		goto errfree;
+	}
+
+	/* Header goes first, with the range count fixed up in the end */
+	if (write_all(fd, &hdr, sizeof(hdr)))
+		goto errwrite;
+
+	pos = NMC_IPL_AREA_LEN;
+	while (pos < nwords) {
+		struct snapshot_range r;
+		uint32_t end, gap;
+
+		while ((pos < nwords) && !copy[pos])
+			pos++;
+		if (pos == nwords)
+			break;
+
+		/* Extend the range until a long enough zero gap */
+		end = pos;
+		gap = 0;
+		while ((end < nwords) && (gap < SNAPSHOT_MIN_GAP)) {
+			gap = copy[end] ? 0 : gap + 1;
+			end++;
+		}
+		end -= gap;
+
+		r.addr = pos;
+		r.len  = end - pos;
+		if (write_all(fd, &r, sizeof(r)) || 
+		    write_all(fd, &copy[pos], r.len * 4))
+			goto errwrite;
+
+		hdr.num_ranges++;
+		pos = end;
+	}
+
+	if ((lseek(fd, 0, SEEK_SET) != 0) || write_all(fd, &hdr, sizeof(hdr)))
+		goto errwrite;
+
+	dbg("Snapshot of core %d: %u ranges saved to %s\n", h->id, hdr.num_ranges, path);
+	ret = 0;
+	goto errclose;
+
+errwrite:
+	perror("write");
+errclose:
+	close(fd);
+errfree:
+	free(copy);
+	return ret;
+}
+
+/* Zero words from..to, leaving the IPL's area at the top of IM0 alone */
+static int clear_gap(struct easynmc_handle *h, uint32_t from, uint32_t to)
+{
+	if ((from < NMC_IPL_EXT_ADDR + NMC_IPL_EXT_LEN) && (to > NMC_IPL_EXT_ADDR)) {
+		if ((from < NMC_IPL_EXT_ADDR) && 
+		    (0 != easynmc_write(h, from * 4, NULL, (NMC_IPL_EXT_ADDR - from) * 4)))
+			return -1;
+		from = NMC_IPL_EXT_ADDR + NMC_IPL_EXT_LEN;
+	}
+	if (to > from)
+		return easynmc_write(h, from * 4, NULL, (to - from) * 4);
+	return 0;
+}
+
+/**
+ * Restore a snapshot previously saved with easynmc_snapshot_save().
+ * The core must be booted and idle. Zero runs are not stored, so memory
+ * between the saved ranges is zeroed, unless EASYNMC_SNAPSHOT_FLAG_SPARSE
+ * is given and the caller knows it is zero already (e.g. a freshly booted
+ * core on a board that clears memory). The driver's stdio is attached to 
+ * the app's rings again, if the snapshot knows where they are.
+ *
+ * After restoring, the app can be started via the entry point saved in
+ * the snapshot (See easynmc_get_app_entry())
+ *
+ * @param h
+ * @param path
+ * @param flags EASYNMC_SNAPSHOT_FLAG_*
+ * @return 0 if everything is OK, non-zero otherwise
+ */
+int easynmc_snapshot_restore(struct easynmc_handle *h, const char *path, int flags)
+{
+	struct stat st;
+	struct snapshot_header *hdr;
+	char *map, *p, *end;
+	uint32_t pos = NMC_IPL_AREA_LEN;
+	uint32_t nwords = h->imem_size / 4;
+	size_t hdrlen;
+	uint32_t i;
+	int fd, ret = -1;
+	enum easynmc_core_state state = easynmc_core_state(h);
+
+	if ((state != EASYNMC_CORE_IDLE) && !(flags & EASYNMC_SNAPSHOT_FLAG_FORCE)) {
+		err("Core is %s, must be idle to restore a snapshot\n", easynmc_state_name(state));
+		return 1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror("open");
+		return -1;
+	}
+
+	if ((fstat(fd, &st) != 0) || (st.st_size < SNAPSHOT_V1_HEADER_LEN)) {
+		err("%s is not a snapshot\n", path);
+		goto errclose;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		goto errclose;
+	}
+
+	hdr = (struct snapshot_header *) map;
+	hdrlen = (hdr->version == 1) ? SNAPSHOT_V1_HEADER_LEN : sizeof(*hdr);
+	if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) ||
+	    (hdr->version < 1) || (hdr->version > SNAPSHOT_VERSION) || 
+	    (st.st_size < hdrlen)) {
+		err("%s is not a snapshot or has unsupported version\n", path);
+		goto errunmap;
+	}
+
+	if (hdr->imem_size != h->imem_size) {
+		err("Snapshot is for %u bytes of imem, core has %u\n", 
+		    hdr->imem_size, h->imem_size);
+		goto errunmap;
+	}
+
+	p   = map + hdrlen;
+	end = map + st.st_size;
+	for (i=0; i<hdr->num_ranges; i++) {
+		struct snapshot_range *r = (struct snapshot_range *) p;
+
+		if ((end - p < sizeof(*r)) || 
+		    ((uint64_t) (end - p) - sizeof(*r) < (uint64_t) r->len * 4) ||
+		    (r->addr < pos) || ((uint64_t) r->addr + r->len > nwords) ||
+		    easynmc_ipl_owns(r->addr, r->len)) {
+			err("Snapshot %s is corrupt\n", path);
+			goto errunmap;
+		}
+
+		if (!(flags & EASYNMC_SNAPSHOT_FLAG_SPARSE) && (0 != clear_gap(h, pos, r->addr)))
+			goto errunmap;
+		if (0 != easynmc_write(h, r->addr * 4, p + sizeof(*r), r->len * 4))
+			goto errunmap;
+
+		pos = r->addr + r->len;
+		p  += sizeof(*r) + r->len * 4;
+	}
+
+	if (!(flags & EASYNMC_SNAPSHOT_FLAG_SPARSE) && (0 != clear_gap(h, pos, nwords)))
+		goto errunmap;
+
+	/* Only the registers that describe the app, the rest belongs to the IPL */
+	h->imem32[NMC_REG_PROG_RETURN] = hdr->regs[NMC_REG_PROG_RETURN - NMC_REG_CODEVERSION];
+	if (easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_EXTREGS)
+		h->imem32[NMC_REG_APP_ENTRY] = hdr->regs[NMC_REG_APP_ENTRY - NMC_REG_CODEVERSION];
+
+	/* Rings of whatever ran before are gone */
+	easynmc_stdio_forget(h);
+	if (hdr->version >= 2) {
+		for (i=0; i<2; i++) {
+			if (!hdr->stdio[i])
+				continue;
+			if ((hdr->stdio[i] >= nwords) || easynmc_ipl_owns(hdr->stdio[i], 1)) {
+				err("Snapshot %s is corrupt\n", path);
+				goto errunmap;
+			}
+			if (0 != easynmc_stdio_attach(h, i, hdr->stdio[i]))
+				goto errunmap;
+		}
+	}
+
+	dbg("Snapshot %s (%u ranges) restored to core %d\n", path, hdr->num_ranges, h->id);
+	ret = 0;
+
+errunmap:
+	munmap(map, st.st_size);
+errclose:
+	close(fd);
+	return ret;
+}
+
+/**
+ * @}
+ */
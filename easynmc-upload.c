@@ -0,0 +1,235 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <easynmc.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup upload_api Writing to core memory
+ * Core memory is mapped uncached, so the width of every store matters: 
+ * libc memcpy()/memset() may pick byte or word stores depending on the
+ * alignment of the arguments. All library writes to core memory go through
+ * easynmc_writev(), which issues 64-bit (or NEON 128-bit) stores to 
+ * aligned destinations. Sources that are not suitably aligned, and runs of 
+ * adjacent small ranges, are gathered in an aligned staging buffer first, 
+ * so that each contiguous piece of core memory is written with one burst.
+ *
+ * \addtogroup upload_api
+ * @{
+ */
+
+#define STAGING_SIZE  (64 * 1024)
+#define BURST_ALIGN   16
+
+/* dst is 8-byte aligned, len is a multiple of 8 */
+static void burst_copy(volatile void *dst, const void *src, size_t len)
+{
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint8_t *d = (uint8_t *) dst;
+	const uint8_t *s = src;
+	while (len >= 16) {
+		vst1q_u8(d, vld1q_u8(s));
+		d += 16;
+		s += 16;
+		len -= 16;
+	}
+	dst = d;
+	src = s;
+#endif
+	volatile uint64_t *d64 = dst;
+	const uint64_t *s64 = src;
+	size_t i;
+	for (i=0; i<len / 8; i++)
+		d64[i] = s64[i];
+}
+
+static void burst_zero(volatile void *dst, size_t len)
+{
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint8_t *d = (uint8_t *) dst;
+	uint8x16_t z = vdupq_n_u8(0);
+	while (len >= 16) {
+		vst1q_u8(d, z);
+		d += 16;
+		len -= 16;
+	}
+	dst = d;
+#endif
+	volatile uint64_t *d64 = dst;
+	size_t i;
+	for (i=0; i<len / 8; i++)
+		d64[i] = 0;
+}
+
+/* Small pieces: 32-bit stores where aligned (the core memory is word-addressed), bytes otherwise */
+static volatile char *write_small(volatile char *dst, const char **s, size_t len)
+{
+	while (len) {
+		if (!((uintptr_t) dst & 3) && (len >= 4)) {
+			uint32_t v = 0;
+			if (*s) {
+				memcpy(&v, *s, 4);
+				*s += 4;
+			}
+			*(volatile uint32_t *) dst = v;
+			dst += 4; 
+			len -= 4;
+		} else {
+			*dst++ = *s ? *(*s)++ : 0;
+			len--;
+		}
+	}
+	return dst;
+}
+
+/* Write len bytes from src (NULL - zeroes) at byte offset addr */
+static void write_range(struct easynmc_handle *h, uint32_t addr, const char *src, size_t len)
+{
+	volatile char *dst = &h->imem[addr];
+	size_t head = (8 - ((uintptr_t) dst & 7)) & 7;
+	size_t body;
+
+	if (head > len)
+		head = len;
+	dst  = write_small(dst, &src, head);
+	len -= head;
+
+	body = len & ~7;
+	if (body) {
+		if (src) {
+			burst_copy(dst, src, body);
+			src += body;
+		} else {
+			burst_zero(dst, body);
+		}
+		dst += body;
+	}
+
+	write_small(dst, &src, len - body);
+}
+
+/**
+ * Write several ranges of core memory. 
+ * Ranges with data == NULL are zero-filled. Adjacent ranges (each starting 
+ * where the previous one ends) are merged into one burst. Nothing is written 
+ * if any range does not fit into core memory.
+ *
+ * @param h
+ * @param iov array of ranges
+ * @param n number of ranges
+ * @return 0 if OK, -1 if a range is out of bounds or out of memory
+ */
+int easynmc_writev(struct easynmc_handle *h, const struct easynmc_iovec *iov, int n)
+{
+	char *stage = NULL;
+	int i, j, k;
+
+	for (i=0; i<n; i++) {
+		if (((uint64_t) iov[i].addr + iov[i].len) > h->imem_size) {
+			err("Write out of bounds: 0x%x + %zu\n", iov[i].addr, iov[i].len);
+			return -1;
+		}
+	}
+
+	for (i=0; i<n; i = j) {
+		uint32_t addr  = iov[i].addr;
+		size_t   total = iov[i].len;
+		size_t   skew  = addr & 7;
+		size_t   pos;
+
+		for (j = i + 1; j < n; j++) {
+			if ((iov[j].addr != iov[j-1].addr + iov[j-1].len) || 
+			    (!iov[j].data != !iov[i].data) || 
+			    (total + iov[j].len > STAGING_SIZE))
+				break;
+			total += iov[j].len;
+		}
+
+		for (k = i; k < j; k++) 
+			easynmc_record(h, iov[k].data ? EASYNMC_REC_UPLOAD : EASYNMC_REC_FILL, 
+				       iov[k].addr, iov[k].len, iov[k].data, iov[k].len);
+
+		/* Zero fills and single sources with matching alignment go straight to the core */
+		if (!iov[i].data || 
+		    ((j == i + 1) && (((uintptr_t) iov[i].data & 7) == skew))) {
+			write_range(h, addr, iov[i].data, total);
+			continue;
+		}
+
+		/* Otherwise copy to the staging buffer, keeping the destination alignment */
+		if (!stage && posix_memalign((void **) &stage, BURST_ALIGN, STAGING_SIZE + 8)) 
+			return -1;
+
+		if (j == i + 1) { 
+			const char *s = iov[i].data;
+			for (pos = 0; pos < total; pos += STAGING_SIZE) {
+				size_t chunk = total - pos;
+				if (chunk > STAGING_SIZE)
+					chunk = STAGING_SIZE;
+				memcpy(&stage[skew], &s[pos], chunk);
+				write_range(h, addr + pos, &stage[skew], chunk);
+			}
+			continue;
+		}
+
+		pos = skew;
+		for (k = i; k < j; k++) {
+			memcpy(&stage[pos], iov[k].data, iov[k].len);
+			pos += iov[k].len;
+		}
+		write_range(h, addr, &stage[skew], total);
+	}
+
+	free(stage);
+	return 0;
+}
+
+/**
+ * Write a single range of core memory, see easynmc_writev()
+ *
+ * @param h
+ * @param addr byte offset
+ * @param data source, NULL to zero-fill
+ * @param len length in bytes
+ * @return
+ */
+int easynmc_write(struct easynmc_handle *h, uint32_t addr, const void *data, size_t len)
+{
+	struct easynmc_iovec iov = { addr, data, len };
+	return easynmc_writev(h, &iov, 1);
+}
+
+/**
+ * @}
+ */
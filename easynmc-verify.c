@@ -0,0 +1,261 @@
+/*
+ * libEasyNMC DSP communication library.
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <easynmc.h>
+
+
+#define dbg(fmt, ...) if (g_libeasynmc_debug) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+#define err(fmt, ...) if (g_libeasynmc_errors) { \
+	fprintf(stderr, "libeasynmc: " fmt, ##__VA_ARGS__); \
+	}
+
+/** \defgroup verify_api Upload verification
+ * With ABSLOAD_FLAG_VERIFY easynmc_load_abs() makes sure every uploaded
+ * and zeroed section has landed intact. The loader takes a CRC32 of each
+ * section while parsing, then the IPL takes the same CRC32 of core memory
+ * (NMC_CMD_CRC), so only the checksums are read back over the bus.
+ *
+ * IPLs without EASYNMC_IPL_CAP_CRC, and cores that are not idle, get the
+ * memory read back and checked on the host instead.
+ *
+ * \addtogroup verify_api
+ * @{
+ */
+
+#define CRC_TIMEOUT_MS  1000
+#define CRC_BATCH       ((NMC_REG_CMD_ARGS_LEN - 1) / 2)
+
+struct easynmc_verify {
+	struct easynmc_crc_range *ranges;  /* Expected CRCs */
+	int num;
+	int max;
+};
+
+/**
+ * Update a CRC32, the same one zlib and the IPL compute. Start with 0.
+ *
+ * @param crc
+ * @param data NULL for zeroes
+ * @param len bytes
+ * @return
+ */
+uint32_t easynmc_crc32(uint32_t crc, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	int i;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= p ? *p++ : 0;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+	}
+	return ~crc;
+}
+
+static int crc_on_core(struct easynmc_handle *h, struct easynmc_crc_range *r, int n)
+{
+	uint32_t *args = &h->imem32[NMC_REG_CMD_ARGS];
+	int i, j, num, ret;
+
+	for (i = 0; i < n; i += num) {
+		num = ((n - i) > CRC_BATCH) ? CRC_BATCH : (n - i);
+		for (j = 0; j < num; j++) {
+			args[1 + 2 * j] = r[i + j].addr;
+			args[2 + 2 * j] = r[i + j].len;
+		}
+		args[0] = num;
+
+		ret = easynmc_ipl_run(h, NMC_CMD_CRC, CRC_TIMEOUT_MS);
+		if (ret != 0)
+			return ret;
+
+		for (j = 0; j < num; j++)
+			r[i + j].crc = args[2 + 2 * j];
+	}
+	return 0;
+}
+
+/**
+ * Get CRC32s of core memory ranges, computed by the IPL if it can.
+ *
+ * @param h
+ * @param r ranges, crc is filled in
+ * @param n number of ranges
+ * @return 0 if OK, -1 on error, -2 if the IPL didn't complete in time
+ */
+int easynmc_crc(struct easynmc_handle *h, struct easynmc_crc_range *r, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (((uint64_t) r[i].addr + r[i].len) * 4 > h->imem_size) {
+			err("CRC range %u words @0x%x is out of core memory\n", r[i].len, r[i].addr);
+			return -1;
+		}
+	}
+
+	if ((easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_CRC) &&
+	    (easynmc_core_state(h) == EASYNMC_CORE_IDLE))
+		return crc_on_core(h, r, n);
+
+	dbg("Core %d: reading %d ranges back for CRC\n", h->id, n);
+	for (i = 0; i < n; i++)
+		r[i].crc = easynmc_crc32(0, &h->imem32[r[i].addr], r[i].len * 4);
+	return 0;
+}
+
+/**
+ * Start collecting ranges to verify. Used by easynmc_load_abs().
+ *
+ * @param h
+ * @return 0 if OK, -1 otherwise
+ */
+int easynmc_verify_begin(struct easynmc_handle *h)
+{
+	easynmc_verify_free(h);
+	h->verify = calloc(1, sizeof(*h->verify));
+	return h->verify ? 0 : -1;
+}
+
+/**
+ * Remember what a range of core memory should hold.
+ * Does nothing unless easynmc_verify_begin() has been called.
+ *
+ * @param h
+ * @param addr words
+ * @param data NULL for zeroes
+ * @param len bytes, a trailing partial word is not checked
+ * @return 0 if OK, -1 otherwise
+ */
+int easynmc_verify_add(struct easynmc_handle *h, uint32_t addr, const void *data, size_t len)
+{
+	struct easynmc_verify *v = h->verify;
+	struct easynmc_crc_range *r;
+
+	if (!v || (len < 4))
+		return 0;
+
+	if (v->num == v->max) {
+		int max = v->max ? v->max * 2 : 16;
+		r = realloc(v->ranges, max * sizeof(*r));
+		if (!r)
+			return -1;
+		v->ranges = r;
+		v->max = max;
+	}
+
+	r = &v->ranges[v->num++];
+	r->addr = addr;
+	r->len  = len / 4;
+	r->crc  = easynmc_crc32(0, data, r->len * 4);
+	return 0;
+}
+
+/**
+ * Forget the range starting at addr, e.g. a section a filter writes to.
+ *
+ * @param h
+ * @param addr words
+ */
+void easynmc_verify_drop(struct easynmc_handle *h, uint32_t addr)
+{
+	struct easynmc_verify *v = h->verify;
+	int i;
+
+	if (!v)
+		return;
+	for (i = 0; i < v->num; i++) {
+		if (v->ranges[i].addr == addr) {
+			v->ranges[i] = v->ranges[--v->num];
+			return;
+		}
+	}
+}
+
+/**
+ * Check all collected ranges against core memory and stop collecting.
+ *
+ * @param h
+ * @return 0 if everything matches, -1 otherwise
+ */
+int easynmc_verify_run(struct easynmc_handle *h)
+{
+	struct easynmc_verify *v = h->verify;
+	struct easynmc_crc_range *r;
+	int i, ret = 0;
+
+	if (!v || !v->num) {
+		easynmc_verify_free(h);
+		return 0;
+	}
+
+	r = malloc(v->num * sizeof(*r));
+	if (!r) {
+		easynmc_verify_free(h);
+		return -1;
+	}
+	memcpy(r, v->ranges, v->num * sizeof(*r));
+
+	if (0 != easynmc_crc(h, r, v->num)) {
+		ret = -1;
+	} else {
+		for (i = 0; i < v->num; i++) {
+			if (r[i].crc != v->ranges[i].crc) {
+				err("Core %d: %u words @0x%x are corrupted, CRC 0x%08x, want 0x%08x\n",
+				    h->id, r[i].len, r[i].addr, r[i].crc, v->ranges[i].crc);
+				ret = -1;
+			}
+		}
+	}
+
+	if (!ret) {
+		dbg("Core %d: %d ranges verified\n", h->id, v->num);
+	}
+
+	free(r);
+	easynmc_verify_free(h);
+	return ret;
+}
+
+/**
+ * Stop collecting ranges without checking them.
+ *
+ * @param h
+ */
+void easynmc_verify_free(struct easynmc_handle *h)
+{
+	if (!h->verify)
+		return;
+	free(h->verify->ranges);
+	free(h->verify);
+	h->verify = NULL;
+}
+
+/**
+ * @}
+ */
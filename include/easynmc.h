@@ -12,6 +12,59 @@
 #define  NMC_REG_CORE_START   (0x103)
 #define  NMC_REG_PROG_ENTRY   (0x104)
 #define  NMC_REG_PROG_RETURN  (0x105)
+#define  NMC_REG_IPL_CAPS     (0x106)
+#define  NMC_REG_APP_ENTRY    (0x107)
+#define  NMC_REG_CALL_FN      (0x108)
+#define  NMC_REG_CALL_ARGS    (0x109)
+#define  NMC_REG_CALL_TABLE   (0x10A)
+#define  NMC_REG_CALL_STACK   (0x10B)
+#define  NMC_REG_RUN_COUNT    (0x10C)
+#define  NMC_REG_RUN_LAST     (0x10D)
+#define  NMC_REG_RUN_BUSY     (0x10E)
+#define  NMC_REG_RUN_IDLE     (0x10F)
+#define  NMC_REG_CMD_ARGS     (0x110) /* Command arguments, up to NMC_REG_CMD_ARGS_LEN words */
+#define  NMC_REG_CMD_ARGS_LEN (0x10)
+
+#define  NMC_REG_AREA_LEN     (0x20)
+
+/* Commands written to NMC_REG_CORE_START */
+#define  NMC_CMD_RUN          (1)
+#define  NMC_CMD_CALL         (2)
+#define  NMC_CMD_CRC          (4)
+#define  NMC_CMD_MEMOPS       (8)
+
+/* Words reserved for the IPL at the start of internal memory */
+#define  NMC_IPL_AREA_LEN     (0x200)
+/* ...and at the top of IM0, for the IPL code and data that don't fit there */
+#define  NMC_IPL_EXT_ADDR     (0xFC00)
+#define  NMC_IPL_EXT_LEN      (0x400)
+/* The last words of it are not used by the IPL, the library keeps app info there */
+#define  NMC_IPL_HOST_LEN     (0x4)
+#define  NMC_IPL_HOST_ADDR    (NMC_IPL_EXT_ADDR + NMC_IPL_EXT_LEN - NMC_IPL_HOST_LEN)
+#define  NMC_HOST_STDIN       (0x0) /* stdin ring of the loaded app, words, 0 - none */
+#define  NMC_HOST_STDOUT      (0x1) /* stdout ring */
+
+/* Version of the IPL shipped with this library, see NMC_REG_CODEVERSION */
+#define EASYNMC_IPL_VERSION       (0x20261024)
+
+/* The first IPL, with a short register block and no capabilities */
+#define EASYNMC_LEGACY_STARTUPCODE (0x20140715)
+
+/* IPL capabilities, reported in NMC_REG_IPL_CAPS */
+#define EASYNMC_IPL_CAP_EXTREGS   (1<<0) /* Extended register block, NMC_REG_APP_ENTRY */
+#define EASYNMC_IPL_CAP_CALL      (1<<1) /* Function table calls, NMC_CMD_CALL */
+#define EASYNMC_IPL_CAP_IRQSTART  (1<<2) /* Idle until HP, NMC_REG_CORE_START cleared on pickup */
+#define EASYNMC_IPL_CAP_DONEIRQ   (1<<3) /* Selectable completion irq, EASYNMC_DONE_IRQ_* */
+#define EASYNMC_IPL_CAP_CRC       (1<<4) /* CRC32 of memory ranges, NMC_CMD_CRC */
+#define EASYNMC_IPL_CAP_MEMOPS    (1<<5) /* Fill and copy, NMC_CMD_MEMOPS */
+#define EASYNMC_IPL_CAP_TIMING    (1<<6) /* Run count and timing, NMC_REG_RUN_* */
+
+/* Busy and idle times are in units of 1 << EASYNMC_RUN_TIME_SHIFT timer ticks */
+#define EASYNMC_RUN_TIME_SHIFT    (10)
+
+/* Interrupts raised by the IPL when an app completes, in NMC_REG_ISR_ON_START */
+#define EASYNMC_DONE_IRQ_HP       (1<<0)
+#define EASYNMC_DONE_IRQ_LP       (1<<1) /* Needs EASYNMC_IPL_CAP_DONEIRQ */
 
 
 extern int g_libeasynmc_debug;
@@ -19,7 +72,46 @@ extern int g_libeasynmc_errors;
 
 
 struct easynmc_handle;
+struct easynmc_mapping;
+struct easynmc_relaunch_image;
+struct easynmc_recorder;
+struct easynmc_backend;
+struct easynmc_overlays;
+struct easynmc_verify;
 
+/* 
+ * An opened core as seen by a device backend. Backends fill in everything 
+ * but id. iofd and memfd must be pollable the same way as the driver ones.
+ */
+struct easynmc_device {
+	int       id;
+	int       iofd;
+	int       memfd;
+	char     *imem;
+	uint32_t  imem_size;
+	const struct easynmc_backend *backend;
+	void     *priv;
+};
+
+#define EASYNMC_DEV_REGS_ONLY (1<<0) /* Only the IPL registers will be accessed */
+
+struct easynmc_backend {
+	const char *name;
+	/* Fill ids with up to max core ids present, return their number */
+	int  (*probe)(int *ids, int max);
+	int  (*open)(struct easynmc_device *dev, int flags);
+	void (*close)(struct easynmc_device *dev);
+	/* Same requests and semantics as the IOCTL_NMC3_* driver ioctls */
+	int  (*ioctl)(struct easynmc_device *dev, unsigned long req, void *arg);
+};
+
+extern const struct easynmc_backend easynmc_driver_backend;
+extern const struct easynmc_backend easynmc_sim_backend;
+
+/* 
+ * NOTE: When section filters are replayed by easynmc_relaunch_app() 
+ * rfd is NULL. The filters should only update their state in this case.
+ */
 struct easynmc_section_filter {
 	const char* name;
 	int (*handle_section)(struct easynmc_handle *h, char* name, FILE *rfd, GElf_Shdr shdr);
@@ -34,9 +126,29 @@ struct easynmc_handle {
 	uint32_t *imem32;
 	uint32_t  imem_size;
 	/* Private data */
+	struct easynmc_mapping        *map;
+	struct easynmc_device         *dev;
 	struct easynmc_section_filter *sfilters; 
+	struct easynmc_section_filter *builtin_filters;
 	int       argoffset;
 	int       argdatalen;
+	int       liveoffset;
+	int       ovloffset;
+	int       paramoffset;
+	int       inputoffset;
+	int       outputoffset;
+	int       queueoffset;
+	int       calloffset;
+	int       stdinoffset;
+	int       stdoutoffset;
+	uint32_t  queuehead;  /* Submission head, including staged commands */
+	int       lockfd;
+	struct easynmc_relaunch_image *relaunch;
+	uint32_t  build_hash;
+	uint32_t  expected_hash;
+	struct easynmc_recorder *rec;
+	struct easynmc_overlays *ovl;
+	struct easynmc_verify   *verify;
 };
 
 #ifndef ARRAY_SIZE
@@ -57,23 +169,257 @@ enum easynmc_core_state {
 #define ABSLOAD_FLAG_STDIO    (1<<1)
 #define ABSLOAD_FLAG_ARGS     (1<<2)
 #define ABSLOAD_FLAG_SYNCLIB  (1<<3)
+#define ABSLOAD_FLAG_RELAUNCH (1<<4)
+#define ABSLOAD_FLAG_VERIFY   (1<<5)
+#define ABSLOAD_FLAG_IPL      (1<<6) /* The image is the IPL, used by easynmc_boot_core() */
+
+/* A range of core memory for easynmc_crc() */
+struct easynmc_crc_range {
+	uint32_t addr;  /* words */
+	uint32_t len;   /* words */
+	uint32_t crc;
+};
+
+/* A fill or copy done by the IPL, see easynmc_memops() */
+enum {
+	EASYNMC_MEMOP_FILL = 1,
+	EASYNMC_MEMOP_COPY
+};
+
+struct easynmc_memop {
+	uint32_t op;   /* EASYNMC_MEMOP_* */
+	uint32_t dst;  /* words, in core memory */
+	uint32_t src;  /* words, any nmc address; the value for fills */
+	uint32_t len;  /* words */
+};
+
+/* A range of core memory for easynmc_writev() */
+struct easynmc_iovec {
+	uint32_t    addr;  /* byte offset in imem */
+	const void *data;  /* NULL - fill with zeroes */
+	size_t      len;   /* bytes */
+};
+
+/* A prebuilt IPL image flattened into core writes at build time (nmc-iplgen) */
+struct easynmc_ipl_plan {
+	const char                 *core;   /* as in easynmc_get_core_name() */
+	int                         debug;
+	const struct easynmc_iovec *iov;
+	int                         num;
+	uint32_t                    entry;
+};
+
+extern const struct easynmc_ipl_plan easynmc_ipl_plans[];
+
+/* What the loader does with a section, see easynmc_section_action() */
+enum { 
+	EASYNMC_SECTION_UPLOAD,
+	EASYNMC_SECTION_FILL,
+	EASYNMC_SECTION_SKIP,
+	EASYNMC_SECTION_OVERLAY, /* Kept in host memory, see easynmc-overlay.c */
+};
+
+/* Overlay sections are named EASYNMC_OVERLAY_PREFIX + decimal id */
+#define EASYNMC_OVERLAY_PREFIX ".easynmc_overlay."
+#define EASYNMC_OVERLAY_ALL    (-1)
+
+struct easynmc_overlay_stats {
+	uint32_t hits;       /* Found resident by the core */
+	uint32_t loads;      /* Misses, copied to the core by the host */
+	uint32_t evictions;
+	uint64_t bytes;      /* Copied to the core */
+	int      slot;       /* Current slot, -1 if not resident or for totals */
+};
+
+/* 
+ * Compressed load image, made by nmc-abzip. The header is followed by 
+ * num_sections section records, each followed by the NUL-terminated name 
+ * and zsize bytes of payload, both padded to 4 bytes. All fields are 
+ * little-endian.
+ */
+#define EASYNMC_ABZ_MAGIC    "NMCZ"
+#define EASYNMC_ABZ_VERSION  1
+#define EASYNMC_ABZ_ALIGN(x) (((x) + 3) & ~3)
+
+enum { 
+	EASYNMC_ABZ_NONE, /* No payload: skipped or zero-filled section */
+	EASYNMC_ABZ_RAW,  /* Stored as is */
+	EASYNMC_ABZ_LZ,   /* easynmc_lz_compress() */
+};
+
+struct easynmc_abz_header {
+	char      magic[4];
+	uint32_t  version;
+	uint32_t  entry;
+	uint32_t  build_hash;
+	uint32_t  num_sections;
+	uint32_t  reserved;
+};
+
+struct easynmc_abz_section {
+	uint32_t  sh_type;
+	uint32_t  sh_flags;
+	uint32_t  sh_addr;   /* words */
+	uint32_t  sh_size;   /* bytes */
+	uint32_t  zsize;     /* payload bytes */
+	uint16_t  encoding;  /* EASYNMC_ABZ_* */
+	uint16_t  name_len;  /* including the trailing NUL */
+};
 
 #define ABSLOAD_FLAG_DEFAULT  \
 	(ABSLOAD_FLAG_STDIO | ABSLOAD_FLAG_ARGS)
 
+struct easynmc_start_report {
+	int       started;     /* Number of cores seen starting */
+	uint64_t  release_ns;  /* Time it took to release all cores */
+	uint64_t  skew_ns;     /* Observed spread of core start times */
+};
+
+#define EASYNMC_DISPATCHER_MAX_HANDLES 16
+
+struct easynmc_dispatcher;
+
+struct easynmc_dispatcher_config {
+	int       cpu;              /* CPU to pin the thread to, -1 - don't pin */
+	int       priority;         /* SCHED_FIFO priority, 0 - keep default policy */
+	int       lock_memory;      /* mlockall() before starting */
+	uint32_t  latency_probe_us; /* Latency probe period, 0 - disabled */
+};
+
+struct easynmc_dispatcher_ops {
+	void (*on_event)(struct easynmc_handle *h, int evt, void *arg);
+	void (*on_stdout)(struct easynmc_handle *h, char *buf, int len, void *arg);
+};
+
+struct easynmc_reactor;
+
+struct easynmc_reactor_ops {
+	void (*on_stdout)(struct easynmc_handle *h, char *buf, int len, void *arg);
+	/* App stdin can take more data, see easynmc_reactor_want_stdin() */
+	void (*on_stdin)(struct easynmc_handle *h, void *arg);
+	void (*on_event)(struct easynmc_handle *h, int evt, void *arg);
+	void (*on_exit)(struct easynmc_handle *h, int code, void *arg);
+};
+
+struct easynmc_latency_stats {
+	uint64_t  samples;
+	uint64_t  p50_ns;
+	uint64_t  p90_ns;
+	uint64_t  p99_ns;
+	uint64_t  p999_ns;
+	uint64_t  max_ns;
+};
+
+/* Session log record types */
+enum { 
+	EASYNMC_REC_UPLOAD = 1, /* arg0 - byte address, arg1 - length, data follows */
+	EASYNMC_REC_FILL,       /* arg0 - byte address, arg1 - length, zero fill */
+	EASYNMC_REC_IRQ,        /* arg0 - enum nmc_irq */
+	EASYNMC_REC_START,      /* arg0 - entry point */
+	EASYNMC_REC_EVENT,      /* arg0 - event returned by easynmc_token_wait() */
+	EASYNMC_REC_STATE,      /* arg0 - new enum easynmc_core_state */
+	EASYNMC_REC_STDIN,      /* data sent to app stdin */
+	EASYNMC_REC_STDOUT,     /* data received from app stdout */
+	EASYNMC_REC_MARK,       /* user-defined marker */
+	EASYNMC_REC_STDIO,      /* arg0 - 0 stdin, 1 stdout, arg1 - ring offset, words */
+};
+
+#define EASYNMC_REPLAY_REALTIME (1<<0) /* Keep the original timing */
+#define EASYNMC_REPLAY_SYNC     (1<<1) /* Wait for recorded events and idle states */
+
+struct easynmc_replay_opts {
+	int       flags;       /* EASYNMC_REPLAY_* */
+	uint32_t  timeout_ms;  /* Max wait for each event in sync mode and for stdin space */
+	int       stdout_fd;   /* Where to copy app stdout, -1 - discard */
+};
+
+struct easynmc_replay_stats {
+	uint64_t  records;
+	uint64_t  uploads;
+	uint64_t  irqs;
+	uint64_t  stdin_bytes;
+	uint64_t  stdin_dropped;	/* Not accepted within timeout_ms */
+	uint64_t  stdout_bytes;
+	uint64_t  events_matched;
+	uint64_t  events_missed;
+	uint64_t  duration_ns;
+};
+
 struct easynmc_token {
 	struct nmc_irq_token tok;
 	struct easynmc_handle *h;
 };
 
 
+/* 
+ * Apps run by the IPL, timed by the core. All counters are 32 bits and 
+ * wrap, compare samples to get the load over a period.
+ */
+struct easynmc_run_stats {
+	uint32_t runs;  /* Apps started and function calls */
+	uint32_t last;  /* Ticks, duration of the last run */
+	uint32_t busy;  /* Ticks >> EASYNMC_RUN_TIME_SHIFT, spent in runs */
+	uint32_t idle;  /* Ticks >> EASYNMC_RUN_TIME_SHIFT, spent in the IPL */
+};
+
+struct easynmc_core_info {
+	int       id;
+	char      name[64];
+	char      type[64];
+	uint32_t  imem_size;
+	int       started;
+	uint32_t  codever;
+	enum easynmc_core_state state;
+	struct nmc_core_stats   stats;
+	int       has_run_stats;
+	struct easynmc_run_stats run;
+};
+
+struct easynmc_inventory_priv;
+
+struct easynmc_inventory {
+	int       num_cores;
+	struct easynmc_core_info *cores;
+	/* Private data */
+	struct easynmc_inventory_priv *priv;
+};
+
+
 #define EASYNMC_CORE_ALL   -1
 #define EASYNMC_CORE_ANY   -2
 
 
+int easynmc_set_backend(const struct easynmc_backend *b);
+const struct easynmc_backend *easynmc_get_backend(void);
+int easynmc_ioctl(struct easynmc_handle *h, unsigned long req, void *arg);
+
+struct easynmc_sim_core;
+struct easynmc_sim_app {
+	/* Called on the simulated core when the app is started, returns the exit code */
+	int  (*run)(struct easynmc_sim_core *c, uint32_t entry, void *arg);
+	/* Optional: host sent an LP or HP irq to the core */
+	void (*irq)(struct easynmc_sim_core *c, enum nmc_irq irq, void *arg);
+	/* Optional: host called a function from the app's table, returns its return value */
+	int  (*call)(struct easynmc_sim_core *c, uint32_t fn, uint32_t entry, uint32_t args, void *arg);
+};
+
+int easynmc_sim_set_app(int coreid, const struct easynmc_sim_app *app, void *arg);
+uint32_t *easynmc_sim_imem(struct easynmc_sim_core *c);
+int easynmc_sim_irq(struct easynmc_sim_core *c, enum nmc_irq irq);
+int easynmc_sim_write(struct easynmc_sim_core *c, const char *buf, int len);
+int easynmc_sim_read(struct easynmc_sim_core *c, char *buf, int len);
+int easynmc_sim_stopping(struct easynmc_sim_core *c);
+
 struct easynmc_handle *easynmc_open(int coreid);
 struct easynmc_handle *easynmc_open_noboot(int coreid);
 void easynmc_close(struct easynmc_handle *hndl);
+void easynmc_flush_handle_cache(void);
+int easynmc_reserve_core(struct easynmc_handle *h);
+
+struct easynmc_inventory *easynmc_inventory_scan(void);
+int easynmc_inventory_refresh(struct easynmc_inventory *inv);
+struct easynmc_core_info *easynmc_inventory_find(struct easynmc_inventory *inv, int coreid);
+void easynmc_inventory_free(struct easynmc_inventory *inv);
 
 int easynmc_boot_core(struct easynmc_handle *h, int debug);
 
@@ -85,11 +431,91 @@ const char* easynmc_state_name(enum easynmc_core_state state);
 int easynmc_load_abs(struct easynmc_handle *h, const char *path, uint32_t* ep, int flags);
 int easynmc_set_args(struct easynmc_handle *h, char* self, int argc, char **argv);
 int easynmc_start_app(struct easynmc_handle *h, uint32_t entry);
+int easynmc_get_app_entry(struct easynmc_handle *h, uint32_t *ep);
+int easynmc_start_app_sync(struct easynmc_handle **h, uint32_t *entries, int num, 
+			   struct easynmc_start_report *rep);
+int easynmc_relaunch_app(struct easynmc_handle *h, char* self, int argc, char **argv);
 char *easynmc_get_default_ipl(char* name, int debug);
+const struct easynmc_ipl_plan *easynmc_get_builtin_ipl(const char *name, int debug);
 
 int easynmc_stop_app(struct easynmc_handle *h);
 int easynmc_exitcode(struct easynmc_handle *h);
+int easynmc_set_done_irq(struct easynmc_handle *h, uint32_t irqs);
+int easynmc_wait_app(struct easynmc_handle *h, uint32_t timeout, int *exitcode);
+int easynmc_run_stats(struct easynmc_handle *h, struct easynmc_run_stats *st);
+
+
+#define EASYNMC_SNAPSHOT_FLAG_FORCE   (1<<0)
+#define EASYNMC_SNAPSHOT_FLAG_SPARSE  (1<<1) /* Don't zero memory between the saved ranges */
+#define EASYNMC_SNAPSHOT_FLAG_NOCLEAR EASYNMC_SNAPSHOT_FLAG_SPARSE
+
+int easynmc_snapshot_save(struct easynmc_handle *h, const char *path, int flags);
+int easynmc_snapshot_restore(struct easynmc_handle *h, const char *path, int flags);
+
+int easynmc_live_params_len(struct easynmc_handle *h);
+int easynmc_live_params_write(struct easynmc_handle *h, const uint32_t *params, uint32_t len);
+int easynmc_live_params_read(struct easynmc_handle *h, uint32_t *params, uint32_t len, uint32_t *seq);
+
+/* Types of typed parameters, see easynmc-params.c */
+enum { 
+	EASYNMC_PARAM_INT = 1,
+	EASYNMC_PARAM_FLOAT,
+	EASYNMC_PARAM_DOUBLE,
+	EASYNMC_PARAM_STRING,
+};
+
+int easynmc_params_clear(struct easynmc_handle *h);
+int easynmc_params_set(struct easynmc_handle *h, const char *key, int type, 
+		       const void *values, uint32_t count);
+int easynmc_params_parse(struct easynmc_handle *h, const char *spec);
+
+int easynmc_input_write(struct easynmc_handle *h, const void *data, size_t len);
+int easynmc_input_load(struct easynmc_handle *h, const char *path);
+long easynmc_output_read(struct easynmc_handle *h, void *buf, size_t max);
+int easynmc_output_save(struct easynmc_handle *h, const char *path);
+
+struct easynmc_completion {
+	uint32_t tag;
+	uint32_t result;
+};
 
+struct easynmc_queue_stats {
+	uint32_t doorbells;  /* Kicks with new commands */
+	uint32_t batches;    /* Completion batches (LP interrupts) */
+	uint32_t staged;     /* Submitted, waiting for a kick */
+	uint32_t queued;     /* Kicked, not yet taken by the app */
+	uint32_t completed;  /* Waiting to be collected */
+};
+
+void easynmc_queue_attach(struct easynmc_handle *h, uint32_t offset);
+int easynmc_queue_submit(struct easynmc_handle *h, uint32_t op, uint32_t tag,
+			 const uint32_t *args, int nargs);
+int easynmc_queue_kick(struct easynmc_handle *h);
+int easynmc_queue_poll(struct easynmc_handle *h, struct easynmc_completion *c, int max);
+int easynmc_queue_wait(struct easynmc_handle *h, struct easynmc_completion *c, int max,
+		       uint32_t timeout);
+int easynmc_queue_stats(struct easynmc_handle *h, struct easynmc_queue_stats *st);
+
+int easynmc_call_count(struct easynmc_handle *h);
+int easynmc_call(struct easynmc_handle *h, uint32_t fn, const uint32_t *args, int nargs,
+		 uint32_t *ret, uint32_t timeout);
+
+uint32_t easynmc_crc32(uint32_t crc, const void *data, size_t len);
+int easynmc_crc(struct easynmc_handle *h, struct easynmc_crc_range *r, int n);
+int easynmc_verify_begin(struct easynmc_handle *h);
+int easynmc_verify_add(struct easynmc_handle *h, uint32_t addr, const void *data, size_t len);
+void easynmc_verify_drop(struct easynmc_handle *h, uint32_t addr);
+int easynmc_verify_run(struct easynmc_handle *h);
+void easynmc_verify_free(struct easynmc_handle *h);
+
+int easynmc_memops(struct easynmc_handle *h, const struct easynmc_memop *ops, int n);
+
+int easynmc_overlay_service(struct easynmc_handle *h);
+int easynmc_overlay_list(struct easynmc_handle *h, uint32_t *ids, int max);
+int easynmc_overlay_stats(struct easynmc_handle *h, int id, struct easynmc_overlay_stats *st);
+int easynmc_overlay_add(struct easynmc_handle *h, const char *name, GElf_Shdr *shdr, char *data);
+void easynmc_overlay_attach(struct easynmc_handle *h, uint32_t offset);
+void easynmc_overlay_free(struct easynmc_handle *h);
 
 struct easynmc_token *easynmc_token_new(struct easynmc_handle *h, uint32_t events);
 int easynmc_token_clear(struct easynmc_token *t);
@@ -98,11 +524,59 @@ int easynmc_token_cancel_wait(struct easynmc_token *t);
 
 int easynmc_pollmark(struct easynmc_handle *h);
 
+struct easynmc_dispatcher *easynmc_dispatcher_new(struct easynmc_dispatcher_config *cfg);
+int easynmc_dispatcher_add(struct easynmc_dispatcher *d, struct easynmc_handle *h,
+			   struct easynmc_dispatcher_ops *ops, void *arg);
+int easynmc_dispatcher_start(struct easynmc_dispatcher *d);
+void easynmc_dispatcher_stop(struct easynmc_dispatcher *d);
+int easynmc_dispatcher_latency(struct easynmc_dispatcher *d, struct easynmc_latency_stats *st);
+void easynmc_dispatcher_free(struct easynmc_dispatcher *d);
+
+struct easynmc_reactor *easynmc_reactor_new(void);
+int easynmc_reactor_add(struct easynmc_reactor *r, struct easynmc_handle *h,
+			struct easynmc_reactor_ops *ops, void *arg);
+int easynmc_reactor_remove(struct easynmc_reactor *r, struct easynmc_handle *h);
+int easynmc_reactor_start_app(struct easynmc_reactor *r, struct easynmc_handle *h, uint32_t entry);
+int easynmc_reactor_want_stdin(struct easynmc_reactor *r, struct easynmc_handle *h, int on);
+int easynmc_reactor_add_fd(struct easynmc_reactor *r, int fd, uint32_t events,
+			   void (*cb)(int fd, uint32_t events, void *arg), void *arg);
+int easynmc_reactor_remove_fd(struct easynmc_reactor *r, int fd);
+int easynmc_reactor_poll(struct easynmc_reactor *r, int timeout);
+int easynmc_reactor_run(struct easynmc_reactor *r);
+void easynmc_reactor_stop(struct easynmc_reactor *r);
+void easynmc_reactor_free(struct easynmc_reactor *r);
+
+int easynmc_record_start(struct easynmc_handle *h, const char *path);
+int easynmc_record_stop(struct easynmc_handle *h);
+void easynmc_record(struct easynmc_handle *h, int type, uint32_t arg0, uint32_t arg1,
+		    const void *data, uint32_t len);
+void easynmc_record_upload(struct easynmc_handle *h, uint32_t addr, uint32_t len);
+void easynmc_record_state(struct easynmc_handle *h, int state);
+int easynmc_replay(struct easynmc_handle *h, const char *path, 
+		   struct easynmc_replay_opts *o, struct easynmc_replay_stats *st);
+
 /* Section filters are a quick way to add your own ways of handling stuff */
 
 /* Low-level stuff, normally you won't need those */
 int easynmc_send_irq(struct easynmc_handle *h, enum nmc_irq irq);
+int easynmc_ipl_command(struct easynmc_handle *h, uint32_t cmd, int wait);
+int easynmc_ipl_run(struct easynmc_handle *h, uint32_t cmd, uint32_t timeout);
 int easynmc_startupcode_is_compatible(uint32_t codever);
+uint32_t easynmc_ipl_caps(struct easynmc_handle *h);
+int easynmc_ipl_owns(uint32_t addr, uint32_t len);
+
+uint32_t easynmc_elf_build_hash(Elf *elf);
+int easynmc_section_action(const char *name, GElf_Shdr *shdr, const char **why);
+
+int easynmc_writev(struct easynmc_handle *h, const struct easynmc_iovec *iov, int n);
+int easynmc_write(struct easynmc_handle *h, uint32_t addr, const void *data, size_t len);
+
+size_t easynmc_lz_bound(size_t len);
+long easynmc_lz_compress(const void *src, size_t len, void *dst, size_t dstlen);
+int easynmc_lz_decompress(const void *src, size_t len, void *dst, size_t dstlen);
+int easynmc_abs_build_hash(const char *path, uint32_t *hash);
+void easynmc_expect_build_hash(struct easynmc_handle *h, uint32_t hash);
+uint32_t easynmc_get_build_hash(struct easynmc_handle *h);
 int easynmc_get_core_name(struct easynmc_handle *h, char* str);
 int easynmc_get_core_type(struct easynmc_handle *h, char* str);
 const char* easynmc_evt_name(int evt);
@@ -110,5 +584,8 @@ const char* easynmc_evt_name(int evt);
 
 void easynmc_init_default_filters(struct easynmc_handle *h);
 void easynmc_register_section_filter(struct easynmc_handle *h, struct easynmc_section_filter *f);
+int easynmc_stdio_attach(struct easynmc_handle *h, int out, uint32_t offset);
+uint32_t easynmc_stdio_offset(struct easynmc_handle *h, int out);
+void easynmc_stdio_forget(struct easynmc_handle *h);
 
 #endif
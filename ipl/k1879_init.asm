@@ -38,6 +38,11 @@ MAGIC_AREA:
 <__init_INTR_CLEAR>
 	intr clear 3C0h; // Clean requests #2
 
+	/* Counter for run timing. Whether this alone starts it counting is 
+	 * unverified, so LOADER_CAPS doesn't claim EASYNMC_IPL_CAP_TIMING 
+	 */
+	t0 = -1;
+
 	
 	goto int_start_prog;
 
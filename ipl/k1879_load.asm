@@ -13,10 +13,133 @@ nobits ".bss"
 
 LoaderStack: long[20];
 
+/* Run timing state, see NMC_RUN_* */
+Running:   word;
+RunSince:  word;
+IdleSince: word;
+BusyFrac:  word;
+IdleFrac:  word;
+
 end ".bss";
 
 begin ".text"
 
+<sendLPINT>
+	gr7 = 24h;
+	nmscu = gr7;
+	return;
+	
+<sendHPINT>
+	gr7 = 48h;
+	nmscu = gr7;
+	return;
+	
+<Cmd_begin>
+	/* Update our state and acknowledge the command. The host polls 
+	 * NMC_CORE_START for that, HP and LP are left to app completion 
+	 */
+	gr0 = STATE_RUNNING;
+	gr1 = 0h	   ;
+	
+	[NMC_CORE_STATUS] = gr0;
+	[NMC_CORE_START]  = gr1;
+
+	return;
+	
+<int_start_prog>	
+	ar7 = LoaderStack;
+
+	/* Fetch the return code, if any */
+	[NMC_PROG_RETURN] = gr7;
+
+	/* Account the run that has just ended, if any */
+	call Run_end;
+
+	/* Commands that don't run app code come back here */
+<Ipl_ready>
+	
+	gr0 = LOADER_CODE_VERSION;	
+	[NMC_CODEVERSION] = gr0;
+
+	gr0 = LOADER_CAPS;
+	[NMC_IPL_CAPS] = gr0;
+	
+	gr0 = STATE_READY;	
+	[NMC_CORE_STATUS] = gr0;
+
+	/* Reset Vector core, otherwise we can hang up */
+	call _VEC_Reset;
+
+.if DEBUG;
+	call Debug_init;
+.endif;
+	
+	/* Call HPINT and/or LPINT if host instructs us
+	 * to do so. This is also the app completion event
+	 */
+	
+	gr4 = [NMC_ISR_ON_START];
+	gr7 = 1h;
+	with gr7 = gr4 and gr7;
+	if =0 skip No_HP;
+
+	call sendHPINT;
+<No_HP>
+	gr7 = 2h;
+	with gr7 = gr4 and gr7;
+	if =0 skip Main_loop;
+
+	call sendLPINT;
+
+<Main_loop>
+
+	/* Tell the host we're ready */
+	gr0 = STATE_READY;	
+	[NMC_CORE_STATUS] = gr0;
+
+	
+.if DEBUG;
+	call Debug_blink;
+.endif;
+
+	/* Sleep until the host sends an interrupt, looking at 
+	 * registers only, so that edcl gets the IM bank for uploads.
+	 * Have a look at the command now and then anyway, in case 
+	 * the interrupt got lost
+	 */
+	gr6 = HOST_IRQ_REQUESTS;
+	gr5 = IDLE_POLL_SPINS;
+<Idle_loop>
+	gr0 = intr;
+	with gr0 = gr0 and gr6;
+	if <>0 goto Wake_up;
+	gr5--;
+	if > skip Idle_loop;
+<Wake_up>
+	intr clear HOST_IRQ_REQUESTS;
+
+	/* NMC_CMD_RUN is bit 0, the rest are handled in .text_ext */
+	gr4 = [NMC_CORE_START];
+	gr7 = 1h;
+	with gr7 = gr4 and gr7;
+	if =0 goto Ext_command;
+
+	call Cmd_begin;
+	call Run_begin;
+	
+        /* load & call the rogram entry point */
+	ar4 = [NMC_PROG_ENTRY];
+	call ar4;
+	[NMC_PROG_ENTRY] = gr7	;
+
+	goto int_start_prog;
+
+end ".text";
+
+/* Whatever does not need to be in LOADERMEM. It lives at the top of 
+ * IM0, see k1879_init.cfg and NMC_IPL_EXT_ADDR in easynmc.h
+ */
+begin ".text_ext"
 
 /* TODO: Portability? */
 <_VEC_Reset>
@@ -61,32 +184,8 @@ begin ".text"
 	pop ar0,gr0;
 	return;
 	
-<sendLPINT>
-	gr7 = 24h;
-	nmscu = gr7;
-	return;
-	
-<sendHPINT>
-	gr7 = 48h;
-	nmscu = gr7;
-	return;
-	
-<int_start_prog>	
-	ar7 = LoaderStack;
-
-	/* Fetch the return code, if any */
-	[NMC_PROG_RETURN] = gr7;
-	
-	gr0 = LOADER_CODE_VERSION;	
-	[NMC_CODEVERSION] = gr0;
-	
-	gr0 = STATE_READY;	
-	[NMC_CORE_STATUS] = gr0;
-
-	/* Reset Vector core, otherwise we can hang up */
-	call _VEC_Reset;
-
 .if DEBUG;
+<Debug_init>
 	// TS2 as GPIO
 	gr0 = [0_0800_CC21h];
 	gr1 = 20h;
@@ -98,43 +197,9 @@ begin ".text"
 	gr1 = 0C0h;
 	gr0 = gr0 or gr1;
 	[0_0800_A407h] = gr0;
-.endif; 
-	
-	/* Call HPINT if host instructs us
-	 * to do so
-	 */
-	
-	gr7 = 1h;
-	gr4 = [NMC_ISR_ON_START];
-	with gr4 = gr4 and gr7;
-	if =0 skip Main_loop;
-
-	call sendHPINT;
-
-<Main_loop>
-
-	/* Tell the host we're ready */
-	gr0 = STATE_READY;	
-	[NMC_CORE_STATUS] = gr0;
-
-	/* Loop on some dumb arithmetics to allow
-	 * edcl get access to the IM bank
-	*/
-	
-	gr4 = false;	
-	gr5 = false;				
-	gr6 = false;
-	gr4 = gr4 + gr5;
-	gr5 = gr6 + gr5;
-	gr4 = gr4 + gr5;
-	gr5 = gr6 + gr5;
-	gr4 = gr4 + gr5;
-	gr5 = gr6 + gr5;
-	gr4 = gr4 + gr5;
-	gr5 = gr6 + gr5;
+	return;
 
-	
-.if DEBUG;
+<Debug_blink>
 	// First LED on
 	gr1 = 40h;
 	gr0 = [0_0800_A403h];
@@ -156,25 +221,171 @@ begin ".text"
 <First_LED_off_loop>
 	gr2--;
 	if > skip First_LED_off_loop;
+	return;
 .endif;
 
-	gr7 = 1h;
-	gr4 = [NMC_CORE_START];
-	with gr4 = gr4 and gr7;
-	if =0 skip Main_loop;
+<Run_begin>
+	/* Idle time ends, run time starts */
+	gr0 = t0;
+	[RunSince] = gr0;
+	gr1 = 1h;
+	[Running] = gr1;
+	gr1 = [IdleSince];
+	gr1 = gr1 - gr0;
+	gr2 = [IdleFrac];
+	gr2 = gr2 + gr1;
+	gr3 = gr2 >> RUN_TIME_SHIFT;
+	gr4 = [NMC_RUN_IDLE];
+	gr4 = gr4 + gr3;
+	[NMC_RUN_IDLE] = gr4;
+	gr3 = RUN_TIME_MASK;
+	gr2 = gr2 and gr3;
+	[IdleFrac] = gr2;
+	return;
 
-	/* Update our state */
-	gr0 = STATE_RUNNING;
-	gr1 = 0h	   ;
-	
-	[NMC_CORE_STATUS] = gr0;
-	[NMC_CORE_START]  = gr1;
-	
-        /* load & call the rogram entry point */
-	ar4 = [NMC_PROG_ENTRY];
+<Run_end>
+	/* Run time ends, idle time starts.
+	 * t0 counts down, so elapsed time is then - now
+	 */
+	gr0 = t0;
+	[IdleSince] = gr0;
+	gr1 = [Running];
+	with gr1;
+	if =0 goto Run_end_idle;
+	gr1 = 0h;
+	[Running] = gr1;
+	gr1 = [RunSince];
+	gr1 = gr1 - gr0;
+	[NMC_RUN_LAST] = gr1;
+	gr2 = [BusyFrac];
+	gr2 = gr2 + gr1;
+	gr3 = gr2 >> RUN_TIME_SHIFT;
+	gr4 = [NMC_RUN_BUSY];
+	gr4 = gr4 + gr3;
+	[NMC_RUN_BUSY] = gr4;
+	gr3 = RUN_TIME_MASK;
+	gr2 = gr2 and gr3;
+	[BusyFrac] = gr2;
+	gr2 = [NMC_RUN_COUNT];
+	gr2++;
+	[NMC_RUN_COUNT] = gr2;
+<Run_end_idle>
+	return;
+
+<Ext_command>
+	gr7 = NMC_CMD_CALL;
+	with gr4 - gr7;
+	if =0 goto Call_function;
+
+	gr7 = NMC_CMD_CRC;
+	with gr4 - gr7;
+	if =0 goto Crc_ranges;
+
+	gr7 = NMC_CMD_MEMOPS;
+	with gr4 - gr7;
+	if =0 goto Mem_ops;
+
+	goto Main_loop;
+
+<Call_function>
+	call Cmd_begin;
+	call Run_begin;
+
+	/* Look the function up in the app's table and call it 
+	 * on the app's stack, argument block pointer is the only 
+	 * argument. The return value ends up in NMC_PROG_RETURN
+	 */
+	ar0 = [NMC_CALL_TABLE];
+	gr0 = [NMC_CALL_FN];
+	ar4 = [ar0 + gr0];
+	ar7 = [NMC_CALL_STACK];
+	gr7 = [NMC_CALL_ARGS];
+	push gr7;
 	call ar4;
-	[NMC_PROG_ENTRY] = gr7	;
 
 	goto int_start_prog;
 
-end ".text";
\ No newline at end of file
+<Crc_ranges>
+	call Cmd_begin;
+	/* NMC_CMD_ARGS holds the number of ranges, then address and 
+	 * length in words of each. Lengths are replaced with the CRC32 
+	 * of the range, the same as zlib gives for its bytes
+	 */
+	ar1 = NMC_CMD_ARGS;
+	gr1 = [ar1++];
+	ar2 = CrcNibbles;
+	gr6 = 0Fh;
+<Crc_range>
+	with gr1;
+	if =0 goto Ipl_ready;
+	gr1--;
+	ar0 = [ar1++];
+	gr4 = [ar1];
+	gr2 = -1;
+	with gr4;
+	if =0 goto Crc_store;
+<Crc_word>
+	gr0 = [ar0++];
+	gr2 = gr2 xor gr0;
+	gr5 = 8;
+<Crc_nibble>
+	gr3 = gr2 and gr6;
+	gr3 = [ar2 + gr3];
+	gr2 = gr2 >> 4;
+	gr2 = gr2 xor gr3;
+	gr5--;
+	if > skip Crc_nibble;
+	gr4--;
+	if > goto Crc_word;
+<Crc_store>
+	gr7 = -1;
+	gr2 = gr2 xor gr7;
+	[ar1++] = gr2;
+	goto Crc_range;
+
+<Mem_ops>
+	call Cmd_begin;
+
+	/* NMC_CMD_ARGS holds the number of operations, then operation, 
+	 * destination, source (the value for fills) and length in words 
+	 * of each. Unknown operations are skipped
+	 */
+	ar1 = NMC_CMD_ARGS;
+	gr1 = [ar1++];
+<Mem_op>
+	with gr1;
+	if =0 goto Ipl_ready;
+	gr1--;
+	gr3 = [ar1++];
+	ar0 = [ar1++];
+	gr0 = [ar1++];
+	ar2 = gr0;
+	gr4 = [ar1++];
+	with gr4;
+	if =0 goto Mem_op;
+	gr7 = MEMOP_COPY;
+	with gr3 - gr7;
+	if =0 goto Mem_copy;
+	gr7 = MEMOP_FILL;
+	with gr3 - gr7;
+	if <>0 goto Mem_op;
+<Mem_fill>
+	[ar0++] = gr0;
+	gr4--;
+	if > skip Mem_fill;
+	goto Mem_op;
+<Mem_copy>
+	gr0 = [ar2++];
+	[ar0++] = gr0;
+	gr4--;
+	if > skip Mem_copy;
+	goto Mem_op;
+
+	/* CRC32 of every nibble value, a byte table won't fit */
+CrcNibbles: word[16] = (
+	000000000h, 01DB71064h, 03B6E20C8h, 026D930ACh, 
+	076DC4190h, 06B6B51F4h, 04DB26158h, 05005713Ch, 
+	0EDB88320h, 0F00F9344h, 0D6D6A3E8h, 0CB61B38Ch, 
+	09B64C2B0h, 086D3D2D4h, 0A00AE278h, 0BDBDF21Ch);
+
+end ".text_ext";
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include <string.h>
+#include <easynmc/easynmc.h>
+
+/* 
+ * Live parameters are double-buffered. The host writes the inactive copy,
+ * flips 'active' and bumps 'seq'. If seq didn't change while we were copying
+ * the active copy, nobody touched it and what we have is consistent.
+ * No locks, no interrupts.
+ */
+
+/* Fetch a consistent copy of parameters, returns its sequence number */
+unsigned int easynmc_live_fetch(unsigned int *dst)
+{
+	struct nmc_live_params *p = &easynmc_live_hdr;
+	unsigned int *data = &p->data;
+	unsigned int seq;
+
+	do { 
+		seq = p->seq;
+		memcpy(dst, &data[p->active ? p->len : 0], p->len);
+	} while (seq != p->seq);
+
+	return seq;
+}
+
+/* 
+ * Fetch parameters only if they changed since *seq. Call this at block 
+ * boundaries. Returns 1 and updates *seq if dst has been updated.
+ */
+int easynmc_live_poll(unsigned int *seq, unsigned int *dst)
+{
+	if (easynmc_live_hdr.seq == *seq)
+		return 0;
+	*seq = easynmc_live_fetch(dst);
+	return 1;
+}
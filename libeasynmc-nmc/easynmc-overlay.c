@@ -0,0 +1,38 @@
+#include <easynmc/easynmc.h>
+
+/* 
+ * Overlays live in host memory until needed. The slot tables are shared
+ * with the host: it sets the resident ids and addresses when loading, we 
+ * bump the use stamps and hit counters, so hits never leave the core. 
+ * On a miss we post the id, raise an HP interrupt and spin until the host 
+ * has copied the overlay into a slot, evicting the least recently used one.
+ *
+ * The overlay that calls easynmc_overlay_get() is the most recently used 
+ * one, so it is evicted only if it is the sole candidate for the slot.
+ */
+
+/* Get the address of an overlay, loading it if needed. NULL if unknown */
+void *easynmc_overlay_get(unsigned int id)
+{
+	struct nmc_overlay_hdr *o = &easynmc_ovl_hdr;
+	volatile unsigned int *ids    = &o->tables;
+	volatile unsigned int *stamps = &ids[o->slots];
+	volatile unsigned int *hits   = &stamps[o->slots];
+	volatile unsigned int *addrs  = &hits[o->slots];
+	unsigned int i;
+
+	for (i = 0; i < o->slots; i++) {
+		if (ids[i] == id + 1) {
+			stamps[i] = ++o->clock;
+			hits[i]++;
+			return (void *) addrs[i];
+		}
+	}
+
+	o->req_id = id;
+	o->req_seq++;
+	easynmc_send_HPINT();
+	while (o->done_seq != o->req_seq);
+
+	return (void *) o->addr;
+}
@@ -0,0 +1,63 @@
+#include <string.h>
+#include <easynmc/easynmc.h>
+
+/* 
+ * The host fills the parameter block with ready-to-use values before the
+ * app starts, so there is nothing to parse here. Each entry is:
+ * 
+ *   length of the entry, words
+ *   type, EASYNMC_PARAM_*
+ *   number of elements
+ *   offset of the values from the start of the entry, words
+ *   key, one char per word, NUL-terminated
+ *   values (doubles are 64-bit aligned)
+ *
+ * Look up what you need once and keep the pointers.
+ */
+
+#define PARAM_LEN     0
+#define PARAM_TYPE    1
+#define PARAM_COUNT   2
+#define PARAM_OFFSET  3
+#define PARAM_KEY     4
+
+/* Find a parameter, returns a pointer to its values or 0 if not found */
+void *easynmc_param_find(const char *key, unsigned int type, unsigned int *count)
+{
+	struct nmc_params_hdr *p = &easynmc_params_hdr;
+	unsigned int *e = &p->data;
+	unsigned int i;
+
+	for (i = 0; i < p->count; i++, e += e[PARAM_LEN]) {
+		if ((e[PARAM_TYPE] != type) || strcmp((char *) &e[PARAM_KEY], key))
+			continue;
+		if (count)
+			*count = e[PARAM_COUNT];
+		return &e[e[PARAM_OFFSET]];
+	}
+	return 0;
+}
+
+int easynmc_param_int(const char *key, int def)
+{
+	int *v = easynmc_param_find(key, EASYNMC_PARAM_INT, 0);
+	return v ? *v : def;
+}
+
+float easynmc_param_float(const char *key, float def)
+{
+	float *v = easynmc_param_find(key, EASYNMC_PARAM_FLOAT, 0);
+	return v ? *v : def;
+}
+
+double easynmc_param_double(const char *key, double def)
+{
+	double *v = easynmc_param_find(key, EASYNMC_PARAM_DOUBLE, 0);
+	return v ? *v : def;
+}
+
+const char *easynmc_param_string(const char *key, const char *def)
+{
+	const char *v = easynmc_param_find(key, EASYNMC_PARAM_STRING, 0);
+	return v ? v : def;
+}
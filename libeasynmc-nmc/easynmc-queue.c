@@ -0,0 +1,64 @@
+#include <easynmc/easynmc.h>
+
+/* 
+ * Persistent apps serve commands from the host instead of exiting after
+ * one job. Both rings are single producer, single consumer: the host only
+ * writes the submission head and the completion tail, we only write the 
+ * submission tail and the completion head.
+ *
+ * The host publishes a batch of commands at once and rings the doorbell.
+ * We run everything there is, then publish all the completions at once 
+ * and raise a single LP interrupt per batch.
+ */
+
+/* Publish completions up to head, one LP for the whole batch */
+static void queue_complete(struct nmc_queue_hdr *q, unsigned int head)
+{
+	q->cq_head = head;
+	q->batches++;
+	easynmc_send_LPINT();
+}
+
+/* Serve commands with fn until an EASYNMC_QUEUE_EXIT command arrives */
+void easynmc_queue_serve(easynmc_cmd_fn fn)
+{
+	struct nmc_queue_hdr *q = &easynmc_queue_hdr;
+	unsigned int *sq = &q->data;
+	unsigned int *cq = &sq[q->depth * q->cmdwords];
+	unsigned int mask = q->depth - 1;
+	unsigned int head = q->cq_head;
+	unsigned int tail = q->sq_tail;
+	unsigned int done = 0;
+
+	while (!done) {
+		unsigned int pending = 0;
+
+		while (!done && (tail != q->sq_head)) {
+			unsigned int *cmd = &sq[tail * q->cmdwords];
+
+			/* No room for the completion: hand over what we have first */
+			if (((head + 1) & mask) == q->cq_tail) {
+				if (pending)
+					queue_complete(q, head);
+				pending = 0;
+				while (((head + 1) & mask) == q->cq_tail);
+			}
+
+			cq[head * 2] = cmd[1];
+			if (cmd[0] == EASYNMC_QUEUE_EXIT) {
+				cq[head * 2 + 1] = 0;
+				done = 1;
+			} else {
+				cq[head * 2 + 1] = fn(cmd[0], &cmd[2], q->cmdwords - 2);
+			}
+
+			head = (head + 1) & mask;
+			tail = (tail + 1) & mask;
+			q->sq_tail = tail;
+			pending++;
+		}
+
+		if (pending)
+			queue_complete(q, head);
+	}
+}
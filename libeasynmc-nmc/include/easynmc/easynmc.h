@@ -40,6 +40,91 @@ struct nmc_stdio_channel {
 };
 
 
+/* Live parameters, declared with EASYNMC_LIVE_PARAMS in asm */
+struct nmc_live_params {
+	volatile unsigned int seq;
+	volatile unsigned int active;
+	unsigned int len;
+	unsigned int reserved;
+	unsigned int data; //first word of 2 copies
+};
+
+extern struct nmc_live_params easynmc_live_hdr;
+
+/* Typed parameters, declared with EASYNMC_PARAMS in asm */
+#define EASYNMC_PARAM_INT     1   /* int, one word */
+#define EASYNMC_PARAM_FLOAT   2   /* float, one word */
+#define EASYNMC_PARAM_DOUBLE  3   /* double, two words */
+#define EASYNMC_PARAM_STRING  4   /* one char per word, NUL-terminated */
+
+struct nmc_params_hdr {
+	unsigned int count;
+	unsigned int len;
+	unsigned int used;
+	unsigned int reserved;
+	unsigned int data; //first word of entries
+};
+
+extern struct nmc_params_hdr easynmc_params_hdr;
+
+/* Job data, declared with EASYNMC_INPUT and EASYNMC_OUTPUT in asm */
+struct nmc_data_section {
+	volatile unsigned int len; //bytes
+	unsigned int size;         //words
+	unsigned int reserved[2];
+	unsigned int data;         //first word
+};
+
+extern struct nmc_data_section easynmc_input_hdr;
+extern struct nmc_data_section easynmc_output_hdr;
+
+#define easynmc_input_data()          (&easynmc_input_hdr.data)
+#define easynmc_input_len()           (easynmc_input_hdr.len)
+#define easynmc_output_data()         (&easynmc_output_hdr.data)
+#define easynmc_output_set_len(bytes) (easynmc_output_hdr.len = (bytes))
+
+/* Command queue, declared with EASYNMC_QUEUE in asm */
+struct nmc_queue_hdr {
+	unsigned int depth;
+	unsigned int cmdwords;
+	volatile unsigned int sq_head;
+	volatile unsigned int sq_tail;
+	volatile unsigned int cq_head;
+	volatile unsigned int cq_tail;
+	volatile unsigned int doorbells;
+	volatile unsigned int batches;
+	unsigned int data; //first word of the submission ring
+};
+
+extern struct nmc_queue_hdr easynmc_queue_hdr;
+
+/* Opcode 0 stops easynmc_queue_serve() */
+#define EASYNMC_QUEUE_EXIT 0
+
+/* Runs a command, returns the result posted to the host */
+typedef unsigned int (*easynmc_cmd_fn)(unsigned int op, unsigned int *args, unsigned int nargs);
+
+/* 
+ * Exported with EASYNMC_CALLS in asm and called by the host with easynmc_call(),
+ * gets the argument block, returns the value posted to the host 
+ */
+typedef unsigned int (*easynmc_call_fn)(unsigned int *args);
+
+/* Overlay area, declared with EASYNMC_OVERLAYS in asm */
+struct nmc_overlay_hdr {
+	volatile unsigned int req_seq;
+	volatile unsigned int req_id;
+	volatile unsigned int done_seq;
+	volatile unsigned int addr;
+	unsigned int slots;
+	unsigned int slotlen;
+	unsigned int clock;
+	unsigned int reserved;
+	volatile unsigned int tables; //first word of ids, stamps, hits and addresses
+};
+
+extern struct nmc_overlay_hdr easynmc_ovl_hdr;
+
 #define min_t(type, a, b) (((type)(a)<(type)(b))?(type)(a):(type)(b))
 #define max_t(type, a, b) (((type)(a)>(type)(b))?(type)(a):(type)(b))
 
@@ -66,6 +151,19 @@ int printf(const char* format,...);
 int eprintf(struct nmc_stdio_channel *ch, const char* format,...);
 int evsprintf(struct nmc_stdio_channel *chan, const char* format, va_list args );
 
+unsigned int easynmc_live_fetch(unsigned int *dst);
+int easynmc_live_poll(unsigned int *seq, unsigned int *dst);
+
+void *easynmc_overlay_get(unsigned int id);
+
+void easynmc_queue_serve(easynmc_cmd_fn fn);
+
+void *easynmc_param_find(const char *key, unsigned int type, unsigned int *count);
+int easynmc_param_int(const char *key, int def);
+float easynmc_param_float(const char *key, float def);
+double easynmc_param_double(const char *key, double def);
+const char *easynmc_param_string(const char *key, const char *def);
+
 char getc();
 void putc(char ch);
 void puts(char *str);
@@ -0,0 +1,181 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <easynmc.h>
+
+void usage(char *nm)
+{
+	fprintf(stderr, 
+		"nmc-abzip - Make compressed load images from abs files\n"
+		"(c) 2014 RC Module | Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>\n"
+		"This is free software; see the source for copying conditions.  There is NO\n"
+                "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n"
+		"License: LGPLv2 \n"
+		"Usage: %s input.abs output.abz\n"
+		"The output can be used anywhere an abs file is accepted (nmrun, nmctl --load,\n"
+		"NMC_STARTUPCODE)\n"
+		, nm
+);
+}
+
+static int put(FILE *o, const void *data, size_t len)
+{
+	static const char pad[4];
+	if (len && (fwrite(data, len, 1, o) != 1))
+		return -1;
+	if ((EASYNMC_ABZ_ALIGN(len) != len) && 
+	    (fwrite(pad, EASYNMC_ABZ_ALIGN(len) - len, 1, o) != 1))
+		return -1;
+	return 0;
+}
+
+static int write_section(FILE *o, int fd, char *name, GElf_Shdr *shdr, 
+			 size_t *stored)
+{
+	struct easynmc_abz_section sec;
+	char *raw = NULL, *z = NULL, *payload = NULL;
+	int action = easynmc_section_action(name, shdr, NULL);
+	int ret = -1;
+
+	memset(&sec, 0x0, sizeof(sec));
+	sec.sh_type  = shdr->sh_type;
+	sec.sh_flags = shdr->sh_flags;
+	sec.sh_addr  = shdr->sh_addr;
+	sec.sh_size  = shdr->sh_size;
+	sec.name_len = strlen(name) + 1;
+	sec.encoding = EASYNMC_ABZ_NONE;
+
+	if ((action == EASYNMC_SECTION_UPLOAD) || (action == EASYNMC_SECTION_OVERLAY)) {
+		size_t bound = easynmc_lz_bound(shdr->sh_size);
+		long zlen;
+
+		raw = malloc(shdr->sh_size);
+		z   = malloc(bound);
+		if (!raw || !z)
+			goto bailout;
+		if (pread(fd, raw, shdr->sh_size, shdr->sh_offset) != shdr->sh_size) {
+			perror("pread");
+			goto bailout;
+		}
+
+		zlen = easynmc_lz_compress(raw, shdr->sh_size, z, bound);
+		if ((zlen >= 0) && (zlen < shdr->sh_size)) {
+			sec.encoding = EASYNMC_ABZ_LZ;
+			sec.zsize    = zlen;
+			payload      = z;
+		} else {
+			sec.encoding = EASYNMC_ABZ_RAW;
+			sec.zsize    = shdr->sh_size;
+			payload      = raw;
+		}
+	}
+
+	fprintf(stderr, "%-20s %8lu -> %8u bytes %s\n", name, 
+		(unsigned long) shdr->sh_size, sec.zsize, 
+		(sec.encoding == EASYNMC_ABZ_LZ) ? "lz" : 
+		(sec.encoding == EASYNMC_ABZ_RAW) ? "raw" : "");
+
+	if (put(o, &sec, sizeof(sec)) || put(o, name, sec.name_len) || 
+	    put(o, payload, sec.zsize))
+		goto bailout;
+
+	*stored += sizeof(sec) + EASYNMC_ABZ_ALIGN(sec.name_len) + EASYNMC_ABZ_ALIGN(sec.zsize);
+	ret = 0;
+
+bailout:
+	free(raw);
+	free(z);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct easynmc_abz_header hdr;
+	GElf_Ehdr ehdr; 
+	GElf_Shdr shdr;
+	Elf_Scn *scn = NULL;
+	size_t stored = sizeof(hdr);
+	FILE *o;
+	Elf *elf;
+	int fd, ret = 1;
+
+	if (argc != 3) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if ((fd = open(argv[1], O_RDONLY)) == -1) {
+		perror("open");
+		return 1;
+	}
+
+	elf_version(EV_CURRENT);
+	if (((elf = elf_begin(fd, ELF_C_READ, NULL)) == NULL) || !gelf_getehdr(elf, &ehdr)) {
+		fprintf(stderr, "%s: not an abs file: %s\n", argv[1], elf_errmsg(-1));
+		goto errclose;
+	}
+
+	if (!(o = fopen(argv[2], "wb"))) {
+		perror("fopen");
+		goto errend;
+	}
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	memcpy(hdr.magic, EASYNMC_ABZ_MAGIC, sizeof(hdr.magic));
+	hdr.version    = EASYNMC_ABZ_VERSION;
+	hdr.entry      = ehdr.e_entry;
+	hdr.build_hash = easynmc_elf_build_hash(elf);
+	while ((scn = elf_nextscn(elf, scn)) != NULL)
+		hdr.num_sections++;
+
+	if (put(o, &hdr, sizeof(hdr)))
+		goto errwrite;
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		char *name;
+		gelf_getshdr(scn, &shdr);
+		name = elf_strptr(elf, ehdr.e_shstrndx, shdr.sh_name);
+		if (write_section(o, fd, name ? name : "", &shdr, &stored))
+			goto errwrite;
+	}
+
+	fprintf(stderr, "%s: %u sections, %zu bytes\n", argv[2], hdr.num_sections, stored);
+	ret = 0;
+
+errwrite:
+	if (fclose(o) || ret) {
+		fprintf(stderr, "Failed to write %s\n", argv[2]);
+		unlink(argv[2]);
+		ret = 1;
+	}
+errend:
+	if (elf)
+		elf_end(elf);
+errclose:
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,319 @@
+/* 
+ * libEasyNMC DSP communication library. 
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <easynmc.h>
+
+#define MAX_MATCHES 32
+
+static char *g_prefix;
+static char *g_matches[MAX_MATCHES];
+static int   g_num_matches;
+
+struct binding {
+	char      ident[128];
+	char      symbol[128];
+	uint32_t  offset; /* words */
+	uint32_t  size;   /* bytes */
+};
+
+void usage(char *nm)
+{
+	fprintf(stderr, 
+		"nmc-bindgen - Generate host bindings for NMC app globals\n"
+		"(c) 2014 RC Module | Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>\n"
+		"This is free software; see the source for copying conditions.  There is NO\n"
+                "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n"
+		"License: LGPLv2 \n"
+		"Usage: %s [options] myapp.abs\n"
+		"Valid options are: \n"
+		"  --help             - Show this help\n" 
+		"  --prefix=name      - Prefix for generated names (Default - abs file name)\n"
+		"  --match=str        - Only export globals starting with str (C name, may repeat)\n"
+		"  --output=file      - Write header to file (Default - stdout)\n"
+		, nm
+);
+}
+
+static struct option long_options[] =
+{
+	{"help",             no_argument,         0, 'h' },
+	{"prefix",           required_argument,   0, 'p' },
+	{"match",            required_argument,   0, 'm' },
+	{"output",           required_argument,   0, 'o' },
+	{0, 0, 0, 0}
+};
+
+/* NMC C compiler prepends an underscore to all C symbols */
+static const char *c_name(const char *sym)
+{
+	return (sym[0] == '_') ? &sym[1] : sym;
+}
+
+static void make_ident(char *dst, const char *src, size_t len, int upper)
+{
+	size_t i;
+	for (i=0; src[i] && (i < len - 1); i++) {
+		char c = src[i];
+		if (!isalnum((unsigned char) c))
+			c = '_';
+		dst[i] = upper ? toupper((unsigned char) c) : c;
+	}
+	dst[i] = 0;
+}
+
+/* 
+ * Macros are upper-cased and non-alphanumerics become '_', so foo/FOO and 
+ * a.b/a_b would clash. Later ones get a numeric suffix.
+ */
+static void make_unique(struct binding *b, int num)
+{
+	char base[128], up[128], other[128];
+	int i, n = 1;
+
+	make_ident(up, b[num].ident, sizeof(up), 1);
+	strcpy(base, b[num].ident);
+	for (i = 0; i < num; i++) {
+		make_ident(other, b[i].ident, sizeof(other), 1);
+		if (strcmp(up, other))
+			continue;
+		snprintf(b[num].ident, sizeof(b[num].ident), "%.100s_%d", base, ++n);
+		make_ident(up, b[num].ident, sizeof(up), 1);
+		i = -1; /* The suffixed name may clash too, start over */
+	}
+	if (n > 1)
+		fprintf(stderr, "WARN: %s exported as %s, the name clashes with another global\n",
+			b[num].symbol, b[num].ident);
+}
+
+static int symbol_wanted(const char *name)
+{
+	int i;
+	if (!g_num_matches)
+		return 1;
+	for (i=0; i<g_num_matches; i++)
+		if (0 == strncmp(name, g_matches[i], strlen(g_matches[i])))
+			return 1;
+	return 0;
+}
+
+static int collect(Elf *elf, struct binding **out)
+{
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	struct binding *b = NULL;
+	int num = 0;
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		Elf_Data *data;
+		int i, count;
+
+		gelf_getshdr(scn, &shdr);
+		if ((shdr.sh_type != SHT_SYMTAB) || !shdr.sh_entsize)
+			continue;
+
+		data  = elf_getdata(scn, NULL);
+		count = shdr.sh_size / shdr.sh_entsize;
+		for (i=0; data && i<count; i++) {
+			GElf_Sym sym;
+			GElf_Shdr dshdr;
+			Elf_Scn *dscn;
+			const char *name;
+			struct binding *tmp;
+
+			if (!gelf_getsym(data, i, &sym))
+				continue;
+			if ((GELF_ST_BIND(sym.st_info) != STB_GLOBAL) ||
+			    (GELF_ST_TYPE(sym.st_info) == STT_FUNC) ||
+			    (GELF_ST_TYPE(sym.st_info) == STT_SECTION) ||
+			    (sym.st_shndx == SHN_UNDEF) || (sym.st_shndx >= SHN_LORESERVE))
+				continue;
+			
+			/* Only data: skip anything living in code sections */
+			dscn = elf_getscn(elf, sym.st_shndx);
+			if (!dscn || !gelf_getshdr(dscn, &dshdr) || 
+			    (dshdr.sh_flags & SHF_EXECINSTR))
+				continue;
+
+			name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+			if (!name || !name[0] || (name[0] == '.') || !symbol_wanted(c_name(name)))
+				continue;
+
+			tmp = realloc(b, (num + 1) * sizeof(*b));
+			if (!tmp) {
+				free(b);
+				return -1;
+			}
+			b = tmp;
+			make_ident(b[num].ident, c_name(name), sizeof(b[num].ident), 0);
+			strncpy(b[num].symbol, name, sizeof(b[num].symbol) - 1);
+			b[num].symbol[sizeof(b[num].symbol) - 1] = 0;
+			b[num].offset = sym.st_value;
+			b[num].size   = sym.st_size;
+			make_unique(b, num);
+			num++;
+		}
+	}
+	*out = b;
+	return num;
+}
+
+static void emit(FILE *o, const char *abs, uint32_t hash, struct binding *b, int num)
+{
+	char up[128], low[128];
+	char uident[128];
+	int i;
+
+	make_ident(up,  g_prefix, sizeof(up), 1);
+	make_ident(low, g_prefix, sizeof(low), 0);
+
+	fprintf(o, "/* Generated by nmc-bindgen from %s. Do not edit. */\n\n", abs);
+	fprintf(o, "#ifndef %s_NMC_BINDINGS_H\n", up);
+	fprintf(o, "#define %s_NMC_BINDINGS_H\n\n", up);
+	fprintf(o, "#include <stdint.h>\n");
+	fprintf(o, "#include <easynmc.h>\n\n");
+	fprintf(o, "/* Pass to easynmc_expect_build_hash() before easynmc_load_abs() */\n");
+	fprintf(o, "#define %s_BUILD_HASH 0x%08xU\n\n", up, hash);
+	fprintf(o, "/* Offsets are in 32-bit words from the start of imem, sizes in bytes */\n");
+	fprintf(o, "/* The symbol table has no C types, accessors are untyped word pointers */\n");
+
+	for (i=0; i<num; i++) {
+		make_ident(uident, b[i].ident, sizeof(uident), 1);
+		fprintf(o, "#define %s_%s_OFFSET 0x%xU /* %s */\n", up, uident, b[i].offset, b[i].symbol);
+		fprintf(o, "#define %s_%s_SIZE   %uU\n", up, uident, b[i].size);
+		fprintf(o, "#define %s_%s_WORDS  %uU\n", up, uident, (b[i].size + 3) / 4);
+	}
+
+	fprintf(o, "\nstruct %s_nmc {\n", low);
+	for (i=0; i<num; i++)
+		fprintf(o, "\tvolatile uint32_t *%s; /* %u words */\n", 
+			b[i].ident, (b[i].size + 3) / 4);
+	if (!num)
+		fprintf(o, "\tint dummy;\n");
+	fprintf(o, "};\n\n");
+
+	fprintf(o, "static inline void %s_nmc_bind(struct %s_nmc *b, struct easynmc_handle *h)\n{\n", 
+		low, low);
+	for (i=0; i<num; i++) {
+		make_ident(uident, b[i].ident, sizeof(uident), 1);
+		fprintf(o, "\tb->%s = &h->imem32[%s_%s_OFFSET];\n", b[i].ident, up, uident);
+	}
+	if (!num)
+		fprintf(o, "\t(void) b; (void) h;\n");
+	fprintf(o, "}\n\n");
+
+	fprintf(o, "static inline int %s_nmc_check(struct easynmc_handle *h)\n{\n", low);
+	fprintf(o, "\treturn easynmc_get_build_hash(h) == %s_BUILD_HASH;\n}\n\n", up);
+	fprintf(o, "#endif\n");
+}
+
+int main(int argc, char **argv)
+{
+	char *output = NULL;
+	char *abs;
+	struct binding *b;
+	uint32_t hash;
+	Elf *elf;
+	FILE *o = stdout;
+	int fd, num, ret = 1;
+
+	while (1) {
+		int option_index = 0;
+		int c = getopt_long(argc, argv, "hp:m:o:", long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'p':
+			g_prefix = optarg;
+			break;
+		case 'm':
+			if (g_num_matches == MAX_MATCHES) {
+				fprintf(stderr, "Too many --match options\n");
+				return 1;
+			}
+			g_matches[g_num_matches++] = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	abs = argv[optind];
+
+	if (!g_prefix) { 
+		char *dot, *slash = strrchr(abs, '/');
+		g_prefix = strdup(slash ? slash + 1 : abs);
+		if ((dot = strrchr(g_prefix, '.')))
+			*dot = 0;
+	}
+
+	if ((fd = open(abs, O_RDONLY)) == -1) {
+		perror("open");
+		return 1;
+	}
+
+	elf_version(EV_CURRENT);
+	if ((elf = elf_begin(fd, ELF_C_READ, NULL)) == NULL) {
+		fprintf(stderr, "elf_begin() failed: %s\n", elf_errmsg(-1));
+		goto errclose;
+	}
+
+	hash = easynmc_elf_build_hash(elf);
+	num  = collect(elf, &b);
+	if (num < 0) {
+		fprintf(stderr, "Out of memory\n");
+		goto errend;
+	}
+
+	if (output && !(o = fopen(output, "w"))) {
+		perror("fopen");
+		goto errfree;
+	}
+
+	emit(o, abs, hash, b, num);
+	fprintf(stderr, "Exported %d globals, build hash 0x%08x\n", num, hash);
+	ret = 0;
+
+	if (o != stdout)
+		fclose(o);
+errfree:
+	free(b);
+errend:
+	elf_end(elf);
+errclose:
+	close(fd);
+	return ret;
+}
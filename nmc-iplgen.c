@@ -0,0 +1,253 @@
+/*
+ * libEasyNMC DSP communication library.
+ * Copyright (C) 2014  RC "Module"
+ * Written by Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * ut WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Build-time helper, runs on the build host: turns IPL images into the
+ * load plans libeasynmc boots cores with (See easynmc_get_builtin_ipl()).
+ * It is built with HOSTCC, so it parses ELF by itself and doesn't link
+ * against libelf or the library. Section rules must follow
+ * easynmc_section_action().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <elf.h>
+
+#define OVERLAY_PREFIX ".easynmc_overlay."  /* EASYNMC_OVERLAY_PREFIX */
+
+struct chunk {
+	unsigned int addr;  /* words */
+	unsigned int size;  /* bytes */
+	int fill;
+};
+
+void usage(char *nm)
+{
+	fprintf(stderr,
+		"nmc-iplgen - Make built-in IPL load plans for libeasynmc\n"
+		"(c) 2014 RC Module | Andrew 'Necromant' Andrianov <andrew@ncrmnt.org>\n"
+		"This is free software; see the source for copying conditions.  There is NO\n"
+                "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n"
+		"License: LGPLv2 \n"
+		"Usage: %s ipl-(core)[-debug].abs ... > easynmc-ipl-plans.c\n"
+		, nm
+);
+}
+
+static unsigned int get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int get32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static unsigned char *slurp(const char *path, long *len)
+{
+	unsigned char *buf;
+	FILE *fd = fopen(path, "rb");
+
+	if (!fd) {
+		perror(path);
+		return NULL;
+	}
+	fseek(fd, 0, SEEK_END);
+	*len = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	buf = malloc(*len ? *len : 1);
+	if (buf && (fread(buf, 1, *len, fd) != *len)) {
+		fprintf(stderr, "%s: short read\n", path);
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fd);
+	return buf;
+}
+
+/* ipl-K1879-nmc-debug.abs -> K1879-nmc, debug */
+static char *core_name(const char *path, int *debug)
+{
+	const char *base = strrchr(path, '/');
+	char *name;
+	size_t len;
+
+	base = base ? base + 1 : path;
+	if (strncmp(base, "ipl-", 4) != 0)
+		return NULL;
+	name = strdup(base + 4);
+	len = strlen(name);
+	if ((len < 4) || strcmp(&name[len - 4], ".abs")) {
+		free(name);
+		return NULL;
+	}
+	name[len -= 4] = 0;
+	*debug = (len > 6) && !strcmp(&name[len - 6], "-debug");
+	if (*debug)
+		name[len - 6] = 0;
+	return name;
+}
+
+static int emit_image(int n, const char *path)
+{
+	unsigned char *elf, *sh, *strtab;
+	struct chunk *chunks;
+	unsigned int shoff, shentsize, shnum, shstrndx, entry;
+	int i, j, num = 0, debug, ret = -1;
+	char *core;
+	long len;
+
+	core = core_name(path, &debug);
+	if (!core) {
+		fprintf(stderr, "%s: expected ipl-(core)[-debug].abs\n", path);
+		return -1;
+	}
+
+	elf = slurp(path, &len);
+	if (!elf)
+		goto bailout;
+
+	if ((len < sizeof(Elf32_Ehdr)) || memcmp(elf, ELFMAG, SELFMAG) ||
+	    (elf[EI_CLASS] != ELFCLASS32) || (elf[EI_DATA] != ELFDATA2LSB)) {
+		fprintf(stderr, "%s: not a 32-bit little-endian ELF\n", path);
+		goto bailout;
+	}
+
+	entry     = get32(&elf[offsetof(Elf32_Ehdr, e_entry)]);
+	shoff     = get32(&elf[offsetof(Elf32_Ehdr, e_shoff)]);
+	shentsize = get16(&elf[offsetof(Elf32_Ehdr, e_shentsize)]);
+	shnum     = get16(&elf[offsetof(Elf32_Ehdr, e_shnum)]);
+	shstrndx  = get16(&elf[offsetof(Elf32_Ehdr, e_shstrndx)]);
+
+	if ((shentsize < sizeof(Elf32_Shdr)) || (shstrndx >= shnum) ||
+	    ((unsigned long) shoff + (unsigned long) shnum * shentsize > len)) {
+		fprintf(stderr, "%s: bad section headers\n", path);
+		goto bailout;
+	}
+
+	sh = &elf[shoff + shstrndx * shentsize];
+	if ((unsigned long) get32(&sh[offsetof(Elf32_Shdr, sh_offset)]) +
+	    get32(&sh[offsetof(Elf32_Shdr, sh_size)]) > len) {
+		fprintf(stderr, "%s: bad section name table\n", path);
+		goto bailout;
+	}
+	strtab = &elf[get32(&sh[offsetof(Elf32_Shdr, sh_offset)])];
+
+	chunks = calloc(shnum, sizeof(*chunks));
+	if (!chunks)
+		goto bailout;
+
+	printf("/* %s */\n", path);
+
+	/* Section 0 is the null one */
+	for (i = 1; i < shnum; i++) {
+		unsigned int type, addr, offset, size;
+		const char *name;
+
+		sh     = &elf[shoff + i * shentsize];
+		name   = (const char *) &strtab[get32(&sh[offsetof(Elf32_Shdr, sh_name)])];
+		type   = get32(&sh[offsetof(Elf32_Shdr, sh_type)]);
+		addr   = get32(&sh[offsetof(Elf32_Shdr, sh_addr)]);
+		offset = get32(&sh[offsetof(Elf32_Shdr, sh_offset)]);
+		size   = get32(&sh[offsetof(Elf32_Shdr, sh_size)]);
+
+		if (!size || !strcmp(name, ".memBankMap") || !strcmp(name, ".shstrtab") ||
+		    (type == SHT_SYMTAB) || (type == SHT_STRTAB))
+			continue;
+
+		if (!strncmp(name, OVERLAY_PREFIX, strlen(OVERLAY_PREFIX))) {
+			fprintf(stderr, "%s: overlays are not supported in the IPL\n", path);
+			goto bailfree;
+		}
+
+		chunks[num].addr = addr;
+		chunks[num].size = size;
+		chunks[num].fill = !strcmp(name, ".bss") || (type == SHT_NOBITS);
+		if (chunks[num].fill) {
+			num++;
+			continue;
+		}
+
+		if ((unsigned long) offset + size > len) {
+			fprintf(stderr, "%s: section %s is out of file\n", path, name);
+			goto bailfree;
+		}
+
+		/* Aligned, so that writev() can send it to the core directly */
+		printf("static const unsigned char ipl%d_%d[%u] __attribute__((aligned(8))) = {",
+		       n, num, size);
+		for (j = 0; j < size; j++)
+			printf("%s0x%02x,", (j % 12) ? " " : "\n\t", elf[offset + j]);
+		printf("\n};\n\n");
+		num++;
+	}
+
+	printf("static const struct easynmc_iovec ipl%d_iov[] = {\n", n);
+	for (i = 0; i < num; i++) {
+		if (chunks[i].fill)
+			printf("\t{ 0x%x, NULL, %u },\n", chunks[i].addr << 2, chunks[i].size);
+		else
+			printf("\t{ 0x%x, ipl%d_%d, sizeof(ipl%d_%d) },\n",
+			       chunks[i].addr << 2, n, i, n, i);
+	}
+	printf("};\n\n");
+
+	/* main() prints the plan table from these */
+	printf("#define IPL%d_CORE \"%s\"\n#define IPL%d_DEBUG %d\n#define IPL%d_ENTRY 0x%x\n\n",
+	       n, core, n, debug, n, entry);
+	ret = 0;
+
+bailfree:
+	free(chunks);
+bailout:
+	free(elf);
+	free(core);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	printf("/* Generated by nmc-iplgen, do not edit */\n\n"
+	       "#include <stdio.h>\n"
+	       "#include <stdlib.h>\n"
+	       "#include <easynmc.h>\n\n");
+
+	for (i = 1; i < argc; i++)
+		if (0 != emit_image(i, argv[i]))
+			exit(1);
+
+	printf("const struct easynmc_ipl_plan easynmc_ipl_plans[] = {\n");
+	for (i = 1; i < argc; i++)
+		printf("\t{ IPL%d_CORE, IPL%d_DEBUG, ipl%d_iov, ARRAY_SIZE(ipl%d_iov), IPL%d_ENTRY },\n",
+		       i, i, i, i, i);
+	printf("\t{ NULL }\n};\n");
+	return 0;
+}
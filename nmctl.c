@@ -27,12 +27,15 @@
 #include <string.h>
 #include <stdint.h>
 #include <getopt.h>
-#include <sys/epoll.h>
 
 
 int g_debug = 1;
 int g_force = 0; 
 int g_nostdio = 0;
+int g_verify = 0;
+int g_sparse = 0;
+int g_replay_realtime = 0;
+int g_replay_sync = 0;
 static uint32_t entrypoint;
 
 #define dbg(fmt, ...) if (g_debug) { \
@@ -47,63 +50,49 @@ static uint32_t entrypoint;
 #include <easynmc.h>
 
 
-int do_dump_core_info(int coreid, char* optarg) 
+static void print_core_info(struct easynmc_core_info *c)
 {
-	struct easynmc_handle *h = easynmc_open_noboot(coreid);
-	if (!h) { 
-		fprintf(stderr, "easynmc_open() failed\n");
-		return 1;
-	}
-	
-	char name[64];
-	char type[64];
-	int ret;
-
-	ret = ioctl(h->iofd, IOCTL_NMC3_GET_NAME, name);
-	if (ret != 0) {
-		perror("ioctl");
-		return 1;
-	}
-	
-	ret = ioctl(h->iofd, IOCTL_NMC3_GET_TYPE, type);
-	if (ret != 0) {
-		perror("ioctl");
-		return 1;
-	}
-	
-	struct nmc_core_stats stats; 
-	
-	ret = ioctl(h->iofd, IOCTL_NMC3_GET_STATS, &stats);
-	if (ret != 0) {
-		perror("ioctl");
-		return 1;
-	}
-
-	/* Now, let's read some magic bytes */
-	const char *status = easynmc_state_name(easynmc_core_state(h));
-	
 	printf("%d. name: %s type: %s (%s)\n", 
-	       coreid, name, type, status
+	       c->id, c->name, c->type, easynmc_state_name(c->state)
 		);
 	
-	if (stats.started) { 
-		uint32_t codever = h->imem32[NMC_REG_CODEVERSION];
-		printf("   Initcode version: %x, %s\n", codever, 
-		       easynmc_startupcode_is_compatible(codever) ? "compatible" : "incompatible");
+	if (c->started) { 
+		printf("   Initcode version: %x, %s\n", c->codever, 
+		       easynmc_startupcode_is_compatible(c->codever) ? "compatible" : "incompatible");
 	}
 	
 	printf("   IRQs Recv: HP:  %d LP: %d\n",
-	       stats.irqs_recv[NMC_IRQ_HP], 
-	       stats.irqs_recv[NMC_IRQ_LP]
+	       c->stats.irqs_recv[NMC_IRQ_HP], 
+	       c->stats.irqs_recv[NMC_IRQ_LP]
 		);
 	
 	printf("   IRQs Sent: NMI: %d HP: %d LP: %d\n",
-	       stats.irqs_sent[NMC_IRQ_NMI], 
-	       stats.irqs_sent[NMC_IRQ_HP], 
-	       stats.irqs_sent[NMC_IRQ_LP]
+	       c->stats.irqs_sent[NMC_IRQ_NMI], 
+	       c->stats.irqs_sent[NMC_IRQ_HP], 
+	       c->stats.irqs_sent[NMC_IRQ_LP]
 		);
-	
-	easynmc_close(h);
+
+	if (c->has_run_stats) {
+		uint64_t total = (uint64_t) c->run.busy + c->run.idle;
+		printf("   Runs: %u, last run: %u ticks, busy: %.1f%%\n",
+		       c->run.runs, c->run.last, 
+		       total ? 100.0 * c->run.busy / total : 0.0);
+	}
+}
+
+int do_list_cores(void)
+{
+	int i;
+	struct easynmc_inventory *inv = easynmc_inventory_scan();
+	if (!inv) { 
+		fprintf(stderr, "easynmc_inventory_scan() failed\n");
+		return 1;
+	}
+
+	for (i=0; i<inv->num_cores; i++)
+		print_core_info(&inv->cores[i]);
+
+	easynmc_inventory_free(inv);
 	return 0;
 }
 
@@ -144,6 +133,13 @@ int do_dump_ldr_info(int coreid, char* optarg)
 	printf("  ENTRY        %x\n", h->imem32[NMC_REG_PROG_ENTRY]);
 	printf("  RETCODE      %x\n", h->imem32[NMC_REG_PROG_RETURN]);
 
+	if (easynmc_ipl_caps(h) & EASYNMC_IPL_CAP_TIMING) {
+		printf("  RUN_COUNT    %u\n", h->imem32[NMC_REG_RUN_COUNT]);
+		printf("  RUN_LAST     %u\n", h->imem32[NMC_REG_RUN_LAST]);
+		printf("  RUN_BUSY     %u\n", h->imem32[NMC_REG_RUN_BUSY]);
+		printf("  RUN_IDLE     %u\n", h->imem32[NMC_REG_RUN_IDLE]);
+	}
+
 	easynmc_close(h); 
 	return 0;
 }
@@ -179,6 +175,9 @@ int do_load_abs(int coreid, char* optarg)
 
 	if (g_force)
 		flags |= ABSLOAD_FLAG_FORCE;
+
+	if (g_verify)
+		flags |= ABSLOAD_FLAG_VERIFY;
 	
 	/* No args processing in nmctl */
 	
@@ -202,7 +201,17 @@ int do_start_app(int coreid, char* optarg)
 		return 1;
 	}
 	
-	ret = easynmc_start_app(h, entrypoint);	
+	uint32_t ep = entrypoint;
+
+	/* The IPL remembers what was loaded, possibly by another process */
+	ret = easynmc_get_app_entry(h, &ep);
+	if ((ret == 1) || ((ret == -1) && !ep)) {
+		fprintf(stderr, "No app loaded on core %d\n", coreid);
+		easynmc_close(h);
+		return 1;
+	}
+
+	ret = easynmc_start_app(h, ep);	
 	if (ret == 0)
 		printf("NMC app now started!\n");
 	else
@@ -212,6 +221,133 @@ int do_start_app(int coreid, char* optarg)
 	return ret;
 }
 
+int do_snapshot(int coreid, char* optarg)
+{
+	int ret;
+	struct easynmc_handle *h = easynmc_open(coreid);
+	if (!h) { 
+		fprintf(stderr, "easynmc_open() failed\n");
+		return 1;
+	}
+
+	ret = easynmc_snapshot_save(h, optarg, g_force ? EASYNMC_SNAPSHOT_FLAG_FORCE : 0);
+	if (ret == 0) 
+		printf("Core %d memory saved to %s\n", coreid, optarg);
+	else
+		printf("Failed to save core %d memory to %s\n", coreid, optarg);
+
+	easynmc_close(h);
+	return ret;
+}
+
+int do_restore(int coreid, char* optarg)
+{
+	int ret;
+	struct easynmc_handle *h = easynmc_open(coreid);
+	if (!h) { 
+		fprintf(stderr, "easynmc_open() failed\n");
+		return 1;
+	}
+
+	ret = easynmc_snapshot_restore(h, optarg, 
+				       (g_force  ? EASYNMC_SNAPSHOT_FLAG_FORCE  : 0) | 
+				       (g_sparse ? EASYNMC_SNAPSHOT_FLAG_SPARSE : 0));
+	if (ret == 0) 
+		printf("Core %d memory restored from %s\n", coreid, optarg);
+	else
+		printf("Failed to restore core %d memory from %s\n", coreid, optarg);
+
+	easynmc_close(h);
+	return ret;
+}
+
+int do_replay(int coreid, char* optarg)
+{
+	int ret;
+	struct easynmc_replay_opts o;
+	struct easynmc_replay_stats st;
+	struct easynmc_handle *h = easynmc_open(coreid);
+	if (!h) { 
+		fprintf(stderr, "easynmc_open() failed\n");
+		return 1;
+	}
+
+	o.flags = (g_replay_realtime ? EASYNMC_REPLAY_REALTIME : 0) |
+		(g_replay_sync ? EASYNMC_REPLAY_SYNC : 0);
+	o.timeout_ms = 5000;
+	o.stdout_fd  = g_nostdio ? -1 : STDOUT_FILENO;
+
+	ret = easynmc_replay(h, optarg, &o, &st);
+	if (ret == 0) { 
+		fprintf(stderr, "Replayed %llu records in %llu us: %llu uploads, %llu irqs, "
+			"stdin %llu bytes (%llu dropped), stdout %llu bytes, "
+			"events %llu matched %llu missed\n",
+			(unsigned long long) st.records, 
+			(unsigned long long) st.duration_ns / 1000,
+			(unsigned long long) st.uploads, 
+			(unsigned long long) st.irqs,
+			(unsigned long long) st.stdin_bytes, 
+			(unsigned long long) st.stdin_dropped, 
+			(unsigned long long) st.stdout_bytes,
+			(unsigned long long) st.events_matched,
+			(unsigned long long) st.events_missed);
+	} else {
+		fprintf(stderr, "Failed to replay %s on core %d\n", optarg, coreid);
+	}
+
+	easynmc_close(h);
+	return ret;
+}
+
+/* Start all cores at once, see easynmc_start_app_sync() */
+int do_start_all(void)
+{
+	int i, num = 0, ret = 1;
+	struct easynmc_start_report rep;
+	struct easynmc_inventory *inv = easynmc_inventory_scan();
+	struct easynmc_handle **h = NULL;
+	uint32_t *entries = NULL;
+
+	if (!inv)
+		return 1;
+
+	h = calloc(inv->num_cores + 1, sizeof(*h));
+	entries = calloc(inv->num_cores + 1, sizeof(*entries));
+	if (!h || !entries)
+		goto done;
+
+	for (i=0; i<inv->num_cores; i++) {
+		h[num] = easynmc_open(inv->cores[i].id);
+		if (!h[num]) { 
+			fprintf(stderr, "easynmc_open() failed\n");
+			goto done;
+		}
+		entries[num] = entrypoint;
+		ret = easynmc_get_app_entry(h[num], &entries[num]);
+		if ((ret == 1) || ((ret == -1) && !entries[num])) {
+			ret = 1;
+			fprintf(stderr, "No app loaded on core %d\n", h[num]->id);
+			num++;
+			goto done;
+		}
+		num++;
+	}
+
+	ret = easynmc_start_app_sync(h, entries, num, &rep);
+	printf("%d/%d NMC apps started, release took %llu ns, start skew %llu ns\n", 
+	       rep.started, num, 
+	       (unsigned long long) rep.release_ns, 
+	       (unsigned long long) rep.skew_ns);
+
+done:
+	for (i=0; i<num; i++)
+		easynmc_close(h[i]);
+	free(h);
+	free(entries);
+	easynmc_inventory_free(inv);
+	return ret;
+}
+
 int do_irq(int coreid, char* optarg)
 {
 	int ret = 1;
@@ -235,25 +371,24 @@ int do_irq(int coreid, char* optarg)
 	return ret;
 }
 
-int do_mon(int coreid, char* optarg)
+int do_wait(int coreid, char* optarg)
 {
-	int ret = 1;
-	printf("Monitoring events on core %d, CTRL+C to terminate\n", coreid);
+	int ret, code;
+	uint32_t timeout = optarg ? strtoul(optarg, NULL, 0) : UINT32_MAX;
 	struct easynmc_handle *h = easynmc_open(coreid);
 	if (!h) { 
 		fprintf(stderr, "easynmc_open() failed\n");
 		return 1;
 	}
-	int evt;
-	struct easynmc_token *tok = easynmc_token_new(h, EASYNMC_EVT_ALL);
-	while (1) { 
-		evt = easynmc_token_wait(tok, 50000);
-		if (evt != EASYNMC_EVT_TIMEOUT)
-			printf("Event: %s\n", easynmc_evt_name(evt));
-		
-	}
+
+	ret = easynmc_wait_app(h, timeout, &code);
+	if (ret == 0)
+		printf("Core %d: app terminated with result %d\n", coreid, code);
+	else if (ret == -2)
+		printf("Core %d: app still running\n", coreid);
+
 	easynmc_close(h);
-	return ret;	
+	return ret ? 1 : 0;
 }
 
 int do_kill(int coreid, char* optarg)
@@ -284,59 +419,69 @@ done:
 	
 }
 
-#define NUMEVENTS 16
-int do_mon_epoll(int coreid, char* optarg)
+static void mon_event(struct easynmc_handle *h, int evt, void *arg)
 {
-	int ret = 1;
-	printf("Monitoring events on core %d (epoll), CTRL+C to terminate\n", coreid);
-	struct easynmc_handle *h = easynmc_open(coreid);
-	if (!h) { 
-		fprintf(stderr, "easynmc_open() failed\n");
+	printf("Core %d event: %s\n", h->id, easynmc_evt_name(evt));
+}
+
+static void mon_exit(struct easynmc_handle *h, int code, void *arg)
+{
+	printf("Core %d: app terminated with result %d\n", h->id, code);
+}
+
+static struct easynmc_reactor_ops mon_ops = {
+	.on_event = mon_event,
+	.on_exit  = mon_exit,
+};
+
+int do_mon(int coreid)
+{
+	int i, ret = 1, num = 0;
+	struct easynmc_inventory *inv = NULL;
+	struct easynmc_handle **h;
+	struct easynmc_reactor *r = easynmc_reactor_new();
+
+	if (!r)
 		return 1;
+
+	if (coreid == -1) {
+		inv = easynmc_inventory_scan();
+		if (!inv)
+			goto errfree;
+		h = calloc(inv->num_cores, sizeof(*h));
+	} else {
+		h = calloc(1, sizeof(*h));
 	}
-	
-	if (0!=easynmc_pollmark(h))
-		goto errclose;
-
-	struct epoll_event event;
-	struct epoll_event *events;
-	int efd = epoll_create(1);
-	if (efd == -1)
-	{
-		perror ("epoll_create");
-		ret = 1;
-		goto errclose;
+	if (!h)
+		goto errfree;
+
+	for (i = 0; i < (inv ? inv->num_cores : 1); i++) {
+		int id = inv ? inv->cores[i].id : coreid;
+		h[num] = easynmc_open(id);
+		if (!h[num]) { 
+			fprintf(stderr, "easynmc_open() failed for core %d\n", id);
+			goto errclose;
+		}
+		if (0 != easynmc_reactor_add(r, h[num++], &mon_ops, NULL))
+			goto errclose;
 	}
-	
-	event.data.fd = h->memfd;
-	event.events = EPOLLNMI | EPOLLHP | EPOLLLP;
-	ret = epoll_ctl (efd, EPOLL_CTL_ADD, h->memfd, &event);
-	if (ret == -1)
-	{
-		perror ("epoll_ctl");
-		ret = 1;
-		goto errclose;
-	}
-	
-	 events = calloc (NUMEVENTS, sizeof event);
-	 
-	 while (1) { 
-		 int n, i;
-		 n = epoll_wait(efd, events, NUMEVENTS, -1);
-		 for (i = 0; i < n; i++) {
-			 if (events[i].events & EPOLLNMI)
-				 printf("Event: NMI\n");
-			 if (events[i].events & EPOLLLP)
-				 printf("Event: LP\n");
-			 if (events[i].events & EPOLLHP)
-				 printf("Event: HP\n");
-			 if (events[i].events & EPOLLERR)
-				 printf("Event: ERROR\n");
-		 }
-	 }
+
+	if (coreid == -1)
+		printf("Monitoring events on %d cores, CTRL+C to terminate\n", num);
+	else
+		printf("Monitoring events on core %d, CTRL+C to terminate\n", coreid);
+
+	ret = easynmc_reactor_run(r) ? 1 : 0;
+
 errclose:
-	easynmc_close(h);
-	return ret;	
+	for (i = 0; i < num; i++)
+		easynmc_close(h[i]);
+	free(h);
+errfree:
+	if (inv)
+		easynmc_inventory_free(inv);
+	easynmc_reactor_free(r);
+	return ret;
 }
 
 
@@ -349,17 +494,26 @@ static struct option long_options[] =
 	/* Options */
 	{"core",             required_argument,   0, 'c' },
 	{"force",            no_argument,        &g_force,   1 },
+	{"sparse",           no_argument,        &g_sparse,  1 },
 	{"nostdio",          no_argument,        &g_nostdio, 1 },
+	{"verify",           no_argument,        &g_verify,  1 },
+	{"replay-realtime",  no_argument,        &g_replay_realtime, 1 },
+	{"replay-sync",      no_argument,        &g_replay_sync,     1 },
 
 	/* Actual actions */
 	{"boot",             optional_argument,   0, 'b' },
 	{"reset-stats",      no_argument,         0, 'r' },
 	{"load",             required_argument,   0, 'L' },
 	{"start",            required_argument,   0, 's' },
+	{"restart",          no_argument,         0, 'T' },
 	{"irq",              required_argument,   0, 'i' },
 	{"mon",              no_argument,         0, 'm' },
 	{"mon-epoll",        no_argument,         0, 'M' },
 	{"kill",             no_argument,         0, 'k' },
+	{"wait",             optional_argument,   0, 'w' },
+	{"snapshot",         required_argument,   0, 'S' },
+	{"restore",          required_argument,   0, 'R' },
+	{"replay",           required_argument,   0, 'P' },
 
 
 	/* Debugging hacks */
@@ -387,6 +541,10 @@ void usage(char *nm)
 		"  --help             - Show this help\n" 
 		"  --force            - Disable internal seatbelts (DANGEROUS!)\n" 
 		"  --nostdio          - Do not auto-attach stdio\n" 
+		"  --verify           - Check --load by CRC\n"
+		"  --sparse           - Don't zero memory between the ranges of --restore\n"
+		"  --replay-realtime  - Replay with the original timing (Default - max speed)\n"
+		"  --replay-sync      - Wait for recorded events while replaying\n"
 		"  --debug            - print lots of debugging info (nmctl)\n"
 		"  --debug-lib        - print lots of debugging info (libeasynmc)\n"
 		"Valid actions are: \n"
@@ -394,9 +552,14 @@ void usage(char *nm)
 		"  --reset-stats      - Reset driver statistics for core (all cores)\n"
 		"  --load=file.abs    - Load abs file to core internal memory\n"
 		"  --start=file.abs   - Load abs file to core internal memory and start it\n"
+		"  --restart          - Start the app already loaded to the core again\n"
 		"  --irq=[nmi,lp,hp]  - Send an interrupt to NMC\n"
 		"  --kill             - Abort nmc program execution\n"
-		"  --mon              - Monitor IRQs from NMC\n"
+		"  --wait[=ms]        - Wait for the app to terminate and print its result\n"
+		"  --snapshot=file    - Save app memory and IPL registers to a file\n"
+		"  --restore=file     - Restore app memory from a snapshot file\n"
+		"  --replay=file      - Replay a session recorded with nmrun --record\n"
+		"  --mon              - Monitor IRQs and app exits from NMC (all cores)\n"
 		"  --dump-ldr-regs    - Dump init code memory registers\n\n"
 		"ProTIP(tm): You can supply init code file to use via NMC_STARTUPCODE env var\n"
 		"            When no env is set nmctl will search a set of predefined paths\n"
@@ -405,20 +568,14 @@ void usage(char *nm)
 }
 
 static int for_each_core(int (*action)(int, char *), char *optarg) {
-	int i=0;
-	int ret; 
-	char tmp[64];
+	int i;
 	int retcode = 0;
-	do { 
-		/* TODO: Better way to enumerate cores. Current sucks */ 
-		sprintf(tmp, "/dev/nmc%dmem", i);
-		ret = access(tmp, R_OK);
-		if (ret==0)
-			retcode += action(i,optarg);
-		else
-			break;
-		i++;
-	} while (1);
+	struct easynmc_inventory *inv = easynmc_inventory_scan();
+	if (!inv)
+		return 1;
+	for (i=0; i<inv->num_cores; i++)
+		retcode += action(inv->cores[i].id, optarg);
+	easynmc_inventory_free(inv);
 	return retcode;
 }
 
@@ -458,34 +615,52 @@ int main (int argc, char **argv)
 				core = atoi(optarg);
 			break;
 		case 'M':
-			return do_mon_epoll(core, NULL);
 		case 'm':
-			return do_mon(core, NULL);
+			return do_mon(core);
 		case 'r':
 			return for_each_core_optarg(core, do_reset_stats, NULL);
 		case 'k':
 			return for_each_core_optarg(core, do_kill, NULL);
+		case 'w':
+			return for_each_core_optarg(core, do_wait, optarg);
 		case 'i':
 			return for_each_core_optarg(core, do_irq, optarg);			
 		case 'D':
 			return for_each_core_optarg(core, do_dump_ldr_info, NULL);			
 		case 'L':
 		case 's':
-			ret = for_each_core_optarg(core, do_load_abs, optarg);
+		case 'T':
+			ret = (c != 'T') ? for_each_core_optarg(core, do_load_abs, optarg) : 0;
 			/* start */
 			if (ret != 0) {
 				fprintf(stderr, "Failed to load abs file to nmc core(s)\n");
 				return ret;
 			}
-			if (c=='s')
-				ret = for_each_core_optarg(core, do_start_app, optarg);
+			if (c == 'L')
+				return ret;
+			if (core == -1)
+				ret = do_start_all();
+			else
+				ret = do_start_app(core, optarg);
 			return ret; 
 			break;
+		case 'S':
+		case 'R':
+			if (core == -1) {
+				fprintf(stderr, "Snapshots only work with a single core\n");
+				return 1;
+			}
+			return (c == 'S') ? do_snapshot(core, optarg) : do_restore(core, optarg);
+		case 'P':
+			if (core == -1) {
+				fprintf(stderr, "Replay only works with a single core\n");
+				return 1;
+			}
+			return do_replay(core, optarg);
 		case 'b':
 			return for_each_core_optarg(core, do_boot_core, optarg);
 		case 'l':
-			for_each_core(do_dump_core_info, NULL);
-			exit(0);
+			exit(do_list_cores());
 			break;
 		case 'h':
 			usage(argv[0]);
@@ -44,6 +44,15 @@ int g_force = 0;
 int g_nostdio = 0;
 int g_detach  = 0;
 int g_nosigint = 0;
+int g_ovlstats = 0;
+int g_verify = 0;
+char *g_record = NULL;
+
+#define MAX_PARAMS 64
+char *g_params[MAX_PARAMS];
+int g_num_params = 0;
+char *g_input = NULL;
+char *g_output = NULL;
 
 struct easynmc_handle *g_handle = NULL;
 
@@ -69,14 +78,21 @@ void usage(char *nm)
 		"This is free software; see the source for copying conditions.  There is NO\n"
                 "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n"
 		"License: LGPLv2 \n"
-		"Usage: %s [options] myapp.abs [arguments]   - operate on core 0 (default)\n"
+		"Usage: %s [options] myapp.abs [arguments]   - run on first unused core (default)\n"
 		"Valid options are: \n"
 		"  --help             - Show this help\n" 
 		"  --core=id          - Select a core to operate on (Default - use first usused core)\n"
 		"  --force            - Disable internal seatbelts (DANGEROUS!)\n" 
 		"  --nostdio          - Do not auto-attach stdio\n" 
+		"  --verify           - Check the upload by CRC before start\n"
 		"  --nosigint         - Do not catch SIGINT\n"
 		"  --detach           - Run app in background (do not attach console)\n"
+		"  --record=file      - Record the session for nmctl --replay\n"
+		"  --overlay-stats    - Print overlay hit/miss counters when the app exits\n"
+		"  --input=file       - Copy file to the app input section before start\n"
+		"  --output=file      - Save the app output section to file after exit\n"
+		"  --param=key=value  - Set a typed parameter, may be repeated. Values are\n"
+		"                       [i:|f:|d:|s:]value[,value...], see easynmc_params_parse()\n"
 		"Debugging options: \n"
 		"  --debug            - Print lots of debugging info (nmctl)\n"
 		"  --debug-lib        - Print lots of debugging info (libeasynmc)\n"
@@ -93,8 +109,14 @@ static struct option long_options[] =
 	{"core",             required_argument,   0, 'c' },
 	{"force",            no_argument,        &g_force,    1 },
 	{"nostdio",          no_argument,        &g_nostdio,  1 },
+	{"verify",           no_argument,        &g_verify,   1 },
 	{"nosigint",         no_argument,        &g_nosigint, 1 },
 	{"detach",           no_argument,        &g_detach,   1 },
+	{"record",           required_argument,   0,         'R' },
+	{"overlay-stats",    no_argument,        &g_ovlstats, 1 },
+	{"param",            required_argument,   0,         'p' },
+	{"input",            required_argument,   0,         'i' },
+	{"output",           required_argument,   0,         'o' },
 
 	/* Debugging hacks */
 	{"debug-lib",        no_argument,        &g_libeasynmc_debug, 1 },
@@ -130,6 +152,30 @@ void nonblock(int fd, int state)
 
 }
 
+void print_overlay_stats(struct easynmc_handle *h)
+{
+	struct easynmc_overlay_stats st;
+	uint32_t ids[256];
+	int i, n = easynmc_overlay_list(h, ids, ARRAY_SIZE(ids));
+
+	if (n > ARRAY_SIZE(ids))
+		n = ARRAY_SIZE(ids);
+
+	fprintf(stderr, "%8s %10s %10s %10s %12s %6s\n", 
+		"overlay", "hits", "loads", "evictions", "bytes", "slot");
+	for (i = 0; i <= n; i++) {
+		int id = (i < n) ? ids[i] : EASYNMC_OVERLAY_ALL;
+		if (0 != easynmc_overlay_stats(h, id, &st))
+			continue;
+		if (i < n)
+			fprintf(stderr, "%8d ", id);
+		else
+			fprintf(stderr, "%8s ", "total");
+		fprintf(stderr, "%10u %10u %10u %12llu %6d\n", st.hits, st.loads, 
+			st.evictions, (unsigned long long) st.bytes, st.slot);
+	}
+}
+
 void die()
 {
 	fprintf(stderr, "\nCTRL+C pressed, terminating app\n");
@@ -149,150 +195,136 @@ void  handle_sigint(int sig)
 	die();
 }
 
-#define NUMEVENTS 3
+struct console {
+	struct easynmc_reactor *r;
+	struct easynmc_handle  *h;
+	unsigned char tonmc[1024];
+	int gotfromstdin;
+	int written_to_nmc;
+	int ret;
+};
 
+static void console_stdout(struct easynmc_handle *h, char *buf, int len, void *arg)
+{
+	easynmc_record(h, EASYNMC_REC_STDOUT, 0, 0, buf, len);
+	if (write(STDOUT_FILENO, buf, len) != len)
+		perror("write-to-stdout");
+}
+
+static void console_terminal(int fd, uint32_t events, void *arg);
 
-int read_inbound(int fd) 
+static void console_stdin(struct easynmc_handle *h, void *arg)
 {
-	unsigned char fromnmc[1024];
-	do { 
-		int n;
-		n = read(fd, fromnmc, 1024); 
-		if (n == -1) {
-			if (errno==EAGAIN)
-				break;
-			else {
-				perror("read-from-nmc");
-				return errno;
-			}
+	struct console *con = arg;
+	int n = write(h->iofd, &con->tonmc[con->written_to_nmc], 
+		      con->gotfromstdin - con->written_to_nmc);
+
+	if (n > 0) {
+		easynmc_record(h, EASYNMC_REC_STDIN, 0, 0, 
+			       &con->tonmc[con->written_to_nmc], n);
+		con->written_to_nmc += n;
+		if (con->written_to_nmc == con->gotfromstdin) {
+			/* All sent, read some more */
+			con->gotfromstdin   = 0;
+			con->written_to_nmc = 0;
+			easynmc_reactor_want_stdin(con->r, h, 0);
+			easynmc_reactor_add_fd(con->r, STDIN_FILENO, EPOLLIN, console_terminal, con);
 		}
-		write(STDOUT_FILENO, fromnmc, n);
-	} while (1);
-	return 0;
+	} else if ((n == -1) && (errno != EAGAIN)) {
+		perror("write-to-nmc");
+		con->ret = 1;
+		easynmc_reactor_stop(con->r);
+	}
 }
 
-/* DO NOT SAY ANYTHING. Please ;) */
-int run_interactive_console(struct easynmc_handle *h)
+static void console_terminal(int fd, uint32_t events, void *arg)
 {
-	int i;
+	struct console *con = arg;
+	int n = read(fd, con->tonmc, sizeof(con->tonmc));
+
+	if ((n == -1) && (errno == EAGAIN))
+		return;
+
+	if (n == -1) { 
+		perror("read-from-stdin");
+		con->ret = 1;
+		easynmc_reactor_stop(con->r);
+		return;
+	}
+
+	/* Nothing more to read until this lot is sent, or ever on EOF */
+	easynmc_reactor_remove_fd(con->r, fd);
+	if (n == 0)
+		return;
+
+	if (isatty(fd) && con->tonmc[0] == 3)
+		die();
+
+	con->gotfromstdin = n;
+	easynmc_reactor_want_stdin(con->r, con->h, 1);
+}
+
+static void console_event(struct easynmc_handle *h, int evt, void *arg)
+{
+	/* The app may be waiting for an overlay */
+	easynmc_overlay_service(h);
+}
+
+static void console_exit(struct easynmc_handle *h, int code, void *arg)
+{
+	struct console *con = arg;
+	fprintf(stderr, "App terminated with result %d, exiting\n", code);
+	con->ret = code;
+	easynmc_reactor_remove(con->r, h);
+}
+
+static struct easynmc_reactor_ops console_ops = {
+	.on_stdout = console_stdout,
+	.on_stdin  = console_stdin,
+	.on_event  = console_event,
+	.on_exit   = console_exit,
+};
+
+int run_interactive_console(struct easynmc_handle *h, uint32_t entrypoint)
+{
+	struct console con;
 	int ret = 1;
-	struct epoll_event event[3];
-	struct epoll_event *events;
-	int efd = epoll_create(2);
+
+	memset(&con, 0x0, sizeof(con));
 	setvbuf(stdin,NULL,_IONBF,0);
 
-	if (efd == -1)
-	{
-		perror ("epoll_create");
-		ret = 1;
-		goto errclose;
-	}
-	
-	int flags = fcntl(h->iofd, F_GETFL, 0);
-	fcntl(h->iofd, F_SETFL, flags | O_NONBLOCK);
+	con.h = h;
+	con.r = easynmc_reactor_new();
+	if (!con.r)
+		return 1;
 
 	if (!isatty(STDIN_FILENO)) {
-		flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-		fcntl(h->iofd, F_SETFL, flags | O_NONBLOCK);
+		int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+		fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
 	} else { 
 		nonblock(STDIN_FILENO,   1);
 	}
 
-	event[0].data.fd = h->iofd;
-	event[0].events  = EPOLLIN | EPOLLOUT | EPOLLET;
+	if ((0 != easynmc_reactor_add(con.r, h, &console_ops, &con)) ||
+	    (0 != easynmc_reactor_add_fd(con.r, STDIN_FILENO, EPOLLIN, console_terminal, &con)))
+		goto errfree;
 
-	event[1].data.fd = h->memfd;
-	event[1].events  = EPOLLNMI | EPOLLHP | EPOLLET;
-	
-	event[2].data.fd = STDIN_FILENO;
-	event[2].events  = EPOLLIN | EPOLLET;
-	
-	for (i = 0; i < 3; i++) { 
-		ret = epoll_ctl (efd, EPOLL_CTL_ADD, event[i].data.fd, &event[i]);
-		if (ret == -1)
-		{
-			perror ("epoll_ctl");
-			ret = 1;
-			goto errclose;
-		}
+	/* Started only now, so that no early exit or overlay request is missed */
+	if (0 != easynmc_reactor_start_app(con.r, h, entrypoint)) {
+		fprintf(stderr, "Failed to start app (\n");
+		easynmc_reactor_free(con.r);
+		exit(1);
 	}
+	fprintf(stderr, "Application now started, hit CTRL+C to %s it\n", g_nosigint ? "detach" : "stop");
 
-	events = calloc (NUMEVENTS, sizeof event);
-	 
-	int can_read_stdin    = 0;
-	int can_write_to_nmc  = 0;
-
-	int gotfromstdin = 0; 
-	int written_to_nmc = 0;
-	unsigned char   tonmc[1024];
-	 
-	while (1) { 
-		int num, i;
-		num = epoll_wait(efd, events, NUMEVENTS, -1);
-		for (i = 0; i < num; i++) {
-			if ((events[i].data.fd == STDIN_FILENO) && (events[i].events & EPOLLIN))
-				can_read_stdin=1;
-			 
-			if (can_read_stdin && !gotfromstdin) 
-			{ 
-				gotfromstdin = read(STDIN_FILENO, tonmc, 1024);
-				if (isatty(STDIN_FILENO) && tonmc[0] == 3)
-					die();
-				
-				if (-1 == gotfromstdin) { 
-					perror("read-from-stdin");
-					return 1;
-				}
-			}
+	if (0 != easynmc_reactor_run(con.r))
+		goto errfree;
 
-			if (events[i].data.fd == h->iofd && (events[i].events & EPOLLIN)) {
-				ret = read_inbound(h->iofd);
-				if (ret != 0)
-					return ret;
-			}
-			 
-			if (events[i].data.fd == h->iofd && (events[i].events & EPOLLOUT)) 
-				can_write_to_nmc++;
-			 			 
-			if ((events[i].data.fd == h->memfd) &&
-			    easynmc_core_state(h) == EASYNMC_CORE_IDLE) { 
-				/* 
-				 * Read any bytes left in circular buffer.
-				 */
-				ret = read_inbound(h->iofd);
-				if ( ret != 0)
-					return ret;
-				
-				ret = easynmc_exitcode(h);				
-				fprintf(stderr, "App terminated with result %d, exiting\n", ret);
-
-				return ret;
-			}
+	ret = con.ret;
 
-			if (can_write_to_nmc && (written_to_nmc != gotfromstdin)) {
-				int n = write(h->iofd, &tonmc[written_to_nmc], 
-					      gotfromstdin - written_to_nmc);
-
-				if (n > 0) {
-					written_to_nmc += n;			 
-					if (written_to_nmc == gotfromstdin) {
-						gotfromstdin   = 0;
-						written_to_nmc = 0;
-					}
-				}
-				else if (errno == EAGAIN) {
-					break;
-				} else {
-					perror("write-to-nmc");
-					return 1;
-				}
-			}
-		}
-	}
-	
-errclose:
-	easynmc_close(h);
-	return ret;	
+errfree:
+	easynmc_reactor_free(con.r);
+	return ret;
 }
 
 
@@ -300,7 +332,7 @@ errclose:
 
 int main(int argc, char **argv)
 {
-	int core = 0; // EASYNMC_CORE_ANY; /* Default - use first available core */
+	int core = EASYNMC_CORE_ANY; /* Default - use first available core */
 	int ret; 
 	char* self = "nmrun";
 
@@ -326,6 +358,22 @@ int main(int argc, char **argv)
 			else
 				core = atoi(optarg);
 			break;
+		case 'R':
+			g_record = optarg;
+			break;
+		case 'i':
+			g_input = optarg;
+			break;
+		case 'o':
+			g_output = optarg;
+			break;
+		case 'p':
+			if (g_num_params == MAX_PARAMS) {
+				fprintf(stderr, "Too many parameters\n");
+				exit(1);
+			}
+			g_params[g_num_params++] = optarg;
+			break;
 		case 'h':
 			usage(argv[0]);
 			exit(1);
@@ -336,6 +384,11 @@ int main(int argc, char **argv)
 		}        
 	}
 
+	if (g_output && g_detach) {
+		fprintf(stderr, "--output needs to wait for the app, can't --detach\n");
+		exit(1);
+	}
+
 	char* absfile = argv[optind++];	
 	int num_args = argc - optind;
 	char **args = &argv[optind];
@@ -345,11 +398,35 @@ int main(int argc, char **argv)
 	if (g_nostdio)
 		flags &= ~(ABSLOAD_FLAG_STDIO);
 
+	if (g_verify)
+		flags |= ABSLOAD_FLAG_VERIFY;
+
 	struct easynmc_handle *h = easynmc_open(core); 
 	g_handle = h;
 
 	if (!h) {
-		fprintf(stderr, "Failed to open core %d\n", core);
+		if (core == EASYNMC_CORE_ANY)
+			fprintf(stderr, "Failed to find an unused core\n");
+		else
+			fprintf(stderr, "Failed to open core %d\n", core);
+		exit(1);
+	}
+
+	/* 
+	 * Explicitly selected cores get reserved, too. Without a usable 
+	 * lock directory go on, as easynmc_open() does 
+	 */
+	ret = easynmc_reserve_core(h);
+	if (ret == 1) { 
+		fprintf(stderr, "Core %d is reserved by another process\n", h->id);
+		exit(1);
+	} else if (ret != 0) {
+		fprintf(stderr, "WARN: Core %d can't be reserved, using it anyway\n", h->id);
+	}
+	dbg("Using core %d\n", h->id);
+
+	if (g_record && (easynmc_record_start(h, g_record) != 0)) {
+		fprintf(stderr, "Failed to start recording to %s\n", g_record);
 		exit(1);
 	}
 	
@@ -366,9 +443,25 @@ int main(int argc, char **argv)
 	}
 
 	ret = easynmc_set_args(h, self, num_args, args);
-	if (ret != 0) { 
+	if (ret == -3) {
+		fprintf(stderr, "Failed to write arguments to the core\n");
+		exit(1);
+	} else if (ret != 0) { 
 		fprintf(stderr, "WARN: Failed to set arguments. Not supported by app?\n");		
 	}
+
+	int i;
+	for (i = 0; i < g_num_params; i++) {
+		if (0 != easynmc_params_parse(h, g_params[i])) {
+			fprintf(stderr, "Failed to set parameter %s\n", g_params[i]);
+			exit(1);
+		}
+	}
+
+	if (g_input && (0 != easynmc_input_load(h, g_input))) {
+		fprintf(stderr, "Failed to load input from %s\n", g_input);
+		exit(1);
+	}
 	
 	ret = easynmc_pollmark(h);
 	
@@ -378,22 +471,24 @@ int main(int argc, char **argv)
 	};
 
 
-	ret = easynmc_start_app(h, entrypoint);
-	if (ret != 0) { 
-		fprintf(stderr, "Failed to start app (\n");
-		exit(1);
-	}
-
-	ret = 0;
-
 	if (!g_nosigint)
 		signal(SIGINT, handle_sigint);
 
 
 	if (!g_detach) { 
-		fprintf(stderr, "Application now started, hit CTRL+C to %s it\n", g_nosigint ? "detach" : "stop");
-		ret = run_interactive_console(h);
+		ret = run_interactive_console(h, entrypoint);
+		if (g_ovlstats)
+			print_overlay_stats(h);
+		if (g_output && (0 != easynmc_output_save(h, g_output))) {
+			fprintf(stderr, "Failed to save output to %s\n", g_output);
+			ret = 1;
+		}
 	} else { 
+		ret = easynmc_start_app(h, entrypoint);
+		if (ret != 0) { 
+			fprintf(stderr, "Failed to start app (\n");
+			exit(1);
+		}
 		fprintf(stderr, "Application started, detaching\n");
 	}
 	